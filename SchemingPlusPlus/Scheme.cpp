@@ -1,5 +1,9 @@
 #include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <charconv>
 #include <exception>
+#include <iterator>
 #include <stdexcept>
 
 #include "Scheme.h"
@@ -23,7 +27,9 @@ namespace SchemingPlusPlus {
 				case STRING: return "STRING";
 				case INTEGER: return "INTEGER";
 				case FLOAT: return "FLOAT";
+				case BIGINT: return "BIGINT";
 				case LIST: return "LIST";
+				case PAIR: return "PAIR";
 				case LAMBDA: return "LAMBDA";
 				case MACRO: return "MACRO";
 				case PROC: return "PROC";
@@ -61,51 +67,71 @@ namespace SchemingPlusPlus {
 
 		/// Scheme Runtime methods
 		TokenVector Tokenise(const std::string &str) SCHEME_THROW {
-			TokenVector tokens;
-			const char *s = str.c_str();
-			while (*s) {
-				while (isspace(*s))
+			TokenViewVector views(TokeniseView(str));
+			return TokenVector(views.cbegin(), views.cend());
+		}
+
+		TokenViewVector TokeniseView(std::string_view source) SCHEME_THROW {
+			TokenViewVector tokens;
+			// Typical source has a token for every few characters; reserving avoids most regrowth
+			tokens.reserve(source.size() / 4);
+			const char *s = source.data();
+			const char *end = s + source.size();
+			while (s != end) {
+				if (isspace((unsigned char)*s)) {
 					++s;
-				if (*s == ';' && *(s+1) == ';')
-					while (*s && *s != '\n' && *s != '\r') ++s;
-				else if (*s == '(' || *s == ')')
-					tokens.push_back(*s++ == '(' ? "(" : ")");
-				else if (*s == '"' || *s == '\'') {
-					const char *t = s;
-					const char sp = *s;
-					int escape = 0;
-					do {
+					continue;
+				}
+				const char *t = s + 1;
+				if (*s == ';' && t != end && *t == ';') {
+					while (t != end && *t != '\n' && *t != '\r')
 						++t;
-						if (escape != 0) escape--;
-						if(*t == '\\')
-							escape = 2; // skip this and the next character
-					} while (*t && (escape != 0 || *t != sp));
-					++t;
-					tokens.push_back(std::string(s, t));
 					s = t;
+					continue;
+				} else if (*s == '(' || *s == ')') {
+					// Single character token
+				} else if (*s == QUOTE_DOUBLE || *s == QUOTE_SINGLE) {
+					// Up to the matching quote; a backslash escapes the character after it
+					for (; t != end && *t != *s; ++t) {
+						if (*t == '\\' && t + 1 != end)
+							++t;
+					}
+					if (t != end)
+						++t;
 				} else {
-					const char *t = s;
-					while (*t && !isspace(*t) && *t != '(' && *t != ')')
+					while (t != end && !isspace((unsigned char)*t) && *t != '(' && *t != ')')
 						++t;
-					tokens.push_back(std::string(s, t));
-					s = t;
 				}
+				tokens.emplace_back(s, t - s);
+				s = t;
 			}
 			return tokens;
 		}
 
-		SchemeCell Atom(const std::string &token) SCHEME_THROW {
-			if (isdigit(token[0]) || (token[0] == '-' && isdigit(token[1]))) {
-				// Number
-				if (token.find(".") == std::string::npos)
-					return SchemeCell(token, INTEGER);
-				return SchemeCell(token, FLOAT);
+		SchemeCell Atom(std::string_view token) SCHEME_THROW {
+			runtime_assert(token.empty() == false);
+			if (isdigit((unsigned char)token[0]) || (token[0] == '-' && token.size() > 1 && isdigit((unsigned char)token[1]))) {
+				// Number: parsed once here, kept unboxed in the cell
+				const char *start = token.data();
+				const char *end = start + token.size();
+				IntegerType intval;
+				std::from_chars_result result = std::from_chars(start, end, intval);
+				if (result.ptr == end)
+					return result.ec == std::errc() ? SchemeCell(intval) : SchemeCell(std::string(token), BIGINT);
+				FloatType fltval;
+				result = std::from_chars(start, end, fltval);
+				if (result.ptr == end) {
+					if (result.ec == std::errc())
+						return SchemeCell(fltval);
+					// Out of range: infinity or zero, as strtod gives
+					return SchemeCell((FloatType)strtod(std::string(token).c_str(), nullptr));
+				}
+				// Not a well formed number, such as 1+; treat as a symbol
 			} else if (token[0] == QUOTE_DOUBLE) { // "String"
-				auto len = token.length();
-				runtime_assert(token[len - 1] == QUOTE_DOUBLE);
-				return SchemeCell(token.substr(1, len - 2), STRING);
-			}	
-			return SchemeCell(token, SYMBOL);
+				runtime_assert(token.size() > 1 && token.back() == QUOTE_DOUBLE);
+				return SchemeCell(std::string(token.substr(1, token.size() - 2)), STRING);
+			}
+			return SchemeCell(std::string(token), SYMBOL);
 		}
 
 		SchemeCell ReadFrom(TokenVector &tokens) SCHEME_THROW {
@@ -126,9 +152,40 @@ namespace SchemingPlusPlus {
 			return Atom(token);
 		}
 
-		SchemeCell Read(const std::string &s) SCHEME_THROW {
-			TokenVector tokens(Tokenise(s));
-			return ReadFrom(tokens);
+		SchemeCell ReadFrom(const TokenViewVector &tokens, size_t &position) SCHEME_THROW {
+			// Elements of every list still open share one stack; starts holds where
+			// each open list begins, innermost last. Each list is built once, at its
+			// final size, and nothing recurses, so deep nesting cannot overflow the C++ stack.
+			VectorType elements;
+			std::vector<size_t> starts;
+			for (;;) {
+				runtime_assert(position < tokens.size());
+				std::string_view token = tokens[position++];
+				if (token == "(") {
+					starts.push_back(elements.size());
+					continue;
+				}
+				if (token == ")") {
+					runtime_assert(starts.empty() == false);
+					auto start = elements.begin() + starts.back();
+					starts.pop_back();
+					SchemeCell list(VectorType(std::make_move_iterator(start), std::make_move_iterator(elements.end())));
+					elements.erase(start, elements.end());
+					if (starts.empty())
+						return list;
+					elements.push_back(std::move(list));
+					continue;
+				}
+				if (starts.empty())
+					return Atom(token);
+				elements.push_back(Atom(token));
+			}
+		}
+
+		SchemeCell Read(std::string_view s) SCHEME_THROW {
+			TokenViewVector tokens(TokeniseView(s));
+			size_t position = 0;
+			return ReadFrom(tokens, position);
 		}
 	}
 }
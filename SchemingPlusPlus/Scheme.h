@@ -1,14 +1,22 @@
 #pragma once
 
+#include <cstdint>
 #include <list>
 #include <map>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <stdexcept>
 #include <vector>
 
 #if _MSC_VER
 #define COMPILER_MSC
+#endif
+
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+// Dynamic exception specifications were removed in C++17
+#define THROW(x)
+#elif defined(COMPILER_MSC)
 #define THROW(x) throw(...)
 #else
 #define THROW(x) throw(x)
@@ -23,7 +31,9 @@ namespace SchemingPlusPlus {
 			STRING,
 			INTEGER,
 			FLOAT,
+			BIGINT,
 			LIST,
+			PAIR,
 			LAMBDA,
 			MACRO,
 			PROC,
@@ -39,12 +49,35 @@ namespace SchemingPlusPlus {
 		std::string enquote(std::string str, char start = QUOTE_DOUBLE, char end = QUOTE_DOUBLE);
 
 		struct SchemeCell;
+		struct SchemePair;
+		class SchemeBigInt;
 		class SchemeEnvironment;
+		class SchemeMarker;
+
+		// Evaluator specific compiled form of a lambda or macro body, attached
+		// to the closure cell so it is only built once.
+		struct SchemeCompiled {
+			enum Kinds {
+				BYTECODE,    // SchemeCode, see SchemeCompiler
+				ANALYZED     // SchemeAnalyzed, see SchemeAnalyzeEval
+			};
+			const Kinds Kind;
+			mutable uint32_t Mark = 0; // see SchemeHeap
+			SchemeCompiled(Kinds kind) : Kind(kind) { }
+			virtual ~SchemeCompiled() { }
+			// Mark the values this code refers to
+			virtual void Trace(SchemeMarker &) const { }
+		};
 
-		typedef long long IntegerType;
+		typedef int64_t IntegerType;
 		typedef double FloatType;
+		typedef uint32_t AtomType;
 		typedef std::vector<SchemeCell> VectorType;
-		typedef std::shared_ptr<SchemeEnvironment> EnvironmentType;
+		// Environments are owned by SchemeHeap and freed by its collector
+		typedef SchemeEnvironment *EnvironmentType;
+		typedef std::shared_ptr<const SchemeCompiled> CompiledType;
+		typedef std::shared_ptr<SchemePair> PairType;
+		typedef std::shared_ptr<const SchemeBigInt> BigIntType;
 		typedef SchemeCell(*ProcType)(const VectorType &);
 		typedef SchemeCell(*ProcEnvType)(const VectorType &, EnvironmentType);
 
@@ -57,7 +90,8 @@ namespace SchemingPlusPlus {
 			CRIT_INVALID_COERCE,
 			CRIT_INVALID_INDEX,
 			CRIT_INVALID_PROC,
-			CRIT_OP_INVALID
+			CRIT_OP_INVALID,
+			CRIT_SYNTAX
 		};
 
 		class critical_error : public std::runtime_error {
@@ -73,6 +107,7 @@ namespace SchemingPlusPlus {
 					case CRIT_INVALID_INDEX: return "Index out of range";
 					case CRIT_INVALID_PROC: return "Proc not valid";
 					case CRIT_OP_INVALID: return "Invalid operation";
+					case CRIT_SYNTAX: return "Syntax error";
 				}
 				std::string message = "(Unknown: ";
 				message += std::to_string(code);
@@ -88,9 +123,14 @@ namespace SchemingPlusPlus {
 
 		typedef std::list<std::string> TokenVector;
 		TokenVector Tokenise(const std::string &str) SCHEME_THROW;
-		SchemeCell Atom(const std::string &token) SCHEME_THROW;
+		// Tokens as views into the text they were scanned from, which must outlive them
+		typedef std::vector<std::string_view> TokenViewVector;
+		TokenViewVector TokeniseView(std::string_view source) SCHEME_THROW;
+		SchemeCell Atom(std::string_view token) SCHEME_THROW;
 		SchemeCell ReadFrom(TokenVector &tokens) SCHEME_THROW;
-		SchemeCell Read(const std::string &s) SCHEME_THROW;
+		// Read the expression starting at tokens[position], leaving position just past it
+		SchemeCell ReadFrom(const TokenViewVector &tokens, size_t &position) SCHEME_THROW;
+		SchemeCell Read(std::string_view s) SCHEME_THROW;
 
 		struct SchemeConstants {
 			static std::string NilValue;
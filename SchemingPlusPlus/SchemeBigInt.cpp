@@ -0,0 +1,329 @@
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+
+#include "SchemeAssert.h"
+#include "SchemeBigInt.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		namespace {
+			typedef SchemeBigInt::LimbType LimbType;
+			typedef SchemeBigInt::LimbsType LimbsType;
+			const uint64_t Base = SchemeBigInt::Base;
+
+			void Trim(LimbsType &limbs) {
+				while (!limbs.empty() && limbs.back() == 0)
+					limbs.pop_back();
+			}
+
+			int CompareMagnitude(const LimbsType &a, const LimbsType &b) {
+				if (a.size() != b.size())
+					return a.size() < b.size() ? -1 : 1;
+				for (size_t i = a.size(); i-- > 0; ) {
+					if (a[i] != b[i])
+						return a[i] < b[i] ? -1 : 1;
+				}
+				return 0;
+			}
+
+			LimbsType AddMagnitude(const LimbsType &a, const LimbsType &b) {
+				const LimbsType &longer = a.size() >= b.size() ? a : b;
+				const LimbsType &shorter = a.size() >= b.size() ? b : a;
+				LimbsType result(longer.size() + 1);
+				LimbType carry = 0;
+				for (size_t i = 0; i < longer.size(); ++i) {
+					LimbType sum = longer[i] + (i < shorter.size() ? shorter[i] : 0) + carry;
+					carry = sum >= Base ? 1 : 0;
+					result[i] = carry ? sum - (LimbType)Base : sum;
+				}
+				result[longer.size()] = carry;
+				Trim(result);
+				return result;
+			}
+
+			// a - b, where a >= b
+			LimbsType SubMagnitude(const LimbsType &a, const LimbsType &b) {
+				LimbsType result(a.size());
+				int64_t borrow = 0;
+				for (size_t i = 0; i < a.size(); ++i) {
+					int64_t diff = (int64_t)a[i] - (i < b.size() ? b[i] : 0) - borrow;
+					borrow = diff < 0 ? 1 : 0;
+					result[i] = (LimbType)(diff + borrow * (int64_t)Base);
+				}
+				Trim(result);
+				return result;
+			}
+
+			// out[0, na + nb) += a * b
+			void MulSchool(const LimbType *a, size_t na, const LimbType *b, size_t nb, LimbType *out) {
+				for (size_t i = 0; i < na; ++i) {
+					uint64_t carry = 0;
+					const uint64_t ai = a[i];
+					if (ai == 0) continue;
+					size_t j = 0;
+					for (; j < nb; ++j) {
+						uint64_t cur = out[i + j] + ai * b[j] + carry;
+						out[i + j] = (LimbType)(cur % Base);
+						carry = cur / Base;
+					}
+					for (size_t k = i + j; carry != 0; ++k) {
+						uint64_t cur = out[k] + carry;
+						out[k] = (LimbType)(cur % Base);
+						carry = cur / Base;
+					}
+				}
+			}
+
+			// out[offset, ...) += value; out is large enough to absorb the carry
+			void AddAt(LimbsType &out, const LimbsType &value, size_t offset) {
+				LimbType carry = 0;
+				size_t i = 0;
+				for (; i < value.size() || carry != 0; ++i) {
+					LimbType sum = out[offset + i] + (i < value.size() ? value[i] : 0) + carry;
+					carry = sum >= Base ? 1 : 0;
+					out[offset + i] = carry ? sum - (LimbType)Base : sum;
+				}
+			}
+
+			LimbsType Slice(const LimbsType &limbs, size_t start, size_t end) {
+				start = std::min(start, limbs.size());
+				end = std::min(end, limbs.size());
+				LimbsType result(limbs.begin() + start, limbs.begin() + end);
+				Trim(result);
+				return result;
+			}
+
+			LimbsType MulMagnitude(const LimbsType &a, const LimbsType &b) {
+				if (a.empty() || b.empty())
+					return LimbsType();
+				const LimbsType &longer = a.size() >= b.size() ? a : b;
+				const LimbsType &shorter = a.size() >= b.size() ? b : a;
+				LimbsType result(longer.size() + shorter.size() + 1);
+				if (shorter.size() < SchemeBigInt::KaratsubaThreshold) {
+					MulSchool(longer.data(), longer.size(), shorter.data(), shorter.size(), result.data());
+				} else if (shorter.size() * 2 <= longer.size()) {
+					// Unbalanced: multiply shorter-sized chunks of the longer operand
+					for (size_t start = 0; start < longer.size(); start += shorter.size())
+						AddAt(result, MulMagnitude(Slice(longer, start, start + shorter.size()), shorter), start);
+				} else {
+					// Karatsuba: (a1 B + a0)(b1 B + b0) = z2 B^2 + z1 B + z0,
+					// with z1 = (a1 + a0)(b1 + b0) - z2 - z0
+					const size_t half = longer.size() / 2;
+					LimbsType a0 = Slice(longer, 0, half), a1 = Slice(longer, half, longer.size());
+					LimbsType b0 = Slice(shorter, 0, half), b1 = Slice(shorter, half, shorter.size());
+					LimbsType z0 = MulMagnitude(a0, b0);
+					LimbsType z2 = MulMagnitude(a1, b1);
+					LimbsType z1 = MulMagnitude(AddMagnitude(a0, a1), AddMagnitude(b0, b1));
+					z1 = SubMagnitude(SubMagnitude(z1, z0), z2);
+					AddAt(result, z0, 0);
+					AddAt(result, z1, half);
+					AddAt(result, z2, half * 2);
+				}
+				Trim(result);
+				return result;
+			}
+
+			// a * factor, factor < Base
+			LimbsType MulSmall(const LimbsType &a, LimbType factor) {
+				LimbsType result(a.size() + 1);
+				uint64_t carry = 0;
+				for (size_t i = 0; i < a.size(); ++i) {
+					uint64_t cur = (uint64_t)a[i] * factor + carry;
+					result[i] = (LimbType)(cur % Base);
+					carry = cur / Base;
+				}
+				result[a.size()] = (LimbType)carry;
+				Trim(result);
+				return result;
+			}
+
+			// Schoolbook long division of magnitudes; each quotient limb is found by binary search
+			LimbsType DivMagnitude(const LimbsType &a, const LimbsType &b) {
+				if (CompareMagnitude(a, b) < 0)
+					return LimbsType();
+				LimbsType quotient(a.size());
+				LimbsType remainder;
+				for (size_t i = a.size(); i-- > 0; ) {
+					remainder.insert(remainder.begin(), a[i]);
+					Trim(remainder);
+					LimbType low = 0, high = (LimbType)(Base - 1);
+					while (low < high) {
+						LimbType mid = low + (high - low + 1) / 2;
+						if (CompareMagnitude(MulSmall(b, mid), remainder) <= 0)
+							low = mid;
+						else
+							high = mid - 1;
+					}
+					quotient[i] = low;
+					if (low != 0)
+						remainder = SubMagnitude(remainder, MulSmall(b, low));
+				}
+				Trim(quotient);
+				return quotient;
+			}
+		}
+
+		SchemeBigInt::SchemeBigInt(IntegerType value) : _negative(value < 0) {
+			// Negate as unsigned so the most negative value does not overflow
+			uint64_t magnitude = _negative ? 0 - (uint64_t)value : (uint64_t)value;
+			while (magnitude != 0) {
+				_limbs.push_back((LimbType)(magnitude % Base));
+				magnitude /= Base;
+			}
+		}
+
+		SchemeBigInt::SchemeBigInt(bool negative, LimbsType &&limbs) : _negative(negative), _limbs(std::move(limbs)) {
+			Trim(_limbs);
+			if (_limbs.empty())
+				_negative = false;
+		}
+
+		SchemeBigInt SchemeBigInt::Parse(const std::string &text) SCHEME_THROW {
+			size_t start = (!text.empty() && (text[0] == '-' || text[0] == '+')) ? 1 : 0;
+			runtime_assert(text.size() > start);
+			LimbsType limbs;
+			limbs.reserve((text.size() - start) / BaseDigits + 1);
+			// Limbs are BaseDigits digits each, starting from the least significant end
+			for (size_t end = text.size(); end > start; ) {
+				size_t begin = end > start + BaseDigits ? end - BaseDigits : start;
+				LimbType limb = 0;
+				for (size_t i = begin; i < end; ++i) {
+					if (text[i] < '0' || text[i] > '9')
+						throw critical_error(CRIT_INVALID_COERCE, "Not an integer: " + text);
+					limb = limb * 10 + (text[i] - '0');
+				}
+				limbs.push_back(limb);
+				end = begin;
+			}
+			return SchemeBigInt(text[0] == '-', std::move(limbs));
+		}
+
+		std::string SchemeBigInt::ToString() const {
+			if (_limbs.empty())
+				return "0";
+			std::string result;
+			result.reserve(_limbs.size() * BaseDigits + 1);
+			if (_negative)
+				result += '-';
+			char buffer[16];
+			std::snprintf(buffer, sizeof(buffer), "%u", (unsigned)_limbs.back());
+			result += buffer;
+			for (size_t i = _limbs.size() - 1; i-- > 0; ) {
+				std::snprintf(buffer, sizeof(buffer), "%09u", (unsigned)_limbs[i]);
+				result += buffer;
+			}
+			return result;
+		}
+
+		bool SchemeBigInt::FitsInteger() const {
+			static const SchemeBigInt min(std::numeric_limits<IntegerType>::min());
+			static const SchemeBigInt max(std::numeric_limits<IntegerType>::max());
+			return Compare(*this, min) >= 0 && Compare(*this, max) <= 0;
+		}
+
+		IntegerType SchemeBigInt::ToInteger() const {
+			if (!FitsInteger())
+				return _negative ? std::numeric_limits<IntegerType>::min() : std::numeric_limits<IntegerType>::max();
+			uint64_t magnitude = 0;
+			for (size_t i = _limbs.size(); i-- > 0; )
+				magnitude = magnitude * Base + _limbs[i];
+			return _negative ? (IntegerType)(0 - magnitude) : (IntegerType)magnitude;
+		}
+
+		FloatType SchemeBigInt::ToFloat() const {
+			FloatType value = 0;
+			for (size_t i = _limbs.size(); i-- > 0; )
+				value = value * Base + _limbs[i];
+			return _negative ? -value : value;
+		}
+
+		int SchemeBigInt::Compare(const SchemeBigInt &a, const SchemeBigInt &b) {
+			if (a._negative != b._negative)
+				return a._negative ? -1 : 1;
+			int magnitude = CompareMagnitude(a._limbs, b._limbs);
+			return a._negative ? -magnitude : magnitude;
+		}
+
+		SchemeBigInt SchemeBigInt::AddSigned(const SchemeBigInt &a, const SchemeBigInt &b, bool negate_b) {
+			bool b_negative = b._negative != negate_b;
+			if (a._negative == b_negative)
+				return SchemeBigInt(a._negative, AddMagnitude(a._limbs, b._limbs));
+			// Signs differ: subtract the smaller magnitude from the larger
+			if (CompareMagnitude(a._limbs, b._limbs) >= 0)
+				return SchemeBigInt(a._negative, SubMagnitude(a._limbs, b._limbs));
+			return SchemeBigInt(b_negative, SubMagnitude(b._limbs, a._limbs));
+		}
+
+		SchemeBigInt SchemeBigInt::operator + (const SchemeBigInt &other) const {
+			return AddSigned(*this, other, false);
+		}
+
+		SchemeBigInt SchemeBigInt::operator - (const SchemeBigInt &other) const {
+			return AddSigned(*this, other, true);
+		}
+
+		SchemeBigInt SchemeBigInt::operator * (const SchemeBigInt &other) const {
+			if (other._limbs.size() == 1)
+				return SchemeBigInt(_negative != other._negative, MulSmall(_limbs, other._limbs[0]));
+			if (_limbs.size() == 1)
+				return SchemeBigInt(_negative != other._negative, MulSmall(other._limbs, _limbs[0]));
+			return SchemeBigInt(_negative != other._negative, MulMagnitude(_limbs, other._limbs));
+		}
+
+		SchemeBigInt SchemeBigInt::operator / (const SchemeBigInt &other) const SCHEME_THROW {
+			if (other.IsZero())
+				throw critical_error(CRIT_OP_INVALID, ToString() + " / 0");
+			return SchemeBigInt(_negative != other._negative, DivMagnitude(_limbs, other._limbs));
+		}
+
+		SchemeBigInt SchemeBigInt::operator - () const {
+			SchemeBigInt result(*this);
+			if (!result._limbs.empty())
+				result._negative = !result._negative;
+			return result;
+		}
+
+		bool SchemeBigInt::AddInteger(IntegerType a, IntegerType b, IntegerType &result) {
+#if defined(__GNUC__) || defined(__clang__)
+			return !__builtin_add_overflow(a, b, &result);
+#else
+			if ((b > 0 && a > std::numeric_limits<IntegerType>::max() - b) ||
+				(b < 0 && a < std::numeric_limits<IntegerType>::min() - b))
+				return false;
+			result = a + b;
+			return true;
+#endif
+		}
+
+		bool SchemeBigInt::SubInteger(IntegerType a, IntegerType b, IntegerType &result) {
+#if defined(__GNUC__) || defined(__clang__)
+			return !__builtin_sub_overflow(a, b, &result);
+#else
+			if ((b < 0 && a > std::numeric_limits<IntegerType>::max() + b) ||
+				(b > 0 && a < std::numeric_limits<IntegerType>::min() + b))
+				return false;
+			result = a - b;
+			return true;
+#endif
+		}
+
+		bool SchemeBigInt::MulInteger(IntegerType a, IntegerType b, IntegerType &result) {
+#if defined(__GNUC__) || defined(__clang__)
+			return !__builtin_mul_overflow(a, b, &result);
+#else
+			if (a != 0 && b != 0) {
+				const IntegerType max = std::numeric_limits<IntegerType>::max();
+				const IntegerType min = std::numeric_limits<IntegerType>::min();
+				if ((a == -1 && b == min) || (b == -1 && a == min))
+					return false;
+				if (a > 0 ? (b > 0 ? a > max / b : b < min / a)
+						  : (b > 0 ? a < min / b : a < max / b))
+					return false;
+			}
+			result = a * b;
+			return true;
+#endif
+		}
+	}
+}
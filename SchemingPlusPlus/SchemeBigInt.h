@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Scheme.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		// Arbitrary precision integer, the payload of BIGINT cells.
+		//
+		// The magnitude is held in base 10^9 limbs, least significant first, so
+		// conversion to and from decimal text is linear. Multiplication is
+		// schoolbook for small operands and Karatsuba above KaratsubaThreshold limbs.
+		class SchemeBigInt {
+		public:
+			typedef uint32_t LimbType;
+			typedef std::vector<LimbType> LimbsType;
+			static const LimbType Base = 1000000000;
+			static const size_t BaseDigits = 9;
+			static const size_t KaratsubaThreshold = 40;
+
+			SchemeBigInt() : _negative(false) { }
+			explicit SchemeBigInt(IntegerType value);
+
+			// Decimal text with an optional leading '-'
+			static SchemeBigInt Parse(const std::string &text) SCHEME_THROW;
+			std::string ToString() const;
+
+			bool IsZero() const { return _limbs.empty(); }
+			bool IsNegative() const { return _negative; }
+			// True if the value is within the range of IntegerType
+			bool FitsInteger() const;
+			// The value if FitsInteger, otherwise the nearest IntegerType
+			IntegerType ToInteger() const;
+			FloatType ToFloat() const;
+
+			// -1, 0 or 1 as a is less than, equal to or greater than b
+			static int Compare(const SchemeBigInt &a, const SchemeBigInt &b);
+
+			SchemeBigInt operator + (const SchemeBigInt &other) const;
+			SchemeBigInt operator - (const SchemeBigInt &other) const;
+			SchemeBigInt operator * (const SchemeBigInt &other) const;
+			// Truncating division, as for IntegerType
+			SchemeBigInt operator / (const SchemeBigInt &other) const SCHEME_THROW;
+			SchemeBigInt operator - () const;
+
+			// IntegerType arithmetic that reports overflow rather than wrapping.
+			// Returns false, leaving result unspecified, if the result does not fit.
+			static bool AddInteger(IntegerType a, IntegerType b, IntegerType &result);
+			static bool SubInteger(IntegerType a, IntegerType b, IntegerType &result);
+			static bool MulInteger(IntegerType a, IntegerType b, IntegerType &result);
+
+		private:
+			bool _negative;
+			LimbsType _limbs; // magnitude; no high zero limbs, so zero is empty
+
+			SchemeBigInt(bool negative, LimbsType &&limbs);
+			static SchemeBigInt AddSigned(const SchemeBigInt &a, const SchemeBigInt &b, bool negate_b);
+		};
+	}
+}
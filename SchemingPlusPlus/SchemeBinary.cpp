@@ -0,0 +1,100 @@
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+#include "SchemeBinary.h"
+
+#ifndef COMPILER_MSC
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		void SchemeBinaryWriter::Varint(uint64_t value) {
+			while (value >= 0x80) {
+				Data += (char)(uint8_t)(value | 0x80);
+				value >>= 7;
+			}
+			Data += (char)(uint8_t)value;
+		}
+
+		void SchemeBinaryWriter::Float(FloatType value) {
+			uint64_t bits;
+			std::memcpy(&bits, &value, sizeof(bits));
+			for (int i = 0; i < 8; ++i)
+				Data += (char)(uint8_t)(bits >> (8 * i));
+		}
+
+		uint64_t SchemeBinaryReader::Varint() SCHEME_THROW {
+			uint64_t value = 0;
+			for (unsigned shift = 0; shift < 64; shift += 7) {
+				uint8_t byte = Byte();
+				value |= (uint64_t)(byte & 0x7f) << shift;
+				if ((byte & 0x80) == 0)
+					return value;
+			}
+			throw critical_error(CRIT_SYNTAX, std::string("binary varint too long"));
+		}
+
+		FloatType SchemeBinaryReader::Float() SCHEME_THROW {
+			std::string_view bytes = Bytes(8);
+			uint64_t bits = 0;
+			for (int i = 0; i < 8; ++i)
+				bits |= (uint64_t)(uint8_t)bytes[i] << (8 * i);
+			FloatType value;
+			std::memcpy(&value, &bits, sizeof(value));
+			return value;
+		}
+
+		SchemeMappedFile::SchemeMappedFile(const std::string &path) {
+#ifdef COMPILER_MSC
+			std::ifstream file(path, std::ios::binary);
+			if (file)
+				_copy.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+			_data = _copy;
+#else
+			int fd = open(path.c_str(), O_RDONLY);
+			if (fd < 0)
+				return;
+			struct stat info;
+			if (fstat(fd, &info) == 0 && info.st_size > 0) {
+				void *map = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (map != MAP_FAILED) {
+					_map = map;
+					_data = std::string_view(static_cast<const char*>(map), (size_t)info.st_size);
+				}
+			}
+			close(fd);
+#endif
+		}
+
+		SchemeMappedFile::~SchemeMappedFile() {
+#ifndef COMPILER_MSC
+			if (_map != nullptr)
+				munmap(_map, _data.size());
+#endif
+		}
+
+		bool WriteFileAtomic(const std::string &path, std::string_view data) {
+			namespace fs = std::filesystem;
+			const std::string temporary = path + ".tmp";
+			std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+			if (!out)
+				return false;
+			out.write(data.data(), (std::streamsize)data.size());
+			out.close();
+			std::error_code error;
+			if (out)
+				fs::rename(temporary, path, error);
+			if (!out || error) {
+				fs::remove(temporary, error);
+				return false;
+			}
+			return true;
+		}
+	}
+}
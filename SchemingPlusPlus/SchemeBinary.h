@@ -0,0 +1,92 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "Scheme.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		// Encoding shared by the binary formats (SchemeFasl, SchemeImage).
+		// Unsigned integers are LEB128 varints, signed ones zigzag encoded varints,
+		// floats 8 bytes of IEEE 754 little endian, text a length then its bytes.
+		class SchemeBinaryWriter {
+		public:
+			std::string Data;
+
+			void Byte(uint8_t value) { Data += (char)value; }
+			void Varint(uint64_t value);
+			void Signed(int64_t value) { Varint(((uint64_t)value << 1) ^ (uint64_t)(value >> 63)); }
+			void Float(FloatType value);
+			void Text(std::string_view text) {
+				Varint(text.size());
+				Data.append(text.data(), text.size());
+			}
+		};
+
+		// Reads what SchemeBinaryWriter wrote. Every read is bounds checked:
+		// reading past the end throws CRIT_SYNTAX.
+		class SchemeBinaryReader {
+		public:
+			SchemeBinaryReader(std::string_view data) : _p(data.data()), _end(data.data() + data.size()) { }
+
+			uint8_t Byte() SCHEME_THROW {
+				Need(1);
+				return (uint8_t)*_p++;
+			}
+			uint64_t Varint() SCHEME_THROW;
+			int64_t Signed() SCHEME_THROW {
+				uint64_t bits = Varint();
+				return (int64_t)((bits >> 1) ^ (0 - (bits & 1)));
+			}
+			FloatType Float() SCHEME_THROW;
+			std::string_view Bytes(uint64_t size) SCHEME_THROW {
+				Need(size);
+				std::string_view bytes(_p, (size_t)size);
+				_p += size;
+				return bytes;
+			}
+			std::string_view Text() SCHEME_THROW { return Bytes(Varint()); }
+			// A count of items each at least one byte long, checked against what remains
+			uint64_t Count() SCHEME_THROW {
+				uint64_t count = Varint();
+				Need(count);
+				return count;
+			}
+			bool AtEnd() const { return _p == _end; }
+
+		private:
+			const char *_p;
+			const char *_end;
+
+			void Need(uint64_t size) SCHEME_THROW {
+				if ((uint64_t)(_end - _p) < size)
+					throw critical_error(CRIT_SYNTAX, std::string("binary data truncated"));
+			}
+		};
+
+		// The bytes of a file, mapped into memory where the platform allows.
+		// Empty if the file cannot be read.
+		class SchemeMappedFile {
+		public:
+			explicit SchemeMappedFile(const std::string &path);
+			~SchemeMappedFile();
+			SchemeMappedFile(const SchemeMappedFile &) = delete;
+			SchemeMappedFile &operator = (const SchemeMappedFile &) = delete;
+
+			std::string_view Data() const { return _data; }
+
+		private:
+			std::string_view _data;
+#ifdef COMPILER_MSC
+			std::string _copy;
+#else
+			void *_map = nullptr;
+#endif
+		};
+
+		// Write data to path through a temporary file and a rename, so that
+		// readers never see part of it. False if it could not be written.
+		bool WriteFileAtomic(const std::string &path, std::string_view data);
+	}
+}
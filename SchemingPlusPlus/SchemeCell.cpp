@@ -1,3 +1,6 @@
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
 #include <numeric>
 #include <ostream>
 #include <string>
@@ -8,12 +11,203 @@
 
 namespace SchemingPlusPlus {
 	namespace Core {
+		// Shortest text that reads back as the same double, always showing a decimal point or exponent.
+		static std::string FormatFloat(FloatType value) {
+			char buffer[32];
+			for (int precision = 1; precision <= 17; ++precision) {
+				std::snprintf(buffer, sizeof(buffer), "%.*g", precision, value);
+				if (std::strtod(buffer, nullptr) == value)
+					break;
+			}
+			std::string result;
+			bool fraction = false;
+			for (const char *s = buffer; *s; ++s) {
+				if (*s == '.' || *s == 'n' || *s == 'i')
+					fraction = true;
+				if (*s == 'e') {
+					// 1e+10 => 1e10, 1e-05 => 1e-5
+					fraction = true;
+					result += *s++;
+					if (*s == '+') ++s;
+					else if (*s == '-') result += *s++;
+					while (*s == '0' && *(s + 1)) ++s;
+					result += s;
+					break;
+				}
+				result += *s;
+			}
+			if (!fraction)
+				result += ".0";
+			return result;
+		}
+
+		IntegerType SchemeCell::ParseInteger(const std::string &text) {
+			return (IntegerType)std::strtoll(text.c_str(), nullptr, 10);
+		}
+
+		FloatType SchemeCell::ParseFloat(const std::string &text) {
+			return (FloatType)std::strtod(text.c_str(), nullptr);
+		}
+
+		SchemeBigInt SchemeCell::ParseBigInt(const std::string &text) {
+			// As strtoll: optional leading space and sign, then digits up to the first non-digit
+			size_t start = text.find_first_not_of(" \t\r\n");
+			if (start == std::string::npos)
+				return SchemeBigInt();
+			size_t digits = start + (text[start] == '-' || text[start] == '+' ? 1 : 0);
+			size_t end = text.find_first_not_of("0123456789", digits);
+			if (end == digits)
+				return SchemeBigInt();
+			return SchemeBigInt::Parse(text.substr(start, (end == std::string::npos ? text.size() : end) - start));
+		}
+
+		SchemeBigInt SchemeCell::ToBigInt() const {
+			return Type == BIGINT ? *BigValue : SchemeBigInt(ToInteger());
+		}
+
+		void SchemeCell::SetInteger(const SchemeBigInt &value) {
+			if (value.FitsInteger()) {
+				Type = INTEGER;
+				IntegerValue = value.ToInteger();
+				BigValue = nullptr;
+			} else {
+				Type = BIGINT;
+				IntegerValue = 0;
+				BigValue = std::make_shared<const SchemeBigInt>(value);
+			}
+		}
+
+		int SchemeCell::NumericCompare(const SchemeCell &a, const SchemeCell &b) {
+			if (a.Type == FLOAT || b.Type == FLOAT) {
+				FloatType x = a.ToFloat(), y = b.ToFloat();
+				return x < y ? -1 : (x > y ? 1 : 0);
+			}
+			if (a.Type != BIGINT && b.Type != BIGINT) {
+				IntegerType x = a.ToInteger(), y = b.ToInteger();
+				return x < y ? -1 : (x > y ? 1 : 0);
+			}
+			return SchemeBigInt::Compare(a.ToBigInt(), b.ToBigInt());
+		}
+
+		SchemeCell &SchemeCell::ApplyNumeric(const SchemeCell &other, NumericOp op) SCHEME_THROW {
+			if (!IsNumber())
+				throw critical_error(CRIT_TYPE_NOT_IMPL, *this);
+			if (Type == FLOAT || other.Type == FLOAT) {
+				FloatType a = ToFloat(), b = other.ToFloat();
+				switch (op) {
+					case NUMERIC_ADD: FloatValue = a + b; break;
+					case NUMERIC_SUB: FloatValue = a - b; break;
+					case NUMERIC_MUL: FloatValue = a * b; break;
+					case NUMERIC_DIV: FloatValue = a / b; break;
+				}
+				Type = FLOAT;
+				BigValue = nullptr;
+				return *this;
+			}
+			if (Type == INTEGER && other.Type != BIGINT) {
+				IntegerType a = IntegerValue, b = other.ToInteger();
+				bool fits = false;
+				switch (op) {
+					case NUMERIC_ADD: fits = SchemeBigInt::AddInteger(a, b, IntegerValue); break;
+					case NUMERIC_SUB: fits = SchemeBigInt::SubInteger(a, b, IntegerValue); break;
+					case NUMERIC_MUL: fits = SchemeBigInt::MulInteger(a, b, IntegerValue); break;
+					case NUMERIC_DIV:
+						if (b == 0)
+							throw critical_error(CRIT_OP_INVALID, ToString() + " / 0");
+						// The most negative value divided by -1 is the only quotient that overflows
+						fits = !(b == -1 && a == std::numeric_limits<IntegerType>::min());
+						if (fits)
+							IntegerValue = a / b;
+						break;
+				}
+				if (fits)
+					return *this;
+				IntegerValue = a;
+			}
+			// Overflowed, or already big: redo the operation at full precision
+			SchemeBigInt a = ToBigInt(), b = other.ToBigInt();
+			switch (op) {
+				case NUMERIC_ADD: SetInteger(a + b); break;
+				case NUMERIC_SUB: SetInteger(a - b); break;
+				case NUMERIC_MUL: SetInteger(a * b); break;
+				case NUMERIC_DIV: SetInteger(a / b); break;
+			}
+			return *this;
+		}
+
+		size_t SchemeCell::Size() const {
+			if (Type == PAIR) {
+				size_t size = 0;
+				const SchemeCell *cell = this;
+				for (; cell->Type == PAIR; cell = &cell->PairValue->Tail)
+					++size;
+				return size + cell->ListValue.size();
+			}
+			if (!IsList()) return 0;
+			return ListValue.size();
+		}
+
+		const SchemeCell &SchemeCell::Head() const {
+			if (Type == PAIR) return PairValue->Head;
+			if (Empty()) return SchemeConstants::Nil;
+			// Type should always be LIST here
+			return ListValue.front();
+		}
+
+		SchemeCell SchemeCell::Tail() const {
+			if (Type == PAIR) return PairValue->Tail;
+			if (Empty()) return SchemeCell("", LIST);
+			return Cons(ListValue.cbegin() + 1, ListValue.cend(), SchemeCell("", LIST));
+		}
+
+		SchemeCell SchemeCell::Cons(const SchemeCell &head, const SchemeCell &tail) {
+			SchemeCell result(PAIR);
+			// Anything but a list conses onto the empty list, as append and cons always have
+			result.PairValue = std::make_shared<SchemePair>(head, tail.IsSequence() ? tail : SchemeCell("", LIST));
+			return result;
+		}
+
+		SchemeCell SchemeCell::Cons(VectorType::const_iterator start, VectorType::const_iterator end, const SchemeCell &tail) {
+			SchemeCell result = tail;
+			while (end != start)
+				result = Cons(*--end, result);
+			return result;
+		}
+
+		SchemeCell SchemeCell::Closure(const SchemeCell &form, EnvironmentType env) SCHEME_THROW {
+			runtime_assert(form.Type == LIST && form.ListValue.size() > 2);
+			SchemeCell result(form.ListValue[0].AtomValue == ATOM_MACRO ? MACRO : LAMBDA);
+			result.PairValue = Cons(form.ListValue.cbegin() + 1, form.ListValue.cbegin() + 3, SchemeCell("", LIST)).PairValue;
+			result.Environment = env;
+			return result;
+		}
+
+		SchemeCell SchemeCell::ToList() const {
+			if (Type != PAIR) return *this;
+			SchemeCell result("", LIST);
+			const SchemeCell *cell = this;
+			for (; cell->Type == PAIR; cell = &cell->PairValue->Tail)
+				result.ListValue.push_back(cell->PairValue->Head);
+			result.ListValue.insert(result.ListValue.end(), cell->ListValue.cbegin(), cell->ListValue.cend());
+			return result;
+		}
+
+		SchemePair::~SchemePair() {
+			// Unlink a chain this pair owns alone one pair at a time, rather than
+			// recursing through the destructors of a long list.
+			PairType next = std::move(Tail.PairValue);
+			while (next != nullptr && next.use_count() == 1)
+				next = std::move(next->Tail.PairValue);
+		}
+
 		std::string SchemeCell::ToString(bool expr) const SCHEME_THROW {
 			switch (Type) {
 				case SYMBOL: return Value;
 				case STRING: return expr ? enquote(Value) : Value;
-				case INTEGER: // Fall through
-				case FLOAT: return Value;
+				case INTEGER: return std::to_string(IntegerValue);
+				case FLOAT: return FormatFloat(FloatValue);
+				case BIGINT: return BigValue->ToString();
+				case PAIR: return ToList().ToString(expr);
 				case LIST: {
 					std::string result = "(";
 					auto conv = [expr] (const SchemeCell &cell) { return cell.ToString(expr); };
@@ -32,8 +226,9 @@ namespace SchemingPlusPlus {
 					std::string result = "(";
 					if (Type == LAMBDA) result += "lambda ";
 					else if (Type == MACRO) result += "macro ";
-					result += Head().ToString(expr);
-					result += Tail().Head().ToString(expr);
+					result += Params().ToString(expr);
+					result += " ";
+					result += Body().ToString(expr);
 					result += ")";
 					return result;
 				}
@@ -1,263 +1,361 @@
-#pragma once
-
-#include <ostream>
-
-#include "Scheme.h"
-#include "SchemeRuntime.h"
-
-namespace SchemingPlusPlus {
-	namespace Core {
-		struct SchemeCell {
-		public:
-			CellType Type;
-			std::string Value;
-			VectorType ListValue;
-			ProcType ProcValue;
-			ProcEnvType ProcEnvValue;
-			EnvironmentType Environment;
-
-			SchemeCell() : SchemeCell("") { }
-
-			SchemeCell(const std::string &value, CellType type = SYMBOL) {
-				Type = type;
-				Value = value;
-				ListValue = VectorType();
-				ProcValue = nullptr;
-				ProcEnvValue = nullptr;
-				Environment = nullptr;
-			}
-
-			SchemeCell(const bool value)
-				: SchemeCell(value ? SchemeConstants::TrueValue : SchemeConstants::FalseValue) {}
-
-			SchemeCell(const IntegerType value)
-				: SchemeCell(std::to_string(value), INTEGER) {}
-
-			SchemeCell(const VectorType &value, CellType type = LIST) {
-				Type = type;
-				Value = "";
-				ListValue = value;
-				ProcValue = nullptr;
-				ProcEnvValue = nullptr;
-				Environment = nullptr;
-			}
-
-			SchemeCell(VectorType::const_iterator start, VectorType::const_iterator end, CellType type = LIST) {
-				Type = type;
-				Value = "";
-				ListValue = VectorType(start, end);
-				ProcValue = nullptr;
-				ProcEnvValue = nullptr;
-				Environment = nullptr;
-			}
-
-			SchemeCell(ProcType proc) {
-				Type = PROC;
-				Value = "";
-				ListValue = VectorType();
-				ProcValue = proc;
-				ProcEnvValue = nullptr;
-				Environment = nullptr;
-			}
-
-			SchemeCell(ProcEnvType proc) {
-				Type = PROCENV;
-				Value = "";
-				ListValue = VectorType();
-				ProcValue = nullptr;
-				ProcEnvValue = proc;
-				Environment = nullptr;
-			}
-
-			SchemeCell(CellType type)
-				: SchemeCell("", type) {}
-
-			SchemeCell(EnvironmentType env) {
-				Type = ENVPTR;
-				Value = "";
-				ListValue = VectorType();
-				ProcValue = nullptr;
-				ProcEnvValue = nullptr;
-				Environment = env;
-			}
-
-			SchemeCell(const SchemeCell &other) {
-				Type = other.Type;
-				Value = other.Value;
-				ListValue = other.ListValue;
-				ProcValue = other.ProcValue;
-				ProcEnvValue = other.ProcEnvValue;
-				Environment = other.Environment;
-			}
-
-			SchemeCell coerce(CellType to) const SCHEME_THROW {
-				// Basic types are already stored as strings. No conversion needed.
-				if (SchemeRuntime::IsBasicType(Type) && SchemeRuntime::IsBasicType(to))
-					return *this;
-				// TODO - coerce other types
-				std::string message = "Conversion not implemented from ";
-				message += std::to_string(Type);
-				message += " to ";
-				message += std::to_string(to);
-				throw critical_error(CRIT_INVALID_COERCE, message);
-			}
-
-			// Operators
-			bool operator == (const SchemeCell &other) const SCHEME_THROW {
-				if (Type != other.Type) {
-					if (SchemeRuntime::CanCoerce(Type, other.Type)) {
-						const SchemeCell &coerced = other.coerce(Type);
-						return *this == coerced;
-					}
-				}
-				switch (Type) {
-					case INTEGER: return ToInteger() == other.ToInteger();
-					case FLOAT: return ToFloat() == other.ToFloat();
-					case SYMBOL: /* Fall through */
-					case STRING: return Value == other.Value;
-					case LAMBDA: /* Fall through */
-					case MACRO: return Environment == other.Environment && ListValue == other.ListValue;
-					case LIST: return ListValue == other.ListValue;
-					case PROC: return ProcValue == other.ProcValue;
-					case PROCENV: return ProcEnvValue == other.ProcEnvValue;
-					case ENVPTR: return Environment == other.Environment;
-					default:
-						throw critical_error(CRIT_TYPE_NOT_IMPL, *this);
-				}
-			}
-
-			bool operator != (const SchemeCell &other) const SCHEME_THROW {
-				return !(*this == other);
-			}
-
-			SchemeCell &operator += (const SchemeCell &other) SCHEME_THROW {
-				if (Type == INTEGER) {
-					IntegerType intval = other.ToInteger();
-					Value = std::to_string(ToInteger() + intval);
-				} else if (Type == FLOAT) {
-					FloatType fltval = other.ToFloat();
-					Value = std::to_string(ToFloat() + fltval);
-				} else if (Type == STRING) {
-					Value += other.Value;
-				} else if (Type == LIST) {
-					ListValue.insert(ListValue.end(), other.ListValue);
-				} else {
-					throw critical_error(CRIT_TYPE_NOT_IMPL, *this);
-				}
-				return *this;
-			}
-
-			SchemeCell &operator -= (const SchemeCell &other) SCHEME_THROW {
-				if (Type == INTEGER) {
-					IntegerType intval = other.ToInteger();
-					Value = std::to_string(ToInteger() - intval);
-				} else if (Type == FLOAT) {
-					FloatType fltval = other.ToFloat();
-					Value = std::to_string(ToFloat() - fltval);
-				} else {
-					throw critical_error(CRIT_TYPE_NOT_IMPL, *this);
-				}
-				return *this;
-			}
-
-			SchemeCell &operator *= (const SchemeCell &other) SCHEME_THROW {
-				if (Type == INTEGER) {
-					IntegerType intval = other.ToInteger();
-					Value = std::to_string(ToInteger() * intval);
-				} else if (Type == FLOAT) {
-					FloatType fltval = other.ToFloat();
-					Value = std::to_string(ToFloat() * fltval);
-				} else {
-					throw critical_error(CRIT_TYPE_NOT_IMPL, *this);
-				}
-				return *this;
-			}
-
-			SchemeCell &operator /= (const SchemeCell &other) SCHEME_THROW {
-				if (Type == INTEGER) {
-					IntegerType intval = other.ToInteger();
-					Value = std::to_string(ToInteger() / intval);
-				} else if (Type == FLOAT) {
-					FloatType fltval = other.ToFloat();
-					Value = std::to_string(ToFloat() / fltval);
-				} else {
-					throw critical_error(CRIT_TYPE_NOT_IMPL, *this);
-				}
-				return *this;
-			}
-
-			SchemeCell &operator [](VectorType::size_type index) SCHEME_THROW {
-				if (!IsList()) return SchemeConstants::Nil;
-				try {
-					return ListValue[index];
-				} catch (...) {
-					throw critical_error(CRIT_INVALID_INDEX, *this);
-				}
-			}
-			SchemeCell operator [](VectorType::size_type index) const SCHEME_THROW {
-				if (!IsList()) return SchemeConstants::Nil;
-				try {
-					return ListValue[index];
-				} catch (...) {
-					throw critical_error(CRIT_INVALID_INDEX, *this);
-				}
-			}
-
-			operator IntegerType() const { return ToInteger(); }
-			IntegerType ToInteger() const {
-				if (Type == FLOAT)
-					return (IntegerType)ToFloat();
-				try {
-					return std::stoll(Value);
-				} catch (...) {
-					return 0;
-				}
-			}
-
-			operator FloatType() const { return ToFloat(); }
-			FloatType ToFloat() const {
-				if (Type != FLOAT)
-					return (FloatType)ToInteger();
-				try {
-					return std::stod(Value);
-				} catch (...) {
-					return 0;
-				}
-			}
-			// Convert to string. Pass true to return as expression.
-			std::string ToString(bool expr = false) const SCHEME_THROW;
-
-			// List functions
-			bool IsList() const {
-				return (Type == LIST || Type == LAMBDA || Type == MACRO);
-			}
-			bool Empty() const { return Type != LIST || ListValue.empty(); }
-			size_t Size() const {
-				if (!IsList()) return 0;
-				return ListValue.size();
-			}
-			bool SizeAtLeast(size_t size) const {
-				// if (!IsList()) return false;
-				size_t index = 0;
-				for (auto it = ListValue.cbegin(); it != ListValue.cend() && index < size; ++it)
-					++index;
-				return index == size;
-			}
-			SchemeCell Head() const {
-				if (Empty()) return SchemeConstants::Nil;
-				// Type should always be LIST here
-				return ListValue.front();
-			}
-			SchemeCell HeadOr(SchemeCell &r) const {
-				if (Empty()) return r;
-				return ListValue.front();
-			}
-			SchemeCell Tail() const {
-				if (Empty()) return SchemeCell("", LIST);
-				return SchemeCell(ListValue.cbegin() + 1, ListValue.cend());
-			}
-		};
-
-		std::ostream& operator<< (std::ostream& stream, const SchemeCell& cell);
-	}
-}
+#pragma once
+
+#include <atomic>
+#include <ostream>
+
+#include "Scheme.h"
+#include "SchemeBigInt.h"
+#include "SchemeRuntime.h"
+#include "SchemeStats.h"
+#include "SchemeSymbols.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		// Counts every SchemeCell copy (moves are not counted); see SchemeStats.
+		// Empty, and takes no space.
+		struct SchemeCopyCounter {
+			SchemeCopyCounter() = default;
+			SchemeCopyCounter(const SchemeCopyCounter &) { SchemeStats::Copy(); }
+			SchemeCopyCounter(SchemeCopyCounter &&) = default;
+			SchemeCopyCounter &operator = (const SchemeCopyCounter &) { SchemeStats::Copy(); return *this; }
+			SchemeCopyCounter &operator = (SchemeCopyCounter &&) = default;
+		};
+
+		struct SchemeCell : public SchemeCopyCounter {
+		public:
+			CellType Type;
+			// Scalar payloads share storage; Type selects the active member.
+			union {
+				IntegerType IntegerValue;
+				FloatType FloatValue;
+				ProcType ProcValue;
+				ProcEnvType ProcEnvValue;
+				struct {
+					AtomType AtomValue;     // SYMBOL: interned ID of Value
+					uint16_t LexicalDepth;  // SYMBOL: frames outward + 1, or 0 if not resolved (see SchemeLexical)
+					uint16_t LexicalSlot;   // SYMBOL: argument slot within that frame
+				};
+			};
+			// Text of SYMBOL and STRING cells. Numbers keep no text.
+			std::string Value;
+			VectorType ListValue;
+			// PAIR: head and the rest of the list, shared with every list built on it.
+			// LAMBDA and MACRO: the list (params body), shared by every copy of the closure.
+			PairType PairValue;
+			// BIGINT: a value outside the range of IntegerType. Values that fit are always INTEGER.
+			BigIntType BigValue;
+			EnvironmentType Environment;
+			// LAMBDA and MACRO: body compiled by the evaluator that created it, or nullptr
+			CompiledType Compiled;
+
+			// The empty symbol. Its atom is always ATOM_NONE, so nothing is interned.
+			SchemeCell() {
+				Type = SYMBOL;
+				IntegerValue = 0; // AtomValue ATOM_NONE, no lexical address
+				Environment = nullptr;
+			}
+
+			SchemeCell(const std::string &value, CellType type = SYMBOL) {
+				Type = type;
+				IntegerValue = 0;
+				ListValue = VectorType();
+				Environment = nullptr;
+				if (type == INTEGER)
+					IntegerValue = ParseInteger(value);
+				else if (type == BIGINT)
+					SetInteger(ParseBigInt(value));
+				else if (type == FLOAT)
+					FloatValue = ParseFloat(value);
+				else {
+					Value = value;
+					if (type == SYMBOL)
+						AtomValue = SchemeSymbols::Intern(value);
+				}
+				Made();
+			}
+
+			SchemeCell(const bool value)
+				: SchemeCell(value ? SchemeConstants::TrueValue : SchemeConstants::FalseValue) { Made(); }
+
+			SchemeCell(const IntegerType value) {
+				Type = INTEGER;
+				IntegerValue = value;
+				Environment = nullptr;
+				Made();
+			}
+
+			// BIGINT, or INTEGER if the value fits
+			SchemeCell(const SchemeBigInt &value) {
+				Environment = nullptr;
+				SetInteger(value);
+				Made();
+			}
+
+			SchemeCell(const FloatType value) {
+				Type = FLOAT;
+				FloatValue = value;
+				Environment = nullptr;
+				Made();
+			}
+
+			SchemeCell(const VectorType &value, CellType type = LIST) {
+				Type = type;
+				IntegerValue = 0;
+				Value = "";
+				ListValue = value;
+				Environment = nullptr;
+				Made();
+			}
+
+			SchemeCell(VectorType &&value, CellType type = LIST) {
+				Type = type;
+				IntegerValue = 0;
+				ListValue = std::move(value);
+				Environment = nullptr;
+				Made();
+			}
+
+			SchemeCell(VectorType::const_iterator start, VectorType::const_iterator end, CellType type = LIST) {
+				Type = type;
+				IntegerValue = 0;
+				Value = "";
+				ListValue = VectorType(start, end);
+				Environment = nullptr;
+				Made();
+			}
+
+			SchemeCell(ProcType proc) {
+				Type = PROC;
+				Value = "";
+				ListValue = VectorType();
+				ProcValue = proc;
+				Environment = nullptr;
+				Made();
+			}
+
+			SchemeCell(ProcEnvType proc) {
+				Type = PROCENV;
+				Value = "";
+				ListValue = VectorType();
+				ProcEnvValue = proc;
+				Environment = nullptr;
+				Made();
+			}
+
+			SchemeCell(CellType type)
+				: SchemeCell("", type) {}
+
+			SchemeCell(EnvironmentType env) {
+				Type = ENVPTR;
+				IntegerValue = 0;
+				Value = "";
+				ListValue = VectorType();
+				Environment = env;
+				Made();
+			}
+
+			SchemeCell(const SchemeCell &other) = default;
+			SchemeCell(SchemeCell &&other) = default;
+			SchemeCell &operator = (const SchemeCell &other) = default;
+			SchemeCell &operator = (SchemeCell &&other) = default;
+
+			// LAMBDA or MACRO closing over env, from a (lambda params body) or (macro params body) form
+			static SchemeCell Closure(const SchemeCell &form, EnvironmentType env = nullptr) SCHEME_THROW;
+			// Parameter list and body of a LAMBDA or MACRO
+			const SchemeCell &Params() const;
+			const SchemeCell &Body() const;
+
+			SchemeCell coerce(CellType to) const SCHEME_THROW {
+				if (Type == to)
+					return *this;
+				if (SchemeRuntime::IsBasicType(Type) && SchemeRuntime::IsBasicType(to)) {
+					switch (to) {
+						case INTEGER: return SchemeCell(ToInteger());
+						case FLOAT: return SchemeCell(ToFloat());
+						default: return SchemeCell(ToString(), to);
+					}
+				}
+				// TODO - coerce other types
+				std::string message = "Conversion not implemented from ";
+				message += std::to_string(Type);
+				message += " to ";
+				message += std::to_string(to);
+				throw critical_error(CRIT_INVALID_COERCE, message);
+			}
+
+			// Parse number text, as used for STRING and SYMBOL coercion. Invalid text gives 0.
+			static IntegerType ParseInteger(const std::string &text);
+			static FloatType ParseFloat(const std::string &text);
+			static SchemeBigInt ParseBigInt(const std::string &text);
+
+			// -1, 0 or 1 as the numeric value of a is less than, equal to or greater than b
+			static int NumericCompare(const SchemeCell &a, const SchemeCell &b);
+			// The integer value of an INTEGER or BIGINT (or other cell, per ToInteger) at full precision
+			SchemeBigInt ToBigInt() const;
+
+			// Operators
+			bool operator == (const SchemeCell &other) const SCHEME_THROW {
+				if (Type != other.Type) {
+					// Mixed integer and float: compare without truncating the float
+					if (IsNumber() && other.IsNumber())
+						return NumericCompare(*this, other) == 0;
+					// Symbol and string: compare text rather than interning the string
+					if ((Type == SYMBOL || Type == STRING) && (other.Type == SYMBOL || other.Type == STRING))
+						return Value == other.Value;
+					// Vector and pair lists: compare elements
+					if (IsSequence() && other.IsSequence())
+						return ToList().ListValue == other.ToList().ListValue;
+					if (SchemeRuntime::CanCoerce(Type, other.Type)) {
+						const SchemeCell &coerced = other.coerce(Type);
+						return *this == coerced;
+					}
+				}
+				switch (Type) {
+					case INTEGER: return IntegerValue == other.IntegerValue;
+					case FLOAT: return FloatValue == other.FloatValue;
+					case BIGINT: return SchemeBigInt::Compare(*BigValue, *other.BigValue) == 0;
+					case SYMBOL: return AtomValue == other.AtomValue;
+					case STRING: return Value == other.Value;
+					case LAMBDA: /* Fall through */
+					case MACRO: return Environment == other.Environment &&
+						(PairValue == other.PairValue || (Params() == other.Params() && Body() == other.Body()));
+					case LIST: return ListValue == other.ListValue;
+					case PAIR: return PairValue == other.PairValue || ToList().ListValue == other.ToList().ListValue;
+					case PROC: return ProcValue == other.ProcValue;
+					case PROCENV: return ProcEnvValue == other.ProcEnvValue;
+					case ENVPTR: return Environment == other.Environment;
+					default:
+						throw critical_error(CRIT_TYPE_NOT_IMPL, *this);
+				}
+			}
+
+			bool operator != (const SchemeCell &other) const SCHEME_THROW {
+				return !(*this == other);
+			}
+
+			SchemeCell &operator += (const SchemeCell &other) SCHEME_THROW {
+				if (Type == STRING) {
+					Value += other.Value;
+				} else if (Type == LIST) {
+					ListValue.insert(ListValue.end(), other.ListValue);
+				} else {
+					ApplyNumeric(other, NUMERIC_ADD);
+				}
+				return *this;
+			}
+
+			SchemeCell &operator -= (const SchemeCell &other) SCHEME_THROW {
+				return ApplyNumeric(other, NUMERIC_SUB);
+			}
+
+			SchemeCell &operator *= (const SchemeCell &other) SCHEME_THROW {
+				return ApplyNumeric(other, NUMERIC_MUL);
+			}
+
+			SchemeCell &operator /= (const SchemeCell &other) SCHEME_THROW {
+				return ApplyNumeric(other, NUMERIC_DIV);
+			}
+
+			SchemeCell &operator [](VectorType::size_type index) SCHEME_THROW {
+				if (!IsList()) return SchemeConstants::Nil;
+				try {
+					return ListValue[index];
+				} catch (...) {
+					throw critical_error(CRIT_INVALID_INDEX, *this);
+				}
+			}
+			const SchemeCell &operator [](VectorType::size_type index) const SCHEME_THROW {
+				if (!IsList()) return SchemeConstants::Nil;
+				try {
+					return ListValue[index];
+				} catch (...) {
+					throw critical_error(CRIT_INVALID_INDEX, *this);
+				}
+			}
+
+			operator IntegerType() const { return ToInteger(); }
+			IntegerType ToInteger() const {
+				switch (Type) {
+					case INTEGER: return IntegerValue;
+					case FLOAT: return (IntegerType)FloatValue;
+					case BIGINT: return BigValue->ToInteger();
+					case SYMBOL: // Fall through
+					case STRING: return ParseInteger(Value);
+					default: return 0;
+				}
+			}
+
+			operator FloatType() const { return ToFloat(); }
+			FloatType ToFloat() const {
+				switch (Type) {
+					case INTEGER: return (FloatType)IntegerValue;
+					case FLOAT: return FloatValue;
+					case BIGINT: return BigValue->ToFloat();
+					case SYMBOL: // Fall through
+					case STRING: return ParseFloat(Value);
+					default: return 0;
+				}
+			}
+			bool IsNumber() const { return Type == INTEGER || Type == FLOAT || Type == BIGINT; }
+			// Convert to string. Pass true to return as expression.
+			std::string ToString(bool expr = false) const SCHEME_THROW;
+
+			// List functions
+			// True for cells holding a ListValue. PAIR lists are not included; see IsSequence.
+			bool IsList() const { return Type == LIST; }
+			// True for Scheme lists, whether vector (LIST) or pair (PAIR) backed
+			bool IsSequence() const { return Type == LIST || Type == PAIR; }
+			bool Empty() const { return Type != PAIR && (Type != LIST || ListValue.empty()); }
+			size_t Size() const;
+			bool SizeAtLeast(size_t size) const {
+				// if (!IsList()) return false;
+				size_t index = 0;
+				for (auto it = ListValue.cbegin(); it != ListValue.cend() && index < size; ++it)
+					++index;
+				return index == size;
+			}
+			const SchemeCell &Head() const;
+			const SchemeCell &HeadOr(const SchemeCell &r) const {
+				if (Empty()) return r;
+				return Head();
+			}
+			// Rest of the list. O(1) for a PAIR. A LIST is copied into pairs once,
+			// so walking the result with Tail is O(1) per step from then on.
+			SchemeCell Tail() const;
+			// New PAIR list of head followed by the elements of tail. O(1): shares tail.
+			static SchemeCell Cons(const SchemeCell &head, const SchemeCell &tail);
+			// PAIR list of the elements of [start, end) followed by those of tail
+			static SchemeCell Cons(VectorType::const_iterator start, VectorType::const_iterator end, const SchemeCell &tail);
+			// Vector backed copy of a list: the elements of a PAIR chain as a LIST
+			SchemeCell ToList() const;
+
+		private:
+			enum NumericOp { NUMERIC_ADD, NUMERIC_SUB, NUMERIC_MUL, NUMERIC_DIV };
+			// Integer op integer stays integer, promoted to BIGINT on overflow and
+			// demoted again when a result fits. Anything involving a float becomes a float.
+			SchemeCell &ApplyNumeric(const SchemeCell &other, NumericOp op) SCHEME_THROW;
+			// Store an integer result as INTEGER if it fits, otherwise as BIGINT
+			void SetInteger(const SchemeBigInt &value);
+			// Count a cell made with a value, by its type, while tracking (see
+			// SchemeHeap::Track). Copies and moves are not counted.
+			void Made() const {
+				if (SchemeStats::TrackingCells())
+					SchemeStats::CellMade(Type);
+			}
+		};
+
+		// Cons cell. Tail is always a LIST or PAIR, so chains are proper lists.
+		struct SchemePair {
+			SchemeCell Head;
+			SchemeCell Tail;
+			mutable uint32_t Mark = 0; // see SchemeHeap
+			SchemePair(const SchemeCell &head, const SchemeCell &tail) : Head(head), Tail(tail) { }
+			~SchemePair();
+		};
+
+		inline const SchemeCell &SchemeCell::Params() const { return PairValue->Head; }
+		inline const SchemeCell &SchemeCell::Body() const { return PairValue->Tail.PairValue->Head; }
+
+		std::ostream& operator<< (std::ostream& stream, const SchemeCell& cell);
+	}
+}
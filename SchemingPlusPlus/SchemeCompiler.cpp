@@ -0,0 +1,145 @@
+#include "SchemeAssert.h"
+#include "SchemeCompiler.h"
+#include "SchemeHeap.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		namespace {
+			class Emitter {
+			public:
+				Emitter(SchemeCode &code) : _code(code) { }
+
+				void Emit(const SchemeCell &x, bool tail) SCHEME_THROW {
+					switch (x.Type) {
+						case SYMBOL:
+							Op(LOOKUP, Constant(x));
+							return;
+						case STRING: // Fall through
+						case INTEGER: // Fall through
+						case FLOAT: // Fall through
+						case BIGINT:
+							Op(DATA, Constant(x));
+							return;
+					}
+					if (x.Empty()) {
+						Op(DATA, Constant(SchemeConstants::Nil));
+						return;
+					}
+
+					const VectorType &list = x.ListValue;
+					if (list[0].Type == SYMBOL) {
+						switch (list[0].AtomValue) {
+						case ATOM_QUOTE: { // (quote exp)
+							Op(DATA, Constant(list.size() > 1 ? list[1] : SchemeConstants::Nil));
+							return;
+						}
+						case ATOM_IF: { // (if test conseq [alt])
+							runtime_assert(list.size() > 2);
+							Emit(list[1], false);
+							size_t to_alt = Jump(BZ);
+							Emit(list[2], tail);
+							size_t to_end = Jump(JMP);
+							Patch(to_alt);
+							if (list.size() > 3)
+								Emit(list[3], tail);
+							else
+								Op(DATA, Constant(SchemeConstants::Nil));
+							Patch(to_end);
+							return;
+						}
+						case ATOM_SET: // (set! var exp) - must exist
+							// Fall through
+						case ATOM_DEFINE: { // (define var exp) - creates new or updates existing
+							runtime_assert(list.size() > 2 && list[1].Type == SYMBOL);
+							Emit(list[2], false);
+							Op(list[0].AtomValue == ATOM_SET ? SET : DEFINE, Constant(list[1]));
+							return;
+						}
+						case ATOM_LAMBDA: // (lambda (var*) exp)
+							// Fall through
+						case ATOM_MACRO: { // (macro (var*) exp)
+							_code.Functions.push_back(SchemeCompiler::CompileFunction(SchemeCell::Closure(x)));
+							Op(CLOSURE, (int32_t)(_code.Functions.size() - 1));
+							return;
+						}
+						case ATOM_BEGIN: { // (begin exp*)
+							if (list.size() == 1)
+								Op(DATA, Constant(SchemeConstants::Nil));
+							for (size_t i = 1; i < list.size(); ++i)
+								Emit(list[i], tail && i == list.size() - 1);
+							return;
+						}
+						}
+					}
+					// (proc exp*) - a macro takes its operands unevaluated, which is only known once proc is
+					Emit(list[0], false);
+					Op(EXPAND, Constant(x));
+					size_t to_end = _code.Code.size();
+					_code.Code.push_back(0);
+					Op(PUSH);
+					for (size_t i = 1; i < list.size(); ++i) {
+						Emit(list[i], false);
+						Op(PUSH);
+					}
+					Op(tail ? TAILCALL : CALL, (int32_t)(list.size() - 1));
+					Patch(to_end);
+				}
+
+				void Op(OpCode op) {
+					_code.Code.push_back(op);
+				}
+
+				void Op(OpCode op, int32_t operand) {
+					_code.Code.push_back(op);
+					_code.Code.push_back(operand);
+				}
+
+			private:
+				SchemeCode &_code;
+
+				int32_t Constant(const SchemeCell &value) {
+					_code.Data.push_back(value);
+					return (int32_t)(_code.Data.size() - 1);
+				}
+
+				// Emit a jump with its target left to Patch; returns the operand position
+				size_t Jump(OpCode op) {
+					Op(op, 0);
+					return _code.Code.size() - 1;
+				}
+
+				// Point the jump operand at position to the next instruction
+				void Patch(size_t position) {
+					_code.Code[position] = (int32_t)_code.Code.size();
+				}
+			};
+		}
+
+		void SchemeCode::Trace(SchemeMarker &marker) const {
+			// Constants can hold closures, e.g. spliced into a macro expansion
+			marker.Mark(Data);
+			marker.Mark(Form);
+			for (auto it = Functions.cbegin(); it != Functions.cend(); ++it)
+				marker.Mark(**it);
+		}
+
+		CodeType SchemeCompiler::Compile(const SchemeCell &expr) SCHEME_THROW {
+			std::shared_ptr<SchemeCode> code = std::make_shared<SchemeCode>();
+			Emitter emitter(*code);
+			emitter.Emit(expr, true);
+			emitter.Op(RETURN);
+			return code;
+		}
+
+		CodeType SchemeCompiler::CompileFunction(const SchemeCell &closure) SCHEME_THROW {
+			std::shared_ptr<SchemeCode> code = std::make_shared<SchemeCode>();
+			Emitter emitter(*code);
+			emitter.Emit(closure.Body(), true);
+			emitter.Op(RETURN);
+			code->Form = closure;
+			code->Form.Environment = nullptr;
+			code->Form.Compiled = nullptr;
+			return code;
+		}
+	}
+}
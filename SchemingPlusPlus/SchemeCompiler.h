@@ -0,0 +1,49 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "SchemeCell.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		// Instruction set for SchemeVMEval. The machine has an accumulator (A),
+		// a value stack and a call stack; operands follow the opcode inline.
+		enum OpCode : int32_t {
+			NOP,
+			DATA,       // DATA idx: A = Data[idx]
+			LOOKUP,     // LOOKUP idx: A = value of symbol Data[idx]
+			SET,        // SET idx: assign A to existing symbol Data[idx]
+			DEFINE,     // DEFINE idx: bind A to symbol Data[idx] in the current frame
+			CLOSURE,    // CLOSURE idx: A = lambda or macro for Functions[idx] over the current frame
+			PUSH,       // push A
+			BZ,         // BZ addr: jump if A is false
+			JMP,        // JMP addr
+			EXPAND,     // EXPAND idx addr: if A is a macro, expand form Data[idx], run it and jump to addr
+			CALL,       // CALL n: call stack[-n-1] with the n values above it
+			TAILCALL,   // TAILCALL n: as CALL, replacing the current frame
+			RETURN      // return A to the caller
+		};
+
+		struct SchemeCode;
+		typedef std::shared_ptr<const SchemeCode> CodeType;
+
+		// Bytecode for one lambda or macro body, or for one top level expression.
+		struct SchemeCode : public SchemeCompiled {
+			SchemeCode() : SchemeCompiled(BYTECODE) { }
+			std::vector<int32_t> Code;
+			VectorType Data;                 // constants, symbols and source forms
+			std::vector<CodeType> Functions; // nested lambda and macro bodies
+			SchemeCell Form;                 // functions: the LAMBDA or MACRO cell, less its environment
+			void Trace(SchemeMarker &marker) const override;
+		};
+
+		struct SchemeCompiler {
+			// Compile an expression already annotated by SchemeLexical. The code
+			// evaluates it in the frame it is run in and returns the result.
+			static CodeType Compile(const SchemeCell &expr) SCHEME_THROW;
+			// Compile the body of a LAMBDA or MACRO (see SchemeCell::Closure)
+			static CodeType CompileFunction(const SchemeCell &closure) SCHEME_THROW;
+		};
+	}
+}
@@ -4,6 +4,7 @@
 #include "SchemeAssert.h"
 #include "SchemeCell.h"
 #include "SchemeEnvironment.h"
+#include "SchemeStats.h"
 
 namespace SchemingPlusPlus {
 	namespace Core {
@@ -14,84 +15,159 @@ namespace SchemingPlusPlus {
 		SchemeEnvironment::SchemeEnvironment(const SchemeCell &keys, const SchemeCell &values, EnvironmentType outer) {
 			_outer = outer;
 
-			VectorType lc_keys;
-			VectorType lc_values;
 			if (keys.Type == LIST) {
 				// List of keys and values
-				lc_keys.insert(lc_keys.end(), keys.ListValue.cbegin(), keys.ListValue.cend());
-				lc_values.insert(lc_values.end(), values.ListValue.cbegin(), values.ListValue.cend());
+				AddRange(keys.ListValue, values.ListValue);
 			} else {
 				// Single key capturing multiple values
-				lc_keys.push_back(keys);
-				lc_values.push_back(values);
+				_keys.push_back(KeyAtom(keys));
+				_slots.push_back(values);
+			}
+		}
+		SchemeEnvironment::SchemeEnvironment(const SchemeCell &params, VectorType &&values, EnvironmentType outer) SCHEME_THROW {
+			_outer = outer;
+
+			// Slot layout must match SchemeLexical
+			if (params.Type == LIST) {
+				const VectorType &keys = params.ListValue;
+				runtime_assert(keys.size() == values.size());
+				_keys.reserve(keys.size());
+				for (auto it = keys.cbegin(); it != keys.cend(); ++it)
+					_keys.push_back(KeyAtom(*it));
+				_slots = std::move(values);
+			} else {
+				// Single symbol capturing all values
+				_keys.push_back(KeyAtom(params));
+				_slots.push_back(SchemeCell(std::move(values)));
 			}
-			AddRange(lc_keys, lc_values);
 		}
 		void SchemeEnvironment::AddRange(const VectorType &keys, const VectorType &values) {
 			assert(keys.size() == values.size());
+			_keys.reserve(_keys.size() + keys.size());
+			_slots.reserve(_slots.size() + values.size());
 			for (auto it1 = keys.cbegin(), it2 = values.cbegin();
 				 it1 != keys.cend() && it2 != values.cend();
 				 ++it1, ++it2) {
-				Insert((*it1).Value, *it2);
+				_keys.push_back(KeyAtom(*it1));
+				_slots.push_back(*it2);
 			}
 		}
-		void SchemeEnvironment::Insert(std::string key, const SchemeCell &value) {
+		AtomType SchemeEnvironment::KeyAtom(const SchemeCell &key) SCHEME_THROW {
+			if (key.Type == SYMBOL)
+				return key.AtomValue;
+			runtime_assert(key.Type == STRING);
+			return SchemeSymbols::Intern(key.Value);
+		}
+		void SchemeEnvironment::Insert(AtomType key, const SchemeCell &value) {
 			_map.emplace(key, value);
 		}
-		bool SchemeEnvironment::Has(const std::string &key) const {
-			if (_map.find(key) != _map.cend())
-				return true;
-			if (_outer)
-				return _outer->Has(key);
-			return false;
-		}
-		SchemeEnvironment::MapType &SchemeEnvironment::Find(std::string key) SCHEME_THROW {
-			if (_map.find(key) != _map.cend())
-				return _map;
-			if (_outer != nullptr)
-				return _outer->Find(key);
-			throw critical_error(CRIT_SYMBOL_NOT_FOUND, SchemeCell(key, SYMBOL));
+		void SchemeEnvironment::Insert(const std::string &key, const SchemeCell &value) {
+			Insert(SchemeSymbols::Intern(key), value);
+		}
+		SchemeEnvironment::BindingType SchemeEnvironment::FindLocal(AtomType key) {
+			// Lambda frames are small; a linear scan beats hashing
+			for (size_t i = 0; i < _keys.size(); ++i)
+				if (_keys[i] == key)
+					return &_slots[i];
+			if (_map.empty())
+				return nullptr;
+			auto it = _map.find(key);
+			if (it != _map.end())
+				return &it->second;
+			return nullptr;
 		}
 #pragma warning( disable : 4290 )
-		SchemeEnvironment::MapType SchemeEnvironment::Find(std::string key) const SCHEME_THROW {
-			if (_map.find(key) != _map.cend())
-				return _map;
-			if (_outer != nullptr)
-				return _outer->Find(key);
-			throw critical_error(CRIT_SYMBOL_NOT_FOUND, SchemeCell(key, SYMBOL));
+		SchemeEnvironment::BindingType SchemeEnvironment::Resolve(AtomType key) {
+			size_t depth = 0;
+			for (SchemeEnvironment *env = this; env != nullptr; env = env->_outer, ++depth) {
+				BindingType binding = env->FindLocal(key);
+				if (binding != nullptr) {
+					SchemeStats::Lookup(depth);
+					return binding;
+				}
+			}
+			return nullptr;
 		}
-		SchemeCell &SchemeEnvironment::Lookup(std::string key) SCHEME_THROW {
-			auto map = Find(key);
-			return map[key];
+		const SchemeCell *SchemeEnvironment::Resolve(AtomType key) const {
+			return const_cast<SchemeEnvironment*>(this)->Resolve(key);
+		}
+		SchemeEnvironment::BindingType SchemeEnvironment::ResolveLexical(const SchemeCell &symbol) {
+			const AtomType atom = symbol.AtomValue;
+			SchemeEnvironment *env = this;
+			for (uint16_t depth = symbol.LexicalDepth - 1; depth > 0; --depth) {
+				// A define at runtime may shadow the parameter the annotation points to
+				if (!env->_map.empty()) {
+					auto it = env->_map.find(atom);
+					if (it != env->_map.end()) {
+						SchemeStats::Lookup(symbol.LexicalDepth - 1 - depth);
+						return &it->second;
+					}
+				}
+				env = env->_outer;
+				if (env == nullptr)
+					return Resolve(atom);
+			}
+			const size_t slot = symbol.LexicalSlot;
+			if (slot < env->_keys.size() && env->_keys[slot] == atom) {
+				SchemeStats::Lookup(symbol.LexicalDepth - 1);
+				return &env->_slots[slot];
+			}
+			return Resolve(atom);
 		}
-		SchemeCell SchemeEnvironment::Lookup(std::string key) const SCHEME_THROW {
-			auto map = Find(key);
-			return map[key];
+		bool SchemeEnvironment::Has(AtomType key) const {
+			return Resolve(key) != nullptr;
+		}
+		bool SchemeEnvironment::Has(const std::string &key) const {
+			return Has(SchemeSymbols::Intern(key));
+		}
+		SchemeCell &SchemeEnvironment::Lookup(AtomType key) SCHEME_THROW {
+			BindingType binding = Resolve(key);
+			if (binding == nullptr)
+				throw critical_error(CRIT_SYMBOL_NOT_FOUND, SchemeCell(SchemeSymbols::Name(key), SYMBOL));
+			return *binding;
+		}
+		SchemeCell &SchemeEnvironment::Lookup(const std::string &key) SCHEME_THROW {
+			return Lookup(SchemeSymbols::Intern(key));
+		}
+		SchemeCell SchemeEnvironment::Lookup(AtomType key) const SCHEME_THROW {
+			const SchemeCell *binding = Resolve(key);
+			if (binding == nullptr)
+				throw critical_error(CRIT_SYMBOL_NOT_FOUND, SchemeCell(SchemeSymbols::Name(key), SYMBOL));
+			return *binding;
+		}
+		SchemeCell SchemeEnvironment::Lookup(const std::string &key) const SCHEME_THROW {
+			return Lookup(SchemeSymbols::Intern(key));
 		}
 		SchemeCell &SchemeEnvironment::Lookup(const SchemeCell &key) SCHEME_THROW {
-			runtime_assert(key.Type == SYMBOL || key.Type == STRING);
-			auto map = Find(key.Value);
-			return map[key.Value];
+			return Lookup(KeyAtom(key));
 		}
 		SchemeCell SchemeEnvironment::Lookup(const SchemeCell &key) const SCHEME_THROW {
-			runtime_assert(key.Type == SYMBOL || key.Type == STRING);
-			auto map = Find(key.Value);
-			return map[key.Value];
+			return Lookup(KeyAtom(key));
+		}
+		SchemeCell &SchemeEnvironment::LookupLexical(const SchemeCell &symbol) SCHEME_THROW {
+			BindingType binding = ResolveLexical(symbol);
+			if (binding == nullptr)
+				throw critical_error(CRIT_SYMBOL_NOT_FOUND, SchemeCell(SchemeSymbols::Name(symbol.AtomValue), SYMBOL));
+			return *binding;
 		}
 		SchemeCell SchemeEnvironment::Set(const SchemeCell &key, const SchemeCell &value) SCHEME_THROW {
-			runtime_assert(key.Type == STRING || key.Type == SYMBOL);
-			auto map = Find(key.Value);
-			map[key.Value] = value;
-			return value;
+			return Lookup(KeyAtom(key)) = value;
 		}
 		SchemeCell SchemeEnvironment::Define(const SchemeCell &key, const SchemeCell &value) SCHEME_THROW {
-			runtime_assert(key.Type == STRING || key.Type == SYMBOL);
-			_map.emplace(key.Value, value);
+			AtomType atom = KeyAtom(key);
+			if (FindLocal(atom) == nullptr)
+				_map.emplace(atom, value);
 			return value;
 		}
-		SchemeCell &SchemeEnvironment::operator[] (const std::string &key) {
+		SchemeCell &SchemeEnvironment::operator[] (AtomType key) {
+			BindingType binding = FindLocal(key);
+			if (binding != nullptr)
+				return *binding;
 			return _map[key];
 		}
+		SchemeCell &SchemeEnvironment::operator[] (const std::string &key) {
+			return this->operator[](SchemeSymbols::Intern(key));
+		}
 		SchemeCell &SchemeEnvironment::operator[] (const char *key) {
 			return this->operator[](std::string(key));
 		}
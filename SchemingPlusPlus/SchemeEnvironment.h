@@ -4,39 +4,74 @@
 #include "SchemeCell.h"
 #include "SchemeEnvironment.h"
 
-#include <map>
+#include <unordered_map>
+#include <vector>
 
 namespace SchemingPlusPlus {
 	namespace Core {
+		// Allocate with SchemeHeap::New; the heap frees environments no longer reachable.
 		class SchemeEnvironment {
+			friend class SchemeMarker;
+			friend struct SchemeHeap;
+			friend struct SchemeImage;
+			friend class SchemeProfiler;
+			friend struct SchemeStats;
 		public:
-			typedef std::map<std::string, SchemeCell> MapType;
+			// Keyed by interned symbol ID; see SchemeSymbols
+			typedef std::unordered_map<AtomType, SchemeCell> MapType;
+			// Handle to a binding. Valid for as long as the frame holding it:
+			// slot arrays never resize after construction and map nodes never move.
+			typedef SchemeCell *BindingType;
 			SchemeEnvironment(EnvironmentType outer = nullptr) {
 				_map = MapType();
 				_outer = outer;
 			}
 			SchemeEnvironment(const VectorType &keys, const VectorType &values, EnvironmentType outer);
 			SchemeEnvironment(const SchemeCell &keys, const SchemeCell &values, EnvironmentType outer);
+			// Lambda frame: params is the parameter list, or a single symbol capturing all values.
+			// Values are moved into the frame's flat slot array, in parameter order.
+			SchemeEnvironment(const SchemeCell &params, VectorType &&values, EnvironmentType outer) SCHEME_THROW;
 
 			void AddRange(const VectorType &keys, const VectorType &values);
-			void Insert(std::string key, const SchemeCell &value);
-			MapType &Find(std::string key) SCHEME_THROW;
+			void Insert(AtomType key, const SchemeCell &value);
+			void Insert(const std::string &key, const SchemeCell &value);
+			// Binding for key in this frame or an outer one, or nullptr. Never copies.
+			BindingType Resolve(AtomType key);
+			const SchemeCell *Resolve(AtomType key) const;
+			// As Resolve, for a symbol annotated by SchemeLexical. Falls back to
+			// Resolve by name when the frames do not match the annotation.
+			BindingType ResolveLexical(const SchemeCell &symbol);
+			bool Has(AtomType key) const;
 			bool Has(const std::string &key) const;
-			MapType Find(std::string key) const SCHEME_THROW;
-			SchemeCell &Lookup(std::string key) SCHEME_THROW;
+			SchemeCell &Lookup(AtomType key) SCHEME_THROW;
+			SchemeCell &Lookup(const std::string &key) SCHEME_THROW;
 			SchemeCell &Lookup(const SchemeCell &key) SCHEME_THROW;
-			SchemeCell Lookup(std::string key) const SCHEME_THROW;
+			SchemeCell Lookup(AtomType key) const SCHEME_THROW;
+			SchemeCell Lookup(const std::string &key) const SCHEME_THROW;
 			SchemeCell Lookup(const SchemeCell &key) const SCHEME_THROW;
+			// Lookup a symbol annotated by SchemeLexical; see ResolveLexical
+			SchemeCell &LookupLexical(const SchemeCell &symbol) SCHEME_THROW;
 			// Set - set an existing key to value
 			SchemeCell Set(const SchemeCell &key, const SchemeCell &value) SCHEME_THROW;
 			// Define - create a new key set to value
 			SchemeCell Define(const SchemeCell &key, const SchemeCell &value) SCHEME_THROW;
 			std::string ToString() const;
+			// Binding in this frame, created if it does not exist
+			SchemeCell &operator[] (AtomType key);
 			SchemeCell &operator[] (const std::string &key);
 			SchemeCell &operator[] (const char *key);
 		private:
+			// Atom of a SYMBOL key, or the interned text of a STRING key
+			static AtomType KeyAtom(const SchemeCell &key) SCHEME_THROW;
+			// Binding in this frame only, or nullptr
+			BindingType FindLocal(AtomType key);
+
+			// Lambda frames: parameter atoms and their values, index aligned
+			std::vector<AtomType> _keys;
+			VectorType _slots;
 			MapType _map;
 			EnvironmentType _outer;
+			uint32_t _mark = 0; // see SchemeHeap
 		};
 	}
 }
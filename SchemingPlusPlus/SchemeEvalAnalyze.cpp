@@ -0,0 +1,266 @@
+#include "SchemeEvalAnalyze.h"
+#include "SchemeHeap.h"
+#include "SchemeLexical.h"
+#include "SchemeProfiler.h"
+#include "SchemeStats.h"
+#include "SchemeTrace.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		namespace {
+			// Calls under way in the activations on this thread (see SchemeActivation)
+			thread_local SchemeCallStack call_stack;
+
+			SchemeEnvironment::BindingType Binding(const SchemeCell &symbol, const EnvironmentType &env) SCHEME_THROW {
+				SchemeEnvironment::BindingType binding = (symbol.LexicalDepth != 0)
+					? env->ResolveLexical(symbol)
+					: env->Resolve(symbol.AtomValue);
+				if (binding == nullptr)
+					throw critical_error(CRIT_SYMBOL_NOT_FOUND, symbol);
+				return binding;
+			}
+
+			// Expand the macro call form, then run the expansion in env
+			SchemeCell Expand(const SchemeCell &macro, const SchemeCell &form, const EnvironmentType &env, bool tail, SchemeActivation &activation) THROW(critical_error) {
+				SchemeCell expansion;
+				SchemeHeap::Root expansion_root(expansion);
+				{
+					SchemeTrace::Span span("expand", SchemeTrace::Span::Operator(form));
+					VectorType operands(form.ListValue.cbegin() + 1, form.ListValue.cend());
+					expansion = SchemeAnalyzeEval::Apply(macro, std::move(operands), env);
+					// The expansion is new code: address its own lambdas
+					SchemeLexical::Resolve(expansion);
+				}
+				return SchemeAnalyzeEval::Analyze(expansion, tail)(env, activation);
+			}
+		}
+
+		SchemeCell SchemeAnalyzeEval::Eval(const SchemeCell &item, const SchemeCell &env_item) THROW(critical_error) {
+			runtime_assert(env_item.Environment != nullptr);
+			SchemeCell x = item;
+			SchemeLexical::Resolve(x);
+			SchemeActivation activation;
+			SchemeHeap::Root activation_root(&activation, [](const void *value, SchemeMarker &marker) {
+				static_cast<const SchemeActivation*>(value)->Mark(marker);
+			});
+			return Analyze(x, false)(env_item.Environment, activation);
+		}
+
+		AnalyzedType SchemeAnalyzeEval::Analyze(const SchemeCell &x, bool tail) SCHEME_THROW {
+			switch (x.Type) {
+				case SYMBOL:
+					return [x](const EnvironmentType &env, SchemeActivation &) {
+						SchemeEnvironment::BindingType binding = Binding(x, env);
+						// A closure made elsewhere, as by an image, is analyzed here once
+						// and kept by its binding, not analyzed again at every call
+						if ((binding->Type == LAMBDA || binding->Type == MACRO)
+							&& (binding->Compiled == nullptr || binding->Compiled->Kind != SchemeCompiled::ANALYZED))
+							binding->Compiled = AnalyzeFunction(*binding);
+						return *binding;
+					};
+				case STRING: // Fall through
+				case INTEGER: // Fall through
+				case FLOAT: // Fall through
+				case BIGINT:
+					return [x](const EnvironmentType &, SchemeActivation &) { return x; };
+			}
+			if (x.Empty())
+				return [](const EnvironmentType &, SchemeActivation &) { return SchemeConstants::Nil; };
+
+			const VectorType &list = x.ListValue;
+			if (list[0].Type == SYMBOL) {
+				switch (list[0].AtomValue) {
+				case ATOM_QUOTE: { // (quote exp)
+					SchemeCell quoted = list.size() > 1 ? list[1] : SchemeConstants::Nil;
+					return [quoted](const EnvironmentType &, SchemeActivation &) {
+						SchemeStats::SpecialForm(SchemeCounters::QUOTE);
+						return quoted;
+					};
+				}
+				case ATOM_IF: { // (if test conseq [alt])
+					runtime_assert(list.size() > 2);
+					AnalyzedType test = Analyze(list[1], false);
+					AnalyzedType conseq = Analyze(list[2], tail);
+					AnalyzedType alt = Analyze(list.size() > 3 ? list[3] : SchemeConstants::Nil, tail);
+					return [test, conseq, alt](const EnvironmentType &env, SchemeActivation &activation) {
+						SchemeStats::SpecialForm(SchemeCounters::IF);
+						if (test(env, activation) == SchemeConstants::False)
+							return alt(env, activation);
+						return conseq(env, activation);
+					};
+				}
+				case ATOM_SET: { // (set! var exp) - must exist
+					runtime_assert(list.size() > 2 && list[1].Type == SYMBOL);
+					SchemeCell var = list[1];
+					AnalyzedType value = Analyze(list[2], false);
+					return [var, value](const EnvironmentType &env, SchemeActivation &activation) {
+						SchemeStats::SpecialForm(SchemeCounters::SET);
+						SchemeCell result = value(env, activation);
+						return *Binding(var, env) = result;
+					};
+				}
+				case ATOM_DEFINE: { // (define var exp) - creates new or updates existing
+					runtime_assert(list.size() > 2 && list[1].Type == SYMBOL);
+					AtomType atom = list[1].AtomValue;
+					AnalyzedType value = Analyze(list[2], false);
+					return [atom, value](const EnvironmentType &env, SchemeActivation &activation) {
+						SchemeStats::SpecialForm(SchemeCounters::DEFINE);
+						return (*env)[atom] = value(env, activation);
+					};
+				}
+				case ATOM_LAMBDA: // (lambda (var*) exp)
+					// Fall through
+				case ATOM_MACRO: { // (macro (var*) exp)
+					std::shared_ptr<const SchemeAnalyzed> function = AnalyzeFunction(SchemeCell::Closure(x));
+					SchemeCounters::Forms kind = list[0].AtomValue == ATOM_MACRO ? SchemeCounters::MACRO : SchemeCounters::LAMBDA;
+					return [function, kind](const EnvironmentType &env, SchemeActivation &) {
+						SchemeStats::SpecialForm(kind);
+						SchemeCell closure = function->Form;
+						closure.Environment = env;
+						closure.Compiled = function;
+						return closure;
+					};
+				}
+				case ATOM_BEGIN: { // (begin exp*)
+					std::vector<AnalyzedType> body;
+					for (size_t i = 1; i < list.size(); ++i)
+						body.push_back(Analyze(list[i], tail && i == list.size() - 1));
+					if (body.empty())
+						body.push_back(Analyze(SchemeConstants::Nil, false));
+					return [body](const EnvironmentType &env, SchemeActivation &activation) {
+						SchemeStats::SpecialForm(SchemeCounters::BEGIN);
+						auto it = body.cbegin();
+						for (; it != body.cend() - 1; ++it)
+							(*it)(env, activation);
+						return (*it)(env, activation);
+					};
+				}
+				}
+			}
+			// (proc exp*)
+			AnalyzedType procedure = Analyze(list[0], false);
+			std::vector<AnalyzedType> operands;
+			for (auto it = list.cbegin() + 1; it != list.cend(); ++it)
+				operands.push_back(Analyze(*it, false));
+			return [x, procedure, operands, tail](const EnvironmentType &env, SchemeActivation &activation) {
+				// The call and its operands are rooted by the activation
+				SchemeCall &call = activation.Enter();
+				call.Proc = procedure(env, activation);
+				const SchemeCell &proc = call.Proc;
+				// Whether operands are evaluated is only known once proc is
+				if (proc.Type == MACRO) {
+					SchemeCell macro = std::move(call.Proc);
+					activation.Leave();
+					return Expand(macro, x, env, tail, activation);
+				}
+				call.Args.reserve(operands.size());
+				for (auto it = operands.cbegin(); it != operands.cend(); ++it)
+					call.Args.push_back((*it)(env, activation));
+				switch (proc.Type) {
+					case LAMBDA:
+						activation.Leave();
+						if (tail) {
+							// Leave the call to Apply, so tail calls do not grow the stack
+							activation.Pending.Active = true;
+							activation.Pending.Proc = std::move(call.Proc);
+							activation.Pending.Args = std::move(call.Args);
+							return SchemeConstants::Nil;
+						}
+						return Apply(std::move(call.Proc), std::move(call.Args), env);
+					case PROC: {
+						runtime_assert(proc.ProcValue != nullptr);
+						activation.Profile.Call(proc);
+						SchemeStats::Primitive((const void*)proc.ProcValue);
+						SchemeCell result = proc.ProcValue(call.Args);
+						activation.Profile.Return();
+						activation.Leave();
+						return result;
+					}
+					case PROCENV: {
+						runtime_assert(proc.ProcEnvValue != nullptr);
+						activation.Profile.Call(proc);
+						SchemeStats::Primitive((const void*)proc.ProcEnvValue);
+						SchemeCell result = proc.ProcEnvValue(call.Args, env);
+						activation.Profile.Return();
+						activation.Leave();
+						return result;
+					}
+					default:
+						throw critical_error(CRIT_INVALID_PROC, proc);
+				}
+			};
+		}
+
+		SchemeCell SchemeAnalyzeEval::Apply(SchemeCell proc, VectorType args, EnvironmentType env) THROW(critical_error) {
+			SchemeActivation activation;
+			SchemeHeap::Root activation_root(&activation, [](const void *value, SchemeMarker &marker) {
+				static_cast<const SchemeActivation*>(value)->Mark(marker);
+			});
+			activation.Proc = std::move(proc);
+			activation.Args = std::move(args);
+			// A tail call replaces the procedure this Apply is running
+			for (;;) {
+				const SchemeCell &running = activation.Proc;
+				activation.Profile.TailCall(running);
+				switch (running.Type) {
+					case LAMBDA: // Fall through
+					case MACRO: {
+						std::shared_ptr<const SchemeAnalyzed> function = BodyFor(running);
+						// Flat frame: arguments land in parameter slot order
+						activation.Frame = SchemeHeap::New(running.Params(), std::move(activation.Args), running.Environment);
+						SchemeCell result = function->Body(activation.Frame, activation);
+						if (!activation.Pending.Active)
+							return result;
+						activation.Pending.Active = false;
+						activation.Proc = std::move(activation.Pending.Proc);
+						activation.Args = std::move(activation.Pending.Args);
+						break;
+					}
+					case PROC:
+						runtime_assert(running.ProcValue != nullptr);
+						SchemeStats::Primitive((const void*)running.ProcValue);
+						return running.ProcValue(activation.Args);
+					case PROCENV:
+						runtime_assert(running.ProcEnvValue != nullptr);
+						SchemeStats::Primitive((const void*)running.ProcEnvValue);
+						return running.ProcEnvValue(activation.Args, env);
+					default:
+						throw critical_error(CRIT_INVALID_PROC, running);
+				}
+			}
+		}
+
+		SchemeActivation::SchemeActivation() : Stack(call_stack), Base(call_stack.Top) { }
+
+		void SchemeActivation::Mark(SchemeMarker &marker) const {
+			marker.Mark(Proc);
+			marker.Mark(Args);
+			marker.Mark(Frame);
+			marker.Mark(Pending.Proc);
+			marker.Mark(Pending.Args);
+			for (size_t i = Base; i < Base + Depth; ++i) {
+				marker.Mark(Stack.Calls[i].Proc);
+				marker.Mark(Stack.Calls[i].Args);
+			}
+		}
+
+		void SchemeAnalyzed::Trace(SchemeMarker &marker) const {
+			marker.Mark(Form);
+		}
+
+		std::shared_ptr<const SchemeAnalyzed> SchemeAnalyzeEval::AnalyzeFunction(const SchemeCell &closure) SCHEME_THROW {
+			std::shared_ptr<SchemeAnalyzed> function = std::make_shared<SchemeAnalyzed>();
+			function->Body = Analyze(closure.Body(), true);
+			function->Form = closure;
+			function->Form.Environment = nullptr;
+			function->Form.Compiled = nullptr;
+			return function;
+		}
+
+		std::shared_ptr<const SchemeAnalyzed> SchemeAnalyzeEval::BodyFor(const SchemeCell &proc) SCHEME_THROW {
+			if (proc.Compiled != nullptr && proc.Compiled->Kind == SchemeCompiled::ANALYZED)
+				return std::static_pointer_cast<const SchemeAnalyzed>(proc.Compiled);
+			return AnalyzeFunction(proc);
+		}
+	}
+}
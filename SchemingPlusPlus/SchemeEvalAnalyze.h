@@ -0,0 +1,102 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+
+#include "SchemeCell.h"
+#include "SchemeEnvironment.h"
+#include "SchemeEval.h"
+#include "SchemeAssert.h"
+#include "SchemeProfiler.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		// Call left by an expression in tail position, for the caller to make
+		struct SchemeTailCall {
+			bool Active = false;
+			SchemeCell Proc;
+			VectorType Args;
+		};
+
+		// A call whose operands are being evaluated
+		struct SchemeCall {
+			SchemeCell Proc;
+			VectorType Args;
+		};
+
+		// The calls under way on one thread, innermost last. Entries past Top
+		// are done with, and kept for their space. A deque, so an entry stays
+		// where it is while calls are added beyond it.
+		struct SchemeCallStack {
+			std::deque<SchemeCall> Calls;
+			size_t Top = 0;
+		};
+
+		// What one Apply holds while it runs, rooted once for all of it: the
+		// procedure and frame it runs, the tail call its body leaves, and the
+		// calls under way in that body, which it owns on the thread's call
+		// stack from Base on. Operands are evaluated into their call's entry,
+		// so no expression roots what it evaluates.
+		struct SchemeActivation {
+			SchemeActivation();
+			// Drops whatever calls an exception left
+			~SchemeActivation() { Stack.Top = Base; }
+			SchemeActivation(const SchemeActivation &) = delete;
+			SchemeActivation &operator = (const SchemeActivation &) = delete;
+
+			SchemeCell Proc;
+			VectorType Args;
+			EnvironmentType Frame = nullptr;
+			SchemeTailCall Pending;
+			SchemeCallStack &Stack;
+			size_t Base, Depth = 0;
+			SchemeProfiler::Scope Profile;
+
+			// A new call, with no operands yet
+			SchemeCall &Enter() {
+				size_t at = Stack.Top++;
+				++Depth;
+				if (at == Stack.Calls.size())
+					Stack.Calls.emplace_back();
+				SchemeCall &call = Stack.Calls[at];
+				call.Args.clear();
+				return call;
+			}
+			// The innermost call is done with
+			void Leave() { --Stack.Top; --Depth; }
+			void Mark(SchemeMarker &marker) const;
+		};
+
+		// An expression analyzed into a callable: syntax dispatch is done once, up front
+		typedef std::function<SchemeCell(const EnvironmentType &env, SchemeActivation &activation)> AnalyzedType;
+
+		// Analyzed body of a lambda or macro, attached to the closure cell
+		struct SchemeAnalyzed : public SchemeCompiled {
+			SchemeAnalyzed() : SchemeCompiled(ANALYZED) { }
+			AnalyzedType Body;
+			SchemeCell Form; // the LAMBDA or MACRO cell, less its environment
+			// Every value Body captured came from Form
+			void Trace(SchemeMarker &marker) const override;
+		};
+
+		// Converts each expression once into a tree of C++ callables, as SICP's
+		// analyze does. Lambda bodies are analyzed when the lambda expression is,
+		// not on every call.
+		class SchemeAnalyzeEval : public SchemeEvaluator {
+		public:
+			SchemeAnalyzeEval() : SchemeEvaluator() { }
+			SchemeCell Eval(const SchemeCell &x, const SchemeCell &env) THROW(critical_error) override;
+
+			// Analyze an expression already annotated by SchemeLexical. In tail
+			// position, calls are left in the activation's Pending rather than made.
+			static AnalyzedType Analyze(const SchemeCell &x, bool tail) SCHEME_THROW;
+			// Call proc, following any tail calls it leaves
+			static SchemeCell Apply(SchemeCell proc, VectorType args, EnvironmentType env) THROW(critical_error);
+		protected:
+			// Analyze the body of a LAMBDA or MACRO (see SchemeCell::Closure)
+			static std::shared_ptr<const SchemeAnalyzed> AnalyzeFunction(const SchemeCell &closure) SCHEME_THROW;
+			// Analyzed body of a LAMBDA or MACRO, analyzed now if another evaluator created it
+			static std::shared_ptr<const SchemeAnalyzed> BodyFor(const SchemeCell &proc) SCHEME_THROW;
+		};
+	}
+}
@@ -0,0 +1,285 @@
+#include <iterator>
+
+#include "SchemeEvalFrame.h"
+#include "SchemeHeap.h"
+#include "SchemeLexical.h"
+#include "SchemeProfiler.h"
+#include "SchemeStats.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		namespace {
+			// Set by Block during a builtin call, and cleared as Run sees it
+			thread_local SchemeFrameState::BlockReasons block_requested = SchemeFrameState::BLOCK_NONE;
+		}
+
+		SchemeCell SchemeFrameEval::Eval(const SchemeCell &item, const SchemeCell &env_item) THROW(critical_error) {
+			SchemeCell x = item;
+			SchemeLexical::Resolve(x);
+			return EvalResolved(std::move(x), env_item.Environment);
+		}
+
+		SchemeCell SchemeFrameEval::EvalResolved(SchemeCell item, EnvironmentType env) THROW(critical_error) {
+			runtime_assert(env != nullptr);
+			SchemeFrameState state(std::move(item), env);
+			SchemeHeap::Root state_root(&state, [](const void *value, SchemeMarker &marker) {
+				static_cast<const SchemeFrameState*>(value)->Mark(marker);
+			});
+			// Only a scheduled state can wait (see Block); here nothing would resume it
+			if (!state.Run())
+				throw critical_error(CRIT_OP_INVALID, std::string("evaluation cannot wait here"));
+			return state.Result();
+		}
+
+		SchemeFrameState::SchemeFrameState(SchemeCell item, EnvironmentType env) : _env(env) {
+			// The state owns its code, so it need not outlive the caller's item
+			_code = std::make_shared<SchemePair>(SchemeConstants::Nil, SchemeCell(LIST));
+			_code->Head = std::move(item);
+			_x = &_code->Head;
+		}
+
+		void SchemeFrameState::Block(BlockReasons reason) {
+			block_requested = reason;
+		}
+
+		void SchemeFrameState::Mark(SchemeMarker &marker) const {
+			marker.Mark(_env);
+			marker.Mark(_code);
+			marker.Mark(_value);
+			marker.Mark(_values);
+			for (auto it = _frames.cbegin(); it != _frames.cend(); ++it) {
+				marker.Mark(it->Env);
+				marker.Mark(it->Code);
+			}
+		}
+
+		bool SchemeFrameState::Run(size_t budget) THROW(critical_error) {
+			if (_finished)
+				return true;
+			// Registers are used by these names below
+			const SchemeCell *&x = _x;
+			EnvironmentType &env = _env;
+			PairType &code = _code;
+			SchemeCell &value = _value;
+			std::vector<SchemeFrame> &frames = _frames;
+			VectorType &values = _values;
+			// The calls live on the heap, not the C++ stack, so only the closure
+			// last entered is on the shadow stack, and builtins above it
+			SchemeProfiler::Scope profile;
+			if (_blocked != BLOCK_NONE) {
+				_blocked = BLOCK_NONE;
+				goto apply; // the call is back on the stacks as it was
+			}
+
+		eval: // evaluate *x in env
+			if (budget-- == 0)
+				return false; // resumes here
+			switch (x->Type) {
+				case SYMBOL: {
+					SchemeEnvironment::BindingType binding = (x->LexicalDepth != 0)
+						? env->ResolveLexical(*x)
+						: env->Resolve(x->AtomValue);
+					if (binding == nullptr)
+						throw critical_error(CRIT_SYMBOL_NOT_FOUND, *x);
+					value = *binding;
+					goto resume;
+				}
+				case STRING: // Fall through
+				case INTEGER: // Fall through
+				case FLOAT: // Fall through
+				case BIGINT:
+					value = *x;
+					goto resume;
+			}
+			if (x->Empty()) {
+				value = SchemeConstants::Nil;
+				goto resume;
+			}
+			{
+				const VectorType &list = x->ListValue;
+				if (list[0].Type == SYMBOL) {
+					switch (list[0].AtomValue) {
+					case ATOM_QUOTE: { // (quote exp)
+						SchemeStats::SpecialForm(SchemeCounters::QUOTE);
+						value = (*x)[1];
+						goto resume;
+					}
+					case ATOM_IF: { // (if test conseq [alt])
+						SchemeStats::SpecialForm(SchemeCounters::IF);
+						runtime_assert(list.size() > 2);
+						frames.push_back(SchemeFrame{ SchemeFrame::IF, 0, x, env, code });
+						x = &list[1];
+						goto eval;
+					}
+					case ATOM_SET: // (set! var exp) - must exist
+						// Fall through
+					case ATOM_DEFINE: { // (define var exp) - creates new or updates existing
+						runtime_assert(list.size() > 2 && list[1].Type == SYMBOL);
+						SchemeFrame::Kinds kind = list[0].AtomValue == ATOM_SET ? SchemeFrame::SET : SchemeFrame::DEFINE;
+						SchemeStats::SpecialForm(kind == SchemeFrame::SET ? SchemeCounters::SET : SchemeCounters::DEFINE);
+						frames.push_back(SchemeFrame{ kind, 0, x, env, code });
+						x = &list[2];
+						goto eval;
+					}
+					case ATOM_LAMBDA: // (lambda (var*) exp)
+						// Fall through
+					case ATOM_MACRO: { // (macro (var*) exp)
+						SchemeStats::SpecialForm(list[0].AtomValue == ATOM_MACRO ? SchemeCounters::MACRO : SchemeCounters::LAMBDA);
+						value = SchemeCell::Closure(*x, env);
+						goto resume;
+					}
+					case ATOM_BEGIN: { // (begin exp*)
+						SchemeStats::SpecialForm(SchemeCounters::BEGIN);
+						runtime_assert(x->SizeAtLeast(2));
+						if (list.size() > 2)
+							frames.push_back(SchemeFrame{ SchemeFrame::BEGIN, 2, x, env, code });
+						x = &list[1];
+						goto eval;
+					}
+					}
+				}
+				// (proc exp*)
+				frames.push_back(SchemeFrame{ SchemeFrame::OPERATOR, 0, x, env, code });
+				x = &list[0];
+				goto eval;
+			}
+
+		resume: // pass value to the innermost frame
+			if (frames.empty()) {
+				_finished = true;
+				return true;
+			}
+			{
+				SchemeFrame &frame = frames.back();
+				const VectorType &list = frame.Form->ListValue;
+				switch (frame.Kind) {
+				case SchemeFrame::IF: {
+					if (value != SchemeConstants::False)
+						x = &list[2];
+					else
+						x = list.size() > 3 ? &list[3] : &SchemeConstants::Nil;
+					break; // tail position: the frame is done
+				}
+				case SchemeFrame::SET: {
+					const SchemeCell &var = list[1];
+					SchemeEnvironment::BindingType binding = (var.LexicalDepth != 0)
+						? frame.Env->ResolveLexical(var)
+						: frame.Env->Resolve(var.AtomValue);
+					if (binding == nullptr)
+						throw critical_error(CRIT_SYMBOL_NOT_FOUND, var);
+					*binding = value;
+					frames.pop_back();
+					goto resume;
+				}
+				case SchemeFrame::DEFINE: {
+					(*frame.Env)[list[1].AtomValue] = value;
+					frames.pop_back();
+					goto resume;
+				}
+				case SchemeFrame::BEGIN: {
+					x = &list[frame.Index];
+					if (++frame.Index < list.size()) {
+						env = frame.Env;
+						code = frame.Code;
+						goto eval;
+					}
+					break; // last expression is in tail position
+				}
+				case SchemeFrame::OPERATOR: {
+					if (value.Type == MACRO) {
+						// Operands are passed unevaluated; the expansion is evaluated once built
+						VectorType operands(list.cbegin() + 1, list.cend());
+						env = SchemeHeap::New(value.Params(), std::move(operands), value.Environment);
+						frame.Kind = SchemeFrame::EXPANDED;
+						code = value.PairValue;
+						x = &value.Body();
+						goto eval;
+					}
+					values.push_back(std::move(value));
+					if (list.size() > 1) {
+						frame.Kind = SchemeFrame::OPERAND;
+						frame.Index = 1;
+						x = &list[1];
+						env = frame.Env;
+						code = frame.Code;
+						goto eval;
+					}
+					goto apply;
+				}
+				case SchemeFrame::OPERAND: {
+					values.push_back(std::move(value));
+					if (++frame.Index < list.size()) {
+						x = &list[frame.Index];
+						env = frame.Env;
+						code = frame.Code;
+						goto eval;
+					}
+					goto apply;
+				}
+				case SchemeFrame::EXPANDED: {
+					// The expansion is new code: address its own lambdas
+					SchemeLexical::Resolve(value);
+					env = frame.Env;
+					code = SchemeCell::Cons(value, SchemeCell(LIST)).PairValue;
+					frames.pop_back();
+					x = &code->Head;
+					goto eval;
+				}
+				}
+				// Continue with x in the frame's environment, in place of the frame
+				env = frame.Env;
+				code = std::move(frame.Code);
+				frames.pop_back();
+				goto eval;
+			}
+
+		apply: // call the operator with its operands, all on the value stack
+			{
+				SchemeFrame &frame = frames.back();
+				auto proc_it = values.end() - frame.Form->ListValue.size();
+				env = frame.Env;
+				SchemeCell proc = std::move(*proc_it);
+				VectorType args(std::make_move_iterator(proc_it + 1), std::make_move_iterator(values.end()));
+				values.erase(proc_it, values.end());
+				SchemeHeap::Root proc_root(proc), args_root(args);
+				switch (proc.Type) {
+					case LAMBDA: {
+						frames.pop_back();
+						// Flat frame: arguments land in parameter slot order
+						env = SchemeHeap::New(proc.Params(), std::move(args), proc.Environment);
+						profile.Running(proc);
+						code = proc.PairValue;
+						x = &proc.Body();
+						goto eval;
+					}
+					case PROC:
+						runtime_assert(proc.ProcValue != nullptr);
+						profile.Call(proc);
+						SchemeStats::Primitive((const void*)proc.ProcValue);
+						value = proc.ProcValue(args);
+						profile.Return();
+						break;
+					case PROCENV:
+						runtime_assert(proc.ProcEnvValue != nullptr);
+						profile.Call(proc);
+						SchemeStats::Primitive((const void*)proc.ProcEnvValue);
+						value = proc.ProcEnvValue(args, env);
+						profile.Return();
+						break;
+					default:
+						throw critical_error(CRIT_INVALID_PROC, proc);
+				}
+				if (block_requested != BLOCK_NONE) {
+					// Put the call back, with its frame still in place, for the next Run
+					_blocked = block_requested;
+					block_requested = BLOCK_NONE;
+					values.push_back(std::move(proc));
+					values.insert(values.end(), std::make_move_iterator(args.begin()), std::make_move_iterator(args.end()));
+					return false;
+				}
+				frames.pop_back();
+				goto resume;
+			}
+		}
+	}
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "SchemeCell.h"
+#include "SchemeEnvironment.h"
+#include "SchemeEval.h"
+#include "SchemeAssert.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		class SchemeMarker;
+
+		// What remains to be done with the value of the expression being evaluated:
+		// one entry of SchemeFrameEval's control stack.
+		struct SchemeFrame {
+			enum Kinds : uint8_t {
+				IF,        // choose the branch of (if test conseq [alt])
+				SET,       // assign to the variable of (set! var exp)
+				DEFINE,    // bind the variable of (define var exp)
+				BEGIN,     // evaluate expression Index of (begin exp*)
+				OPERATOR,  // operator of (proc exp*) evaluated: expand a macro or start on the operands
+				OPERAND,   // operand Index of (proc exp*) evaluated
+				EXPANDED   // macro expansion of Form built: evaluate it
+			};
+			Kinds Kind;
+			uint32_t Index;
+			const SchemeCell *Form; // the form this frame belongs to
+			EnvironmentType Env;    // environment Form is evaluated in
+			PairType Code;          // keeps Form alive: closure (params body), or expansion; nullptr at top level
+		};
+
+		// The registers and stacks of one evaluation by SchemeFrameEval. Its state
+		// is all here rather than on the C++ stack, so it can be run a few steps at
+		// a time and many evaluations can take turns (see SchemeTaskMachine).
+		class SchemeFrameState {
+		public:
+			// What a blocked call waits for, and so what makes it worth making again
+			enum BlockReasons : uint8_t {
+				BLOCK_NONE,
+				BLOCK_MAILBOX,  // a message (receive)
+				BLOCK_EVENT     // a notice from SchemeEventLoop: input, or a timer
+			};
+
+			// Evaluate item, already annotated by SchemeLexical, in env
+			SchemeFrameState(SchemeCell item, EnvironmentType env);
+
+			// Evaluate at most budget expressions. True once evaluation has finished,
+			// when Result holds its value.
+			bool Run(size_t budget = SIZE_MAX) THROW(critical_error);
+			bool Finished() const { return _finished; }
+			const SchemeCell &Result() const { return _value; }
+
+			// Called by a builtin that cannot go on yet (receive with no message):
+			// it returns no value, and its call is made again when Run next resumes.
+			// Run returns false at once, with Blocked true until then.
+			static void Block(BlockReasons reason);
+			bool Blocked() const { return _blocked != BLOCK_NONE; }
+			BlockReasons BlockReason() const { return _blocked; }
+
+			// Mark what the evaluation holds. Whoever owns a state must see that this
+			// is called by a root; Run roots only what it allocates while running.
+			void Mark(SchemeMarker &marker) const;
+		private:
+			// Registers: the expression (control), its environment, the owner of the
+			// code x points into, and the last value computed
+			const SchemeCell *_x;
+			EnvironmentType _env;
+			PairType _code;
+			SchemeCell _value;
+			std::vector<SchemeFrame> _frames;
+			VectorType _values;
+			bool _finished = false;
+			BlockReasons _blocked = BLOCK_NONE;
+		};
+
+		// Evaluates the same tree as SchemeSimpleEval, but as a CEK machine:
+		// the continuation is an explicit stack of SchemeFrame on the heap, and
+		// operator and operand values wait on a value stack. Nothing recurses on
+		// the C++ stack, not even macro expansion, so recursion depth is limited
+		// only by memory.
+		class SchemeFrameEval : public SchemeEvaluator {
+		public:
+			SchemeFrameEval() : SchemeEvaluator() { }
+			SchemeCell Eval(const SchemeCell &x, const SchemeCell &env) THROW(critical_error) override;
+		protected:
+			// Evaluate an expression already annotated by SchemeLexical
+			SchemeCell EvalResolved(SchemeCell x, EnvironmentType env) THROW(critical_error);
+		};
+	}
+}
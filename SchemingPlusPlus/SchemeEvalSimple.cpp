@@ -1,97 +1,138 @@
 #include "SchemeEvalSimple.h"
+#include "SchemeHeap.h"
+#include "SchemeLexical.h"
+#include "SchemeProfiler.h"
+#include "SchemeStats.h"
+#include "SchemeTrace.h"
 
 namespace SchemingPlusPlus {
 	namespace Core {
 		SchemeCell SchemeSimpleEval::Eval(const SchemeCell &item, const SchemeCell &env_item) THROW(critical_error) {
-			runtime_assert(env_item.Environment != nullptr);
 			SchemeCell x = item;
-			SchemeCell env = env_item;
+			SchemeLexical::Resolve(x);
+			return EvalResolved(x, env_item.Environment);
+		}
+
+		SchemeCell SchemeSimpleEval::EvalResolved(const SchemeCell &item, EnvironmentType env) THROW(critical_error) {
+			runtime_assert(env != nullptr);
+			// x walks the code in place. What it points into must outlive it: item,
+			// the body of the closure being run, or the last macro expansion.
+			const SchemeCell *x = &item;
+			SchemeCell callee, expansion;
+			SchemeHeap::Root env_root(env), callee_root(callee), expansion_root(expansion);
+			SchemeProfiler::Scope profile;
 		recurse:
-			switch(x.Type) {
-					case SYMBOL:
-						runtime_assert(env.Environment != nullptr);
-						return env.Environment->Find(x.Value)[x.Value];
+			switch(x->Type) {
+					case SYMBOL: {
+						SchemeEnvironment::BindingType binding = (x->LexicalDepth != 0)
+							? env->ResolveLexical(*x)
+							: env->Resolve(x->AtomValue);
+						if (binding == nullptr)
+							throw critical_error(CRIT_SYMBOL_NOT_FOUND, *x);
+						return *binding;
+					}
 					case STRING: // Fall through
 					case INTEGER: // Fall through
-					case FLOAT:
-						return x;
+					case FLOAT: // Fall through
+					case BIGINT:
+						return *x;
 			}
-			if (x.Empty()) return SchemeConstants::Nil;
+			if (x->Empty()) return SchemeConstants::Nil;
 
-			const SchemeCell &sym = x.Head();
+			const VectorType &list = x->ListValue;
+			const SchemeCell &sym = list[0];
 			if (sym.Type == SYMBOL) {
-				if (sym.Value == "quote") { // (quote exp)
-					return x.Tail().Head();
+				switch (sym.AtomValue) {
+				case ATOM_QUOTE: { // (quote exp)
+					SchemeStats::SpecialForm(SchemeCounters::QUOTE);
+					return (*x)[1];
 				}
-				if (sym.Value == "if") { // (if test conseq [alt])
-					const SchemeCell &test = x[1];
-					const SchemeCell &conseq = x[2];
-					SchemeCell alt = SchemeConstants::Nil;
-					if (x.SizeAtLeast(4)) alt = x[3];
-					SchemeCell testval = Eval(test, env);
-					x = (testval == SchemeConstants::False) ? alt : conseq;
+				case ATOM_IF: { // (if test conseq [alt])
+					SchemeStats::SpecialForm(SchemeCounters::IF);
+					const SchemeCell &test = list[1];
+					const SchemeCell &conseq = list[2];
+					const SchemeCell &alt = list.size() > 3 ? list[3] : SchemeConstants::Nil;
+					SchemeCell testval = EvalResolved(test, env);
+					x = (testval == SchemeConstants::False) ? &alt : &conseq;
 					goto recurse;
 				}
-				if (sym.Value == "set!") { // (set! var exp) - must exist
-					return env.Environment->Find(x[1].Value)[x[1].Value] = Eval(x[2], env);
+				case ATOM_SET: { // (set! var exp) - must exist
+					SchemeStats::SpecialForm(SchemeCounters::SET);
+					SchemeCell value = EvalResolved(list[2], env);
+					const SchemeCell &var = list[1];
+					SchemeEnvironment::BindingType binding = (var.LexicalDepth != 0)
+						? env->ResolveLexical(var)
+						: env->Resolve(var.AtomValue);
+					if (binding == nullptr)
+						throw critical_error(CRIT_SYMBOL_NOT_FOUND, var);
+					return *binding = std::move(value);
 				}
-				if (sym.Value == "define") { // (define var exp) - creates new or updates existing
-					return (*env.Environment)[x.ListValue[1].Value] = Eval(x.ListValue[2], env);
+				case ATOM_DEFINE: { // (define var exp) - creates new or updates existing
+					SchemeStats::SpecialForm(SchemeCounters::DEFINE);
+					return (*env)[list[1].AtomValue] = EvalResolved(list[2], env);
 				}
-				if (sym.Value == "lambda") { // (lambda (var*) exp)
-					SchemeCell copy(x);
-					copy.Type = LAMBDA;
-					copy.Environment = env.Environment;
-					return copy;
+				case ATOM_LAMBDA: // (lambda (var*) exp)
+					// Fall through
+				case ATOM_MACRO: { // (macro (var*) exp)
+					SchemeStats::SpecialForm(sym.AtomValue == ATOM_MACRO ? SchemeCounters::MACRO : SchemeCounters::LAMBDA);
+					return SchemeCell::Closure(*x, env);
 				}
-				if (sym.Value == "macro") { // (macro (var*) exp)
-					SchemeCell copy(x);
-					copy.Type = MACRO;
-					copy.Environment = env.Environment;
-					return copy;
-				}
-				if (sym.Value == "begin") { // (begin exp*)
-					runtime_assert(x.SizeAtLeast(1));
-					auto it = x.ListValue.cbegin() + 1;
-					for (; it != x.ListValue.cend() - 1; ++it)
-						Eval(*it, env);
-					x = *it;
+				case ATOM_BEGIN: { // (begin exp*)
+					SchemeStats::SpecialForm(SchemeCounters::BEGIN);
+					runtime_assert(x->SizeAtLeast(2));
+					auto it = list.cbegin() + 1;
+					for (; it != list.cend() - 1; ++it)
+						EvalResolved(*it, env);
+					x = &*it;
 					goto recurse;
 				}
+				}
 			}
 			// (proc exp*)
-			const SchemeCell proc = Eval(x[0], env);
-			VectorType exps = VectorType();
+			SchemeCell proc = EvalResolved(list[0], env);
+			SchemeHeap::Root proc_root(proc);
+			VectorType exps;
+			SchemeHeap::Root exps_root(exps);
 			if (proc.Type == MACRO)
-				exps = x.Tail().ListValue;
+				exps.assign(list.cbegin() + 1, list.cend());
 			else {
 				// (map (tail x) (lambda (y) (eval y env)))
-				for (auto it = x.ListValue.cbegin() + 1; it != x.ListValue.cend(); ++it)
-					exps.push_back(Eval(*it, env));
+				exps.reserve(list.size() - 1);
+				for (auto it = list.cbegin() + 1; it != list.cend(); ++it)
+					exps.push_back(EvalResolved(*it, env));
 			}
 			switch (proc.Type) {
 				case LAMBDA: {
-					SchemeEnvironment *env_ptr = new SchemeEnvironment(proc[1].ListValue, exps, proc.Environment);
-					EnvironmentType env_shared(env_ptr); // shared_ptr
-					env.Environment = env_shared; // swap environments
-					x = proc[2]; // set x to body
+					// Flat frame: arguments land in parameter slot order
+					env = SchemeHeap::New(proc.Params(), std::move(exps), proc.Environment); // swap environments
+					profile.TailCall(proc);
+					// Keep the closure alive while its body runs; x may point into the old one
+					callee = std::move(proc);
+					x = &callee.Body();
 					goto recurse;
 				}
 				case MACRO: {
-					SchemeEnvironment *env_ptr = new SchemeEnvironment(proc[1].ListValue, exps, proc.Environment);
-					EnvironmentType env_shared(env_ptr); // shared_ptr
-					SchemeCell env2(env_shared); // short life
-					x = Eval(proc[2], env2);
-					// env2 should deallocate here
+					{
+						SchemeTrace::Span span("expand", SchemeTrace::Span::Operator(*x));
+						EnvironmentType env2 = SchemeHeap::New(proc.Params(), std::move(exps), proc.Environment); // short life
+						expansion = EvalResolved(proc.Body(), env2);
+						// The expansion is new code: address its own lambdas
+						SchemeLexical::Resolve(expansion);
+					}
+					x = &expansion;
 					goto recurse;
 				}
 				case PROC: {
 					runtime_assert(proc.ProcValue != nullptr);
+					profile.Call(proc);
+					SchemeStats::Primitive((const void*)proc.ProcValue);
 					return proc.ProcValue(exps);
 				}
 				case PROCENV: {
 					runtime_assert(proc.ProcEnvValue != nullptr);
-					return proc.ProcEnvValue(exps, env.Environment);
+					profile.Call(proc);
+					SchemeStats::Primitive((const void*)proc.ProcEnvValue);
+					return proc.ProcEnvValue(exps, env);
 				}
 				default:
 					throw critical_error(CRIT_INVALID_PROC, proc);
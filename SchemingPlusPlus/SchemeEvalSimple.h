@@ -11,6 +11,9 @@ namespace SchemingPlusPlus {
 		public:
 			SchemeSimpleEval() : SchemeEvaluator() { }
 			SchemeCell Eval(const SchemeCell &x, const SchemeCell &env) THROW(critical_error) override;
+		protected:
+			// Evaluate an expression already annotated by SchemeLexical
+			SchemeCell EvalResolved(const SchemeCell &x, EnvironmentType env) THROW(critical_error);
 		};
 	}
 }
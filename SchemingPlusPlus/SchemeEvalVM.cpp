@@ -0,0 +1,187 @@
+#include <iterator>
+
+#include "SchemeEvalVM.h"
+#include "SchemeHeap.h"
+#include "SchemeLexical.h"
+#include "SchemeProfiler.h"
+#include "SchemeStats.h"
+#include "SchemeTrace.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		SchemeCell SchemeVMEval::Eval(const SchemeCell &item, const SchemeCell &env_item) THROW(critical_error) {
+			runtime_assert(env_item.Environment != nullptr);
+			SchemeCell x = item;
+			SchemeLexical::Resolve(x);
+			return Execute(SchemeCompiler::Compile(x), env_item.Environment);
+		}
+
+		SchemeCell SchemeVMEval::Execute(CodeType code, EnvironmentType env) THROW(critical_error) {
+			struct Frame {
+				CodeType code;
+				const int32_t *pc;
+				EnvironmentType env;
+			};
+			std::vector<Frame> frames;
+			VectorType stack;
+			SchemeCell A = SchemeConstants::Nil;
+			const int32_t *pc = code->Code.data();
+
+			// The machine's registers and stacks are its roots
+			SchemeHeap::Root env_root(env), stack_root(stack), A_root(A);
+			SchemeHeap::Root code_root(&code, [](const void *value, SchemeMarker &marker) {
+				marker.Mark(**static_cast<const CodeType*>(value));
+			});
+			SchemeHeap::Root frames_root(&frames, [](const void *value, SchemeMarker &marker) {
+				const std::vector<Frame> &frames = *static_cast<const std::vector<Frame>*>(value);
+				for (auto it = frames.cbegin(); it != frames.cend(); ++it) {
+					marker.Mark(it->env);
+					marker.Mark(*it->code);
+				}
+			});
+			// Above its base, the shadow stack holds a closure for each of frames,
+			// and the one running if there is one
+			SchemeProfiler::Scope profile;
+
+			for (;;) {
+				int32_t op = *pc++;
+				switch (op) {
+				case NOP:
+					break;
+				case DATA:
+					A = code->Data[*pc++];
+					break;
+				case LOOKUP: // Fall through
+				case SET: {
+					const SchemeCell &symbol = code->Data[*pc++];
+					SchemeEnvironment::BindingType binding = (symbol.LexicalDepth != 0)
+						? env->ResolveLexical(symbol)
+						: env->Resolve(symbol.AtomValue);
+					if (binding == nullptr)
+						throw critical_error(CRIT_SYMBOL_NOT_FOUND, symbol);
+					if (op == LOOKUP) {
+						// A closure made elsewhere, as by an image, is compiled here once
+						// and kept by its binding, not compiled again at every call
+						if ((binding->Type == LAMBDA || binding->Type == MACRO)
+							&& (binding->Compiled == nullptr || binding->Compiled->Kind != SchemeCompiled::BYTECODE))
+							binding->Compiled = CodeFor(*binding);
+						A = *binding;
+					} else {
+						SchemeStats::SpecialForm(SchemeCounters::SET);
+						*binding = A;
+					}
+					break;
+				}
+				case DEFINE:
+					SchemeStats::SpecialForm(SchemeCounters::DEFINE);
+					(*env)[code->Data[*pc++].AtomValue] = A;
+					break;
+				case CLOSURE: {
+					const CodeType &function = code->Functions[*pc++];
+					A = function->Form;
+					SchemeStats::SpecialForm(A.Type == MACRO ? SchemeCounters::MACRO : SchemeCounters::LAMBDA);
+					A.Environment = env;
+					A.Compiled = function;
+					break;
+				}
+				case PUSH:
+					stack.push_back(A);
+					break;
+				case BZ: {
+					SchemeStats::SpecialForm(SchemeCounters::IF);
+					int32_t target = *pc++;
+					if (A == SchemeConstants::False)
+						pc = code->Code.data() + target;
+					break;
+				}
+				case JMP:
+					pc = code->Code.data() + *pc;
+					break;
+				case EXPAND: {
+					const SchemeCell &form = code->Data[*pc++];
+					int32_t target = *pc++;
+					if (A.Type == MACRO) {
+						A = Expand(A, form, env);
+						pc = code->Code.data() + target;
+					}
+					break;
+				}
+				case CALL: // Fall through
+				case TAILCALL: {
+					auto proc_it = stack.end() - *pc++ - 1;
+					SchemeCell proc = std::move(*proc_it);
+					VectorType args(std::make_move_iterator(proc_it + 1), std::make_move_iterator(stack.end()));
+					SchemeHeap::Root proc_root(proc), args_root(args);
+					stack.erase(proc_it, stack.end());
+					switch (proc.Type) {
+						case LAMBDA: {
+							// Flat frame: arguments land in parameter slot order
+							EnvironmentType frame = SchemeHeap::New(proc.Params(), std::move(args), proc.Environment);
+							if (op == CALL) {
+								frames.push_back(Frame{ code, pc, env });
+								profile.Call(proc);
+							} else {
+								profile.TailCall(proc);
+							}
+							code = CodeFor(proc);
+							env = frame;
+							pc = code->Code.data();
+							break;
+						}
+						case PROC:
+							runtime_assert(proc.ProcValue != nullptr);
+							profile.Call(proc);
+							SchemeStats::Primitive((const void*)proc.ProcValue);
+							A = proc.ProcValue(args);
+							profile.Return();
+							break;
+						case PROCENV:
+							runtime_assert(proc.ProcEnvValue != nullptr);
+							profile.Call(proc);
+							SchemeStats::Primitive((const void*)proc.ProcEnvValue);
+							A = proc.ProcEnvValue(args, env);
+							profile.Return();
+							break;
+						default:
+							throw critical_error(CRIT_INVALID_PROC, proc);
+					}
+					break;
+				}
+				case RETURN: {
+					if (frames.empty())
+						return A;
+					Frame &caller = frames.back();
+					code = std::move(caller.code);
+					pc = caller.pc;
+					env = std::move(caller.env);
+					frames.pop_back();
+					profile.Return();
+					break;
+				}
+				default:
+					throw critical_error(CRIT_OP_INVALID, "opcode " + std::to_string(op));
+				}
+			}
+		}
+
+		SchemeCell SchemeVMEval::Expand(const SchemeCell &macro, const SchemeCell &form, EnvironmentType env) THROW(critical_error) {
+			SchemeCell expansion;
+			SchemeHeap::Root expansion_root(expansion);
+			{
+				SchemeTrace::Span span("expand", SchemeTrace::Span::Operator(form));
+				VectorType operands(form.ListValue.cbegin() + 1, form.ListValue.cend());
+				EnvironmentType frame = SchemeHeap::New(macro.Params(), std::move(operands), macro.Environment);
+				expansion = Execute(CodeFor(macro), frame);
+				// The expansion is new code: address its own lambdas
+				SchemeLexical::Resolve(expansion);
+			}
+			return Execute(SchemeCompiler::Compile(expansion), env);
+		}
+
+		CodeType SchemeVMEval::CodeFor(const SchemeCell &proc) SCHEME_THROW {
+			if (proc.Compiled != nullptr && proc.Compiled->Kind == SchemeCompiled::BYTECODE)
+				return std::static_pointer_cast<const SchemeCode>(proc.Compiled);
+			return SchemeCompiler::CompileFunction(proc);
+		}
+	}
+}
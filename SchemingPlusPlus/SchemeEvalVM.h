@@ -0,0 +1,27 @@
+#pragma once
+
+#include "SchemeCell.h"
+#include "SchemeCompiler.h"
+#include "SchemeEnvironment.h"
+#include "SchemeEval.h"
+#include "SchemeAssert.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		// Compiles each expression to bytecode (see SchemeCompiler) and runs it on a
+		// stack machine. Closure calls use the machine's own call stack rather than
+		// the C++ one, so only macro expansion nests.
+		class SchemeVMEval : public SchemeEvaluator {
+		public:
+			SchemeVMEval() : SchemeEvaluator() { }
+			SchemeCell Eval(const SchemeCell &x, const SchemeCell &env) THROW(critical_error) override;
+		protected:
+			// Run code in env until its outermost frame returns
+			SchemeCell Execute(CodeType code, EnvironmentType env) THROW(critical_error);
+			// Expand the macro call form, then run the expansion in env
+			SchemeCell Expand(const SchemeCell &macro, const SchemeCell &form, EnvironmentType env) THROW(critical_error);
+			// Bytecode for a LAMBDA or MACRO, compiled now if another evaluator created it
+			static CodeType CodeFor(const SchemeCell &proc) SCHEME_THROW;
+		};
+	}
+}
@@ -0,0 +1,236 @@
+#include <algorithm>
+
+#include "SchemeEventLoop.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		namespace {
+			std::atomic<SchemeEventLoop*> started{ nullptr };
+		}
+
+		SchemeEventLoop &SchemeEventLoop::Instance() {
+			// Never destroyed: processes may still be running as statics are
+			static SchemeEventLoop *loop = new SchemeEventLoop();
+			started = loop;
+			return *loop;
+		}
+
+		bool SchemeEventLoop::WaitIdle() {
+			SchemeEventLoop *loop = started;
+			if (loop == nullptr)
+				return false;
+			std::unique_lock<std::mutex> guard(loop->_lock);
+			if (loop->Waiting() == 0)
+				return false;
+			loop->_idle.wait(guard, [loop] { return loop->Waiting() == 0; });
+			return true;
+		}
+
+		void SchemeEventLoop::Stop() {
+			SchemeEventLoop *loop = started;
+			if (loop != nullptr)
+				loop->StopThread();
+		}
+
+		size_t SchemeEventLoop::Waiting() const {
+			size_t waiting = _timers.size() + _waking;
+			for (auto it = _readers.cbegin(); it != _readers.cend(); ++it)
+				waiting += it->second.size();
+			return waiting;
+		}
+
+#ifdef __linux__
+		bool SchemeEventLoop::Supported() {
+			return true;
+		}
+
+		SchemeEventLoop::SchemeEventLoop() {
+			_epoll = epoll_create1(EPOLL_CLOEXEC);
+			_interrupt = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+			epoll_event event{};
+			event.events = EPOLLIN;
+			event.data.fd = _interrupt;
+			epoll_ctl(_epoll, EPOLL_CTL_ADD, _interrupt, &event);
+			_thread = std::thread(&SchemeEventLoop::Run, this);
+		}
+
+		SchemeEventLoop::~SchemeEventLoop() {
+			StopThread();
+			close(_interrupt);
+			close(_epoll);
+		}
+
+		void SchemeEventLoop::StopThread() {
+			{
+				std::lock_guard<std::mutex> guard(_lock);
+				if (_stopping)
+					return;
+				_stopping = true;
+			}
+			Interrupt();
+			_thread.join();
+		}
+
+		void SchemeEventLoop::Interrupt() {
+			uint64_t one = 1;
+			ssize_t written = write(_interrupt, &one, sizeof one);
+			(void)written; // only fails if the counter is already huge, so the loop wakes anyway
+		}
+
+		void SchemeEventLoop::WaitReadable(int fd, SchemeProcess::IdType process) {
+			{
+				std::lock_guard<std::mutex> guard(_lock);
+				std::vector<SchemeProcess::IdType> &waiters = _readers[fd];
+				waiters.push_back(process);
+				if (waiters.size() > 1)
+					return;
+				// epoll_wait picks up a descriptor added while it waits
+				epoll_event event{};
+				event.events = EPOLLIN | EPOLLRDHUP;
+				event.data.fd = fd;
+				if (epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &event) == 0)
+					return;
+				// Not pollable (a regular file), so never has to be waited for
+				_readers.erase(fd);
+			}
+			SchemeProcess::Notify(process);
+		}
+
+		void SchemeEventLoop::Forget(int fd) {
+			SchemeEventLoop *loop = started;
+			if (loop == nullptr)
+				return;
+			std::vector<SchemeProcess::IdType> waiters;
+			{
+				std::lock_guard<std::mutex> guard(loop->_lock);
+				auto found = loop->_readers.find(fd);
+				if (found == loop->_readers.end())
+					return;
+				waiters = std::move(found->second);
+				loop->_readers.erase(found);
+				loop->_waking += waiters.size();
+				epoll_ctl(loop->_epoll, EPOLL_CTL_DEL, fd, nullptr);
+			}
+			for (auto it = waiters.cbegin(); it != waiters.cend(); ++it)
+				SchemeProcess::Notify(*it);
+			std::lock_guard<std::mutex> guard(loop->_lock);
+			loop->_waking -= waiters.size();
+			if (loop->Waiting() == 0)
+				loop->_idle.notify_all();
+		}
+
+		bool SchemeEventLoop::SleepUntil(ClockType::time_point deadline, SchemeProcess::IdType process) {
+			std::lock_guard<std::mutex> guard(_lock);
+			auto found = _sleepers.find(process);
+			if (found != _sleepers.end()) {
+				if (!found->second.second)
+					return false;
+				_sleepers.erase(found);
+				return true;
+			}
+			if (deadline <= ClockType::now())
+				return true;
+			_sleepers.emplace(process, std::make_pair(deadline, false));
+			bool earliest = _timers.empty() || deadline < _timers.begin()->first;
+			_timers.emplace(deadline, process);
+			if (earliest)
+				Interrupt();
+			return false;
+		}
+
+		void SchemeEventLoop::Run() {
+			epoll_event events[64];
+			std::vector<SchemeProcess::IdType> wake;
+			for (;;) {
+				int timeout = -1;
+				{
+					std::lock_guard<std::mutex> guard(_lock);
+					if (_stopping)
+						return;
+					if (!_timers.empty()) {
+						auto wait = std::chrono::ceil<std::chrono::milliseconds>(_timers.begin()->first - ClockType::now());
+						timeout = (int)std::max<std::chrono::milliseconds::rep>(wait.count(), 0);
+					}
+				}
+				int count = epoll_wait(_epoll, events, 64, timeout);
+				{
+					std::lock_guard<std::mutex> guard(_lock);
+					for (int i = 0; i < count; ++i) {
+						int fd = events[i].data.fd;
+						if (fd == _interrupt) {
+							uint64_t value;
+							ssize_t got = read(_interrupt, &value, sizeof value);
+							(void)got;
+							continue;
+						}
+						// One shot: whoever wants more calls WaitReadable again
+						auto found = _readers.find(fd);
+						if (found == _readers.end())
+							continue;
+						wake.insert(wake.end(), found->second.cbegin(), found->second.cend());
+						_readers.erase(found);
+						epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, nullptr);
+					}
+					ClockType::time_point now = ClockType::now();
+					while (!_timers.empty() && _timers.begin()->first <= now) {
+						auto sleeper = _sleepers.find(_timers.begin()->second);
+						if (sleeper != _sleepers.end())
+							sleeper->second.second = true;
+						wake.push_back(_timers.begin()->second);
+						_timers.erase(_timers.begin());
+					}
+					_waking += wake.size();
+				}
+				// Outside the lock: waking a process queues it on the executor. Those
+				// being woken still count as waiting, so WaitIdle returns only once
+				// they are queued.
+				for (auto it = wake.cbegin(); it != wake.cend(); ++it)
+					SchemeProcess::Notify(*it);
+				if (!wake.empty()) {
+					std::lock_guard<std::mutex> guard(_lock);
+					_waking -= wake.size();
+					wake.clear();
+					if (Waiting() == 0)
+						_idle.notify_all();
+				}
+			}
+		}
+#else
+		bool SchemeEventLoop::Supported() {
+			return false;
+		}
+
+		SchemeEventLoop::SchemeEventLoop() {
+		}
+
+		SchemeEventLoop::~SchemeEventLoop() {
+		}
+
+		void SchemeEventLoop::StopThread() {
+		}
+
+		void SchemeEventLoop::Interrupt() {
+		}
+
+		void SchemeEventLoop::WaitReadable(int fd, SchemeProcess::IdType process) {
+			SchemeProcess::Notify(process);
+		}
+
+		void SchemeEventLoop::Forget(int fd) {
+		}
+
+		bool SchemeEventLoop::SleepUntil(ClockType::time_point deadline, SchemeProcess::IdType process) {
+			return deadline <= ClockType::now();
+		}
+
+		void SchemeEventLoop::Run() {
+		}
+#endif
+	}
+}
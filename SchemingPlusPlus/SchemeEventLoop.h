@@ -0,0 +1,70 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "SchemeProcess.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		// Waits on file descriptors and timers for processes, so that a process
+		// which would block gives up its worker instead (see SchemeFrameState::Block).
+		// One thread runs epoll_wait for the whole runtime. When a descriptor
+		// becomes readable, or a timer is due, the processes waiting for it are
+		// woken (SchemeProcess::Notify) and make their call again.
+		//
+		// Only Linux has epoll. Elsewhere Supported is false, and builtins block
+		// the thread they run on as before.
+		class SchemeEventLoop {
+		public:
+			typedef std::chrono::steady_clock ClockType;
+
+			// The runtime's loop, started on first use
+			static SchemeEventLoop &Instance();
+			static bool Supported();
+
+			~SchemeEventLoop();
+			SchemeEventLoop(const SchemeEventLoop &) = delete;
+			SchemeEventLoop &operator = (const SchemeEventLoop &) = delete;
+
+			// Wake process once fd is readable (or has been closed)
+			void WaitReadable(int fd, SchemeProcess::IdType process);
+			// Forget fd before it is closed, waking whoever waits for it
+			static void Forget(int fd);
+			// For a process that sleeps until deadline: true once the deadline has
+			// passed. The first call sets the timer, and the call made again after
+			// the wake up ends the sleep; other wake ups find it still pending.
+			bool SleepUntil(ClockType::time_point deadline, SchemeProcess::IdType process);
+
+			// Wait until no process waits on the loop, if any does. False if none did.
+			static bool WaitIdle();
+			// Stop the loop's thread, if started: at exit, so nothing is woken after
+			static void Stop();
+		private:
+			SchemeEventLoop();
+			void StopThread();
+			void Run();
+			// Tell the loop thread its timers or registrations have changed
+			void Interrupt();
+			// Processes waiting on a descriptor or timer. Under _lock.
+			size_t Waiting() const;
+
+			std::mutex _lock;
+			std::condition_variable _idle;  // notified when nothing is waited for
+			int _epoll = -1;
+			int _interrupt = -1;    // eventfd; readable when the loop should look again
+			bool _stopping = false;
+			size_t _waking = 0;     // taken off the loop, and not yet queued by Notify
+			std::unordered_map<int, std::vector<SchemeProcess::IdType>> _readers;
+			// Sleeping processes by deadline, and whether each one's has passed
+			std::multimap<ClockType::time_point, SchemeProcess::IdType> _timers;
+			std::unordered_map<SchemeProcess::IdType, std::pair<ClockType::time_point, bool>> _sleepers;
+			std::thread _thread;
+		};
+	}
+}
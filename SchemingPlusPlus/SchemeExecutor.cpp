@@ -0,0 +1,141 @@
+#include <algorithm>
+
+#include "SchemeExecutor.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		namespace {
+			// The executor and worker the calling thread belongs to, if it is a worker
+			thread_local const SchemeExecutor *current_executor = nullptr;
+			thread_local size_t current_worker = 0;
+		}
+
+		SchemeExecutor::SchemeExecutor(size_t threads) {
+			if (threads == 0)
+				threads = std::max(1u, std::thread::hardware_concurrency());
+			for (size_t i = 0; i < threads; ++i)
+				_workers.push_back(std::make_unique<Worker>());
+			// Start only once every queue exists: workers steal from each other
+			for (size_t i = 0; i < threads; ++i)
+				_workers[i]->thread = std::thread(&SchemeExecutor::Run, this, i);
+		}
+
+		SchemeExecutor::~SchemeExecutor() {
+			Wait();
+			{
+				std::lock_guard<std::mutex> guard(_lock);
+				_stopping = true;
+			}
+			_wake.notify_all();
+			for (auto it = _workers.begin(); it != _workers.end(); ++it)
+				(*it)->thread.join();
+		}
+
+		void SchemeExecutor::Submit(JobType job) {
+			Queue(std::move(job), false);
+		}
+
+		void SchemeExecutor::Requeue(JobType job) {
+			Queue(std::move(job), true);
+		}
+
+		void SchemeExecutor::Queue(JobType job, bool behind) {
+			size_t index = current_executor == this
+				? current_worker
+				: _next.fetch_add(1, std::memory_order_relaxed) % _workers.size();
+			++_pending;
+			{
+				// Under the lock, so a worker about to sleep sees the count or the wake up.
+				// Counted first: a worker may take the job as soon as it is queued.
+				std::lock_guard<std::mutex> guard(_lock);
+				++_queued;
+			}
+			{
+				Worker &worker = *_workers[index];
+				std::lock_guard<std::mutex> guard(worker.lock);
+				// A worker takes its own jobs from the back
+				if (behind)
+					worker.jobs.push_front(std::move(job));
+				else
+					worker.jobs.push_back(std::move(job));
+			}
+			_wake.notify_one();
+		}
+
+		void SchemeExecutor::Wait() {
+			std::unique_lock<std::mutex> guard(_lock);
+			_idle.wait(guard, [this] { return _pending == 0; });
+		}
+
+		size_t SchemeExecutor::Idle() const {
+			size_t busy = _running + _queued;
+			return busy < _workers.size() ? _workers.size() - busy : 0;
+		}
+
+		SchemeExecutor &SchemeExecutor::Shared() {
+			static SchemeExecutor shared;
+			return shared;
+		}
+
+		SchemeExecutorStats SchemeExecutor::Stats() const {
+			SchemeExecutorStats stats;
+			for (auto it = _workers.cbegin(); it != _workers.cend(); ++it) {
+				stats.Executed += (*it)->executed;
+				stats.Stolen += (*it)->stolen;
+			}
+			return stats;
+		}
+
+		bool SchemeExecutor::Take(size_t index, JobType &job) {
+			// Only one queue is locked at a time, so thieves cannot deadlock
+			Worker &own = *_workers[index];
+			{
+				std::lock_guard<std::mutex> guard(own.lock);
+				if (!own.jobs.empty()) {
+					job = std::move(own.jobs.back());
+					own.jobs.pop_back();
+					++own.executed;
+					return true;
+				}
+			}
+			for (size_t i = 1; i < _workers.size(); ++i) {
+				Worker &victim = *_workers[(index + i) % _workers.size()];
+				{
+					std::lock_guard<std::mutex> guard(victim.lock);
+					if (victim.jobs.empty())
+						continue;
+					job = std::move(victim.jobs.front());
+					victim.jobs.pop_front();
+				}
+				++own.executed;
+				++own.stolen;
+				return true;
+			}
+			return false;
+		}
+
+		void SchemeExecutor::Run(size_t index) {
+			current_executor = this;
+			current_worker = index;
+			JobType job;
+			for (;;) {
+				if (Take(index, job)) {
+					++_running;
+					--_queued;
+					job();
+					job = nullptr;
+					--_running;
+					if (--_pending == 0) {
+						std::lock_guard<std::mutex> guard(_lock);
+						_idle.notify_all();
+					}
+					continue;
+				}
+				std::unique_lock<std::mutex> guard(_lock);
+				_wake.wait(guard, [this] { return _stopping || _queued > 0; });
+				if (_stopping && _queued == 0)
+					return;
+			}
+		}
+	}
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		struct SchemeExecutorStats {
+			size_t Executed = 0;  // jobs run
+			size_t Stolen = 0;    // jobs run by a worker other than the one they were queued on
+		};
+
+		// A work stealing thread pool. Each worker has its own queue: it takes its
+		// newest job first, and when its queue is empty steals the oldest job of
+		// another worker. Queues are locked only to take or add a job, never while
+		// one runs, so jobs that do not share data (such as SchemeIsolate runs) run
+		// in parallel without contention.
+		class SchemeExecutor {
+		public:
+			typedef std::function<void()> JobType;
+
+			// threads 0: one per hardware thread
+			explicit SchemeExecutor(size_t threads = 0);
+			// Waits for every job, then stops the workers
+			~SchemeExecutor();
+			SchemeExecutor(const SchemeExecutor &) = delete;
+			SchemeExecutor &operator = (const SchemeExecutor &) = delete;
+
+			// Queue a job: on the calling worker's own queue, or shared out round robin
+			// when called from another thread. Jobs must not throw.
+			void Submit(JobType job);
+			// Queue a job behind everything already on the calling worker's queue:
+			// for a job that has had its turn and reschedules itself, so the others
+			// come first. From another thread, as Submit.
+			void Requeue(JobType job);
+			// Wait until every job submitted so far has run. Not from within a job.
+			void Wait();
+
+			size_t Threads() const { return _workers.size(); }
+			// Workers with nothing to run or take: a hint whether work is worth handing out
+			size_t Idle() const;
+			SchemeExecutorStats Stats() const;
+
+			// The pool shared by processes and futures, started on first use
+			static SchemeExecutor &Shared();
+		private:
+			struct Worker {
+				std::mutex lock;
+				std::deque<JobType> jobs;
+				std::thread thread;
+				std::atomic<size_t> executed{ 0 };
+				std::atomic<size_t> stolen{ 0 };
+			};
+
+			std::vector<std::unique_ptr<Worker>> _workers;
+			// Sleeping workers wait on this for new jobs; Wait waits on it for none pending
+			std::mutex _lock;
+			std::condition_variable _wake;
+			std::condition_variable _idle;
+			std::atomic<size_t> _pending{ 0 };   // submitted and not yet finished
+			std::atomic<size_t> _queued{ 0 };    // submitted and not yet taken
+			std::atomic<size_t> _running{ 0 };   // taken and not yet finished
+			std::atomic<size_t> _next{ 0 };      // round robin for outside submissions
+			bool _stopping = false;
+
+			void Queue(JobType job, bool behind);
+			void Run(size_t index);
+			// Take a job, from worker index's own queue or by stealing. False if none.
+			bool Take(size_t index, JobType &job);
+		};
+	}
+}
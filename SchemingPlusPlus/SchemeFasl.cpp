@@ -0,0 +1,183 @@
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
+
+#include "SchemeAssert.h"
+#include "SchemeBinary.h"
+#include "SchemeFasl.h"
+#include "SchemeReader.h"
+#include "SchemeSymbols.h"
+#include "SchemeTrace.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		namespace {
+			const std::string_view Magic("SFASL");
+
+			enum Tags : uint8_t { TAG_SYMBOL, TAG_STRING, TAG_INTEGER, TAG_FLOAT, TAG_BIGINT, TAG_LIST };
+
+			SchemeCell ReadScalar(SchemeBinaryReader &in, uint8_t tag, const VectorType &symbols) SCHEME_THROW {
+				switch (tag) {
+					case TAG_SYMBOL: {
+						uint64_t index = in.Varint();
+						if (index >= symbols.size())
+							throw critical_error(CRIT_SYNTAX, std::string("FASL symbol out of range"));
+						return symbols[(size_t)index];
+					}
+					case TAG_STRING:
+						return SchemeCell(std::string(in.Text()), STRING);
+					case TAG_INTEGER:
+						return SchemeCell((IntegerType)in.Signed());
+					case TAG_FLOAT:
+						return SchemeCell(in.Float());
+					case TAG_BIGINT:
+						return SchemeCell(std::string(in.Text()), BIGINT);
+					default:
+						throw critical_error(CRIT_SYNTAX, std::string("FASL tag unknown"));
+				}
+			}
+		}
+
+		std::string SchemeFasl::Write(const VectorType &forms) SCHEME_THROW {
+			SchemeBinaryWriter symbols, body;
+			std::unordered_map<AtomType, uint64_t> indices;
+			// Cells still to write, next last. Iterative, as for ReadFrom, so
+			// nesting depth does not use the C++ stack.
+			std::vector<const SchemeCell*> pending;
+			// PAIR lists as LIST. A deque, as pending points into the ones written so far.
+			std::deque<SchemeCell> converted;
+			for (auto form = forms.crbegin(); form != forms.crend(); ++form)
+				pending.push_back(&*form);
+			while (!pending.empty()) {
+				const SchemeCell *cell = pending.back();
+				pending.pop_back();
+				switch (cell->Type) {
+					case SYMBOL: {
+						auto found = indices.find(cell->AtomValue);
+						if (found == indices.end()) {
+							found = indices.emplace(cell->AtomValue, indices.size()).first;
+							symbols.Text(cell->Value);
+						}
+						body.Byte(TAG_SYMBOL);
+						body.Varint(found->second);
+						break;
+					}
+					case STRING:
+						body.Byte(TAG_STRING);
+						body.Text(cell->Value);
+						break;
+					case INTEGER:
+						body.Byte(TAG_INTEGER);
+						body.Signed(cell->IntegerValue);
+						break;
+					case FLOAT:
+						body.Byte(TAG_FLOAT);
+						body.Float(cell->FloatValue);
+						break;
+					case BIGINT:
+						body.Byte(TAG_BIGINT);
+						body.Text(cell->ToString());
+						break;
+					case PAIR:
+						converted.push_back(cell->ToList());
+						cell = &converted.back();
+						// Fall through
+					case LIST:
+						body.Byte(TAG_LIST);
+						body.Varint(cell->ListValue.size());
+						for (auto it = cell->ListValue.crbegin(); it != cell->ListValue.crend(); ++it)
+							pending.push_back(&*it);
+						break;
+					default:
+						throw critical_error(CRIT_TYPE_NOT_IMPL, "FASL cannot hold " + CellTypeToString(cell->Type));
+				}
+			}
+
+			SchemeBinaryWriter out;
+			out.Data = Magic;
+			out.Byte(Version);
+			out.Varint(indices.size());
+			out.Data += symbols.Data;
+			out.Varint(forms.size());
+			out.Data += body.Data;
+			return out.Data;
+		}
+
+		VectorType SchemeFasl::Read(std::string_view data) SCHEME_THROW {
+			SchemeBinaryReader in(data);
+			if (in.Bytes(Magic.size()) != Magic || in.Byte() != Version)
+				throw critical_error(CRIT_SYNTAX, std::string("not a FASL file, or another version"));
+
+			// Each symbol is interned once; its cells are copies of this one
+			VectorType symbols(in.Count(), SchemeConstants::Nil);
+			for (auto it = symbols.begin(); it != symbols.end(); ++it)
+				*it = SchemeCell(std::string(in.Text()), SYMBOL);
+
+			VectorType forms;
+			uint64_t count = in.Count();
+			forms.reserve((size_t)count);
+			// Lists still open, innermost last. The size of each is known when it
+			// opens, so elements are decoded straight into their list.
+			struct Open { SchemeCell list; uint64_t size; };
+			std::vector<Open> open;
+			while (forms.size() < count) {
+				uint8_t tag = in.Byte();
+				if (tag == TAG_LIST) {
+					uint64_t size = in.Count();
+					if (size != 0) {
+						open.push_back(Open{ SchemeCell(VectorType()), size });
+						open.back().list.ListValue.reserve((size_t)size);
+						continue;
+					}
+				}
+				SchemeCell cell = tag == TAG_LIST ? SchemeCell(VectorType()) : ReadScalar(in, tag, symbols);
+				// Close every list this cell completes
+				for (;;) {
+					if (open.empty()) {
+						forms.push_back(std::move(cell));
+						break;
+					}
+					VectorType &elements = open.back().list.ListValue;
+					elements.push_back(std::move(cell));
+					if (elements.size() < open.back().size)
+						break;
+					cell = std::move(open.back().list);
+					open.pop_back();
+				}
+			}
+			if (!in.AtEnd())
+				throw critical_error(CRIT_SYNTAX, std::string("FASL data has trailing bytes"));
+			return forms;
+		}
+
+		VectorType SchemeFasl::Load(const std::string &path) SCHEME_THROW {
+			namespace fs = std::filesystem;
+			const std::string cache = CachePath(path);
+			std::error_code source_error, cache_error;
+			fs::file_time_type source_time = fs::last_write_time(path, source_error);
+			fs::file_time_type cache_time = fs::last_write_time(cache, cache_error);
+			if (!source_error && !cache_error && cache_time > source_time) {
+				SchemeMappedFile data(cache);
+				try {
+					SchemeTrace::Span span("parse", path.c_str());
+					return Read(data.Data());
+				} catch (critical_error &) {
+					// Damaged or from another version: rebuild it from source
+				}
+			}
+
+			std::ifstream file(path, std::ios::binary);
+			if (!file)
+				throw critical_error(CRIT_INVALID_PROC, path + ": cannot open file");
+			SchemeReader reader;
+			VectorType forms;
+			SchemeCell form;
+			while (reader.NextFrom(file, form))
+				forms.push_back(std::move(form));
+			// A cache that cannot be written only costs the next load a parse
+			WriteFileAtomic(cache, Write(forms));
+			return forms;
+		}
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "SchemeCell.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		// FASL ("fast load"): a compact binary form of parsed source, so a file
+		// that has not changed need not be tokenised and parsed again.
+		//
+		// Layout, all integers unsigned LEB128 varints unless noted:
+		//   "SFASL" version
+		//   symbol count, then each symbol name as length + bytes
+		//   form count, then each form as a tagged tree:
+		//     SYMBOL index into the symbol table
+		//     STRING length + bytes
+		//     INTEGER zigzag encoded value
+		//     FLOAT 8 bytes, IEEE 754 little endian
+		//     BIGINT length + decimal digits
+		//     LIST element count + elements
+		// There are no offsets or pointers, so the data is read in place from a
+		// memory mapped file.
+		struct SchemeFasl {
+			static const uint8_t Version = 1;
+
+			// Serialise forms. Only data can be written: symbols, strings, numbers and lists.
+			static std::string Write(const VectorType &forms) SCHEME_THROW;
+			// Deserialise forms written by Write
+			static VectorType Read(std::string_view data) SCHEME_THROW;
+
+			// The forms of the source file at path, read from its cache (path + ".fasl")
+			// if that is newer than the source. Otherwise the source is parsed and
+			// the cache rewritten, if it can be.
+			static VectorType Load(const std::string &path) SCHEME_THROW;
+			static std::string CachePath(const std::string &path) { return path + ".fasl"; }
+		};
+	}
+}
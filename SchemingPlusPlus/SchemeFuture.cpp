@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "SchemeAssert.h"
+#include "SchemeEvalFrame.h"
+#include "SchemeExecutor.h"
+#include "SchemeFuture.h"
+#include "SchemeHeap.h"
+#include "SchemeProcess.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		namespace {
+			enum Kinds {
+				APPLY,   // (proc item*)
+				MAP,     // (proc item) for each item
+				REDUCE   // items folded with proc, from the first
+			};
+
+			// A call, or part of a map or reduce, that may be handed to a worker. It is
+			// run once, by whoever claims it first: the worker, or the thread that
+			// wants its value and finds it not yet begun.
+			struct Work {
+				Kinds kind;
+				SchemeMessage proc, items;
+				std::atomic<bool> claimed{ false };
+				std::mutex lock;
+				std::condition_variable done;
+				bool finished = false;
+				SchemeMessage value;
+				std::exception_ptr error;
+			};
+
+			// Evaluate (proc arg*) in env, in the current heap
+			SchemeCell Apply(const SchemeCell &proc, const VectorType &args, EnvironmentType env) SCHEME_THROW {
+				// (quote proc) (quote arg)*: each evaluates to the value as it is
+				const SchemeCell quote(std::string("quote"));
+				VectorType form;
+				form.reserve(args.size() + 1);
+				form.push_back(SchemeCell(VectorType{ quote, proc }));
+				for (auto it = args.cbegin(); it != args.cend(); ++it)
+					form.push_back(SchemeCell(VectorType{ quote, *it }));
+				SchemeFrameEval evaluator;
+				return evaluator.Eval(SchemeCell(std::move(form)), SchemeCell(env));
+			}
+
+			SchemeCell Compute(Kinds kind, const SchemeCell &proc, const VectorType &items) SCHEME_THROW {
+				EnvironmentType env = SchemeHeap::New();
+				SchemeHeap::Root env_root(env);
+				switch (kind) {
+					case APPLY:
+						return Apply(proc, items, env);
+					case MAP: {
+						VectorType values;
+						SchemeHeap::Root values_root(values);
+						values.reserve(items.size());
+						for (auto it = items.cbegin(); it != items.cend(); ++it)
+							values.push_back(Apply(proc, VectorType{ *it }, env));
+						return SchemeCell(std::move(values));
+					}
+					case REDUCE: {
+						runtime_assert(!items.empty());
+						SchemeCell value = items[0];
+						SchemeHeap::Root value_root(value);
+						for (auto it = items.cbegin() + 1; it != items.cend(); ++it)
+							value = Apply(proc, VectorType{ value, *it }, env);
+						return value;
+					}
+				}
+				return SchemeConstants::Nil;
+			}
+
+			// Run work in the current heap, on copies of its values
+			void Run(Work &work) {
+				try {
+					SchemeCell proc = work.proc.Open();
+					SchemeHeap::Root proc_root(proc);
+					SchemeCell items = work.items.Open();
+					SchemeHeap::Root items_root(items);
+					work.value = SchemeMessage::Move(Compute(work.kind, proc, items.ListValue));
+				} catch (...) {
+					work.error = std::current_exception();
+				}
+				std::lock_guard<std::mutex> guard(work.lock);
+				work.finished = true;
+				work.done.notify_all();
+			}
+
+			// Hand work to a worker, which runs it in a heap of its own
+			std::shared_ptr<Work> Submit(Kinds kind, const SchemeMessage &proc, VectorType items) SCHEME_THROW {
+				std::shared_ptr<Work> work = std::make_shared<Work>();
+				work->kind = kind;
+				work->proc = proc;
+				work->items = SchemeMessage::Move(SchemeCell(std::move(items)), true);
+				SchemeExecutor::Shared().Submit([work] {
+					if (work->claimed.exchange(true))
+						return;
+					SchemeHeapSpace heap;
+					SchemeHeap::Use use(heap);
+					Run(*work);
+				});
+				return work;
+			}
+
+			// The value of work, in the current heap: run here if no worker has claimed it
+			SchemeCell Join(Work &work) SCHEME_THROW {
+				if (!work.claimed.exchange(true))
+					Run(work);
+				std::unique_lock<std::mutex> guard(work.lock);
+				work.done.wait(guard, [&work] { return work.finished; });
+				if (work.error)
+					std::rethrow_exception(work.error);
+				return work.value.Open();
+			}
+
+			// items split in parts: the first for this thread, one for each idle worker
+			size_t PartSize(size_t items) {
+				size_t parts = std::min(items, SchemeExecutor::Shared().Idle() + 1);
+				return parts <= 1 ? items : (items + parts - 1) / parts;
+			}
+
+			// Futures not yet touched
+			struct Futures {
+				std::mutex lock;
+				std::unordered_map<SchemeFuture::IdType, std::shared_ptr<Work>> started;
+				SchemeFuture::IdType next_id = 1;
+			};
+
+			Futures &GetFutures() {
+				static Futures futures;
+				return futures;
+			}
+
+			const VectorType &Items(const SchemeCell &list, SchemeCell &converted) SCHEME_THROW {
+				if (list.Type == LIST)
+					return list.ListValue;
+				if (list.Type != PAIR)
+					throw critical_error(CRIT_INVALID_COERCE, list);
+				converted = list.ToList();
+				return converted.ListValue;
+			}
+		}
+
+		SchemeFuture::IdType SchemeFuture::Start(const SchemeCell &proc, const VectorType &args) SCHEME_THROW {
+			std::shared_ptr<Work> work;
+			if (SchemeExecutor::Shared().Idle() > 0) {
+				work = Submit(APPLY, SchemeMessage::Copy(proc, true), args);
+			} else {
+				// Nobody to hand it to: evaluate it now, on the values themselves
+				work = std::make_shared<Work>();
+				work->claimed = true;
+				try {
+					work->value = SchemeMessage::Move(Compute(APPLY, proc, args));
+				} catch (...) {
+					work->error = std::current_exception();
+				}
+				work->finished = true;
+			}
+			Futures &futures = GetFutures();
+			std::lock_guard<std::mutex> guard(futures.lock);
+			IdType id = futures.next_id++;
+			futures.started.emplace(id, std::move(work));
+			return id;
+		}
+
+		SchemeCell SchemeFuture::Touch(IdType id) SCHEME_THROW {
+			std::shared_ptr<Work> work;
+			{
+				Futures &futures = GetFutures();
+				std::lock_guard<std::mutex> guard(futures.lock);
+				auto found = futures.started.find(id);
+				if (found == futures.started.end())
+					throw critical_error(CRIT_INVALID_INDEX, "future " + std::to_string(id) + " does not exist, or has been touched");
+				work = std::move(found->second);
+				futures.started.erase(found);
+			}
+			return Join(*work);
+		}
+
+		VectorType SchemeFuture::Map(const SchemeCell &proc, const VectorType &items) SCHEME_THROW {
+			size_t part = PartSize(items.size());
+			if (part >= items.size())
+				return Compute(MAP, proc, items).ListValue;
+			// The procedure is copied once, then handed out with each part
+			SchemeMessage shared_proc = SchemeMessage::Copy(proc, true);
+			std::vector<std::shared_ptr<Work>> parts;
+			for (size_t begin = part; begin < items.size(); begin += part) {
+				size_t end = std::min(begin + part, items.size());
+				parts.push_back(Submit(MAP, shared_proc, VectorType(items.cbegin() + begin, items.cbegin() + end)));
+			}
+			VectorType values = Compute(MAP, proc, VectorType(items.cbegin(), items.cbegin() + part)).ListValue;
+			SchemeHeap::Root values_root(values);
+			values.reserve(items.size());
+			for (auto it = parts.begin(); it != parts.end(); ++it) {
+				SchemeCell more = Join(**it);
+				values.insert(values.end(), std::make_move_iterator(more.ListValue.begin()), std::make_move_iterator(more.ListValue.end()));
+			}
+			return values;
+		}
+
+		SchemeCell SchemeFuture::Reduce(const SchemeCell &proc, const SchemeCell &init, const VectorType &items) SCHEME_THROW {
+			VectorType values{ init };
+			SchemeHeap::Root values_root(values);
+			size_t part = PartSize(items.size());
+			if (part >= items.size()) {
+				values.insert(values.end(), items.cbegin(), items.cend());
+				return Compute(REDUCE, proc, values);
+			}
+			SchemeMessage shared_proc = SchemeMessage::Copy(proc, true);
+			std::vector<std::shared_ptr<Work>> parts;
+			for (size_t begin = part; begin < items.size(); begin += part) {
+				size_t end = std::min(begin + part, items.size());
+				parts.push_back(Submit(REDUCE, shared_proc, VectorType(items.cbegin() + begin, items.cbegin() + end)));
+			}
+			// This thread folds init into the first part, then the value of each other part in order
+			values.insert(values.end(), items.cbegin(), items.cbegin() + part);
+			values = VectorType{ Compute(REDUCE, proc, values) };
+			for (auto it = parts.begin(); it != parts.end(); ++it)
+				values.push_back(Join(**it));
+			return Compute(REDUCE, proc, values);
+		}
+
+		SchemeCell SchemeFuture::proc_future(const VectorType &args) SCHEME_THROW {
+			runtime_assert(args.size() > 0);
+			return SchemeCell((IntegerType)Start(args[0], VectorType(args.cbegin() + 1, args.cend())));
+		}
+
+		SchemeCell SchemeFuture::proc_touch(const VectorType &args) SCHEME_THROW {
+			runtime_assert(args.size() > 0 && args[0].Type == INTEGER);
+			return Touch((IdType)args[0].IntegerValue);
+		}
+
+		SchemeCell SchemeFuture::proc_pmap(const VectorType &args) SCHEME_THROW {
+			runtime_assert(args.size() > 1);
+			SchemeCell converted;
+			return SchemeCell(Map(args[0], Items(args[1], converted)));
+		}
+
+		SchemeCell SchemeFuture::proc_preduce(const VectorType &args) SCHEME_THROW {
+			runtime_assert(args.size() > 2);
+			SchemeCell converted;
+			return Reduce(args[0], args[1], Items(args[2], converted));
+		}
+	}
+}
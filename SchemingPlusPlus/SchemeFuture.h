@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+#include "SchemeCell.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		// Procedure calls evaluated in parallel on the shared SchemeExecutor.
+		//
+		// Heaps are never shared between threads, so a call handed to a worker
+		// runs on a copy of the procedure, its arguments and all they reach (see
+		// SchemeMessage), in a heap of its own, and its value is copied back.
+		// Procedures should be pure: a set! of a captured variable changes only
+		// the copy. Work that no idle worker is free for runs inline on the
+		// calling thread instead, on the values themselves.
+		//
+		// The copy costs about as much as what the procedure's code names: its
+		// environments keep only the bindings it (or what they hold) refers to,
+		// not the rest of the globals (see SchemeImage::WriteValue). Map and
+		// Reduce image the procedure once and rebuild it once per part; a future
+		// does both once. A procedure that evals names built at runtime finds
+		// only the globals named somewhere in its code.
+		struct SchemeFuture {
+			typedef uint32_t IdType;
+
+			// Start evaluating (proc arg*): on an idle worker, or here and now if there is none
+			static IdType Start(const SchemeCell &proc, const VectorType &args) SCHEME_THROW;
+			// The value of a future, waiting for it if need be, or evaluating it
+			// here if no worker has begun it. A future is forgotten once touched.
+			static SchemeCell Touch(IdType id) SCHEME_THROW;
+			// (proc item) for every item, in order
+			static VectorType Map(const SchemeCell &proc, const VectorType &items) SCHEME_THROW;
+			// (proc ... (proc (proc init item0) item1) ... itemN). Parts of items are
+			// folded in parallel, then their values in order, so proc must be associative.
+			static SchemeCell Reduce(const SchemeCell &proc, const SchemeCell &init, const VectorType &items) SCHEME_THROW;
+
+			// Builtins, added to the globals by SchemeRuntime::AddGlobals
+			static SchemeCell proc_future(const VectorType &args) SCHEME_THROW;
+			static SchemeCell proc_touch(const VectorType &args) SCHEME_THROW;
+			static SchemeCell proc_pmap(const VectorType &args) SCHEME_THROW;
+			static SchemeCell proc_preduce(const VectorType &args) SCHEME_THROW;
+		};
+	}
+}
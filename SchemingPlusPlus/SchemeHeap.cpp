@@ -0,0 +1,314 @@
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <unordered_set>
+
+#include "SchemeAssert.h"
+#include "SchemeHeap.h"
+#include "SchemeStats.h"
+#include "SchemeTrace.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		namespace {
+			// Collect when this many environments exist, or twice as many as survived the last collection
+			const size_t MinThreshold = 4096;
+
+			// The process heap: function local, so it is built before any static that allocates
+			SchemeHeapSpace &ProcessSpace() {
+				static SchemeHeapSpace space;
+				return space;
+			}
+
+			// Set by SchemeHeap::Use; otherwise the process heap
+			thread_local SchemeHeapSpace *current = nullptr;
+
+			SchemeHeapSpace &State() {
+				return current != nullptr ? *current : ProcessSpace();
+			}
+
+			// Bytes a string holds beyond itself: none while it fits in the string
+			size_t HeapBytes(const std::string &text) {
+				const char *data = text.data(), *self = reinterpret_cast<const char*>(&text);
+				return (data >= self && data < self + sizeof text) ? 0 : text.capacity() + 1;
+			}
+
+			// Counts the cells reachable from one cell into a census
+			class CensusTaker {
+			public:
+				explicit CensusTaker(SchemeHeapCensus &census) : _census(census) { }
+
+				void Count(const SchemeCell &cell) {
+					SchemeHeapCensus::Cells &cells = _census.ByType[cell.Type];
+					++cells.Live;
+					cells.StringBytes += HeapBytes(cell.Value);
+					cells.ListBytes += cell.ListValue.capacity() * sizeof(SchemeCell);
+					for (auto it = cell.ListValue.cbegin(); it != cell.ListValue.cend(); ++it)
+						Count(*it);
+					if (cell.PairValue != nullptr)
+						Count(cell.PairValue);
+				}
+			private:
+				void Count(const PairType &pair) {
+					// Iterate along the list; only heads recurse
+					for (const SchemePair *rest = pair.get(); rest != nullptr && _pairs.insert(rest).second; ) {
+						++_census.Pairs;
+						Count(rest->Head);
+						const SchemeCell &tail = rest->Tail;
+						if (tail.Type != PAIR || tail.PairValue == nullptr) {
+							Count(tail);
+							break;
+						}
+						SchemeHeapCensus::Cells &cells = _census.ByType[PAIR];
+						++cells.Live;
+						cells.StringBytes += HeapBytes(tail.Value);
+						rest = tail.PairValue.get();
+					}
+				}
+
+				SchemeHeapCensus &_census;
+				std::unordered_set<const SchemePair*> _pairs;
+			};
+		}
+
+		std::string SchemeHeapCensus::ToString() const {
+			std::ostringstream text;
+			text << "Heap census" << (Tracking ? " (tracking)" : "") << std::endl;
+			text << "  environments " << Environments << " (peak " << PeakEnvironments << "), slots " << Slots
+				<< ", map entries " << MapEntries << " (largest " << LargestMap << "), bytes " << EnvironmentBytes << std::endl;
+			text << "  pairs " << Pairs << ", bytes " << Bytes << " (peak " << PeakBytes << ")" << std::endl;
+			for (size_t type = 0; type < CellTypes; ++type) {
+				const Cells &cells = ByType[type];
+				if (cells.PeakLive == 0 && cells.Allocated == 0)
+					continue;
+				text << "  " << CellTypeToString((CellType)type) << ": live " << cells.Live << " (peak " << cells.PeakLive << ")";
+				if (Tracking)
+					text << ", allocated " << cells.Allocated;
+				text << ", string bytes " << cells.StringBytes << ", list bytes " << cells.ListBytes << std::endl;
+			}
+			return text.str();
+		}
+
+		SchemeHeapSpace::SchemeHeapSpace() : _threshold(MinThreshold) {
+		}
+
+		SchemeHeapSpace::~SchemeHeapSpace() {
+			for (auto it = _objects.begin(); it != _objects.end(); ++it)
+				delete *it;
+		}
+
+		SchemeHeap::Use::Use(SchemeHeapSpace &space) : _previous(current) {
+			current = &space;
+		}
+
+		SchemeHeap::Use::~Use() {
+			current = _previous;
+		}
+
+		void SchemeHeap::PushRoot(const void *value, TraceType trace) {
+			State()._roots.push_back(SchemeHeapSpace::RootEntry{ value, trace });
+		}
+
+		void SchemeHeap::PopRoot() {
+			State()._roots.pop_back();
+		}
+
+		void SchemeMarker::Mark(const SchemeCell &cell) {
+			switch (cell.Type) {
+				case LIST:
+					Mark(cell.ListValue);
+					break;
+				case PAIR:
+					Mark(cell.PairValue);
+					break;
+				case LAMBDA: // Fall through
+				case MACRO:
+					Mark(cell.PairValue);
+					if (cell.Compiled != nullptr)
+						Mark(*cell.Compiled);
+					// Fall through
+				case ENVPTR:
+					Mark(cell.Environment);
+					break;
+				default:
+					break;
+			}
+		}
+
+		void SchemeMarker::Mark(const PairType &pair) {
+			// Iterate along the list; only heads recurse
+			const SchemePair *rest = pair.get();
+			while (rest != nullptr && rest->Mark != _epoch) {
+				rest->Mark = _epoch;
+				Mark(rest->Head);
+				if (rest->Tail.Type != PAIR) {
+					Mark(rest->Tail.ListValue);
+					break;
+				}
+				rest = rest->Tail.PairValue.get();
+			}
+		}
+
+		void SchemeMarker::Mark(const VectorType &cells) {
+			for (auto it = cells.cbegin(); it != cells.cend(); ++it)
+				Mark(*it);
+		}
+
+		void SchemeMarker::Mark(EnvironmentType env) {
+			if (env == nullptr || env->_mark == _epoch)
+				return;
+			env->_mark = _epoch;
+			_pending.push_back(env);
+		}
+
+		void SchemeMarker::Mark(const SchemeCompiled &compiled) {
+			if (compiled.Mark == _epoch)
+				return;
+			compiled.Mark = _epoch;
+			compiled.Trace(*this);
+		}
+
+		void SchemeMarker::Drain() {
+			while (!_pending.empty()) {
+				EnvironmentType env = _pending.back();
+				_pending.pop_back();
+				Mark(env->_slots);
+				for (auto it = env->_map.cbegin(); it != env->_map.cend(); ++it)
+					Mark(it->second);
+				Mark(env->_outer);
+			}
+		}
+
+		SchemeHeap::Root::Root(const SchemeCell &cell) {
+			PushRoot(&cell, [](const void *value, SchemeMarker &marker) {
+				marker.Mark(*static_cast<const SchemeCell*>(value));
+			});
+		}
+
+		SchemeHeap::Root::Root(const VectorType &cells) {
+			PushRoot(&cells, [](const void *value, SchemeMarker &marker) {
+				marker.Mark(*static_cast<const VectorType*>(value));
+			});
+		}
+
+		SchemeHeap::Root::Root(const EnvironmentType &env) {
+			PushRoot(&env, [](const void *value, SchemeMarker &marker) {
+				marker.Mark(*static_cast<const EnvironmentType*>(value));
+			});
+		}
+
+		SchemeHeap::Root::Root(const void *value, TraceType trace) {
+			PushRoot(value, trace);
+		}
+
+		SchemeHeap::Root::~Root() {
+			PopRoot();
+		}
+
+		void SchemeHeap::Collect() {
+			SchemeHeapSpace &state = State();
+			SchemeTrace::Span span("gc", "collect");
+			auto start = std::chrono::steady_clock::now();
+
+			// Objects carry the epoch of the last collection that reached them
+			if (++state._epoch == 0)
+				++state._epoch;
+			SchemeMarker marker(state._epoch);
+			for (auto it = state._roots.cbegin(); it != state._roots.cend(); ++it)
+				it->trace(it->value, marker);
+			marker.Drain();
+
+			auto live = std::partition(state._objects.begin(), state._objects.end(),
+				[&state](SchemeEnvironment *env) { return env->_mark == state._epoch; });
+			size_t freed = state._objects.end() - live;
+			for (auto it = live; it != state._objects.end(); ++it)
+				delete *it;
+			state._objects.erase(live, state._objects.end());
+			state._threshold = std::max(MinThreshold, state._objects.size() * 2);
+
+			double pause = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			SchemeHeapStats &stats = state._stats;
+			++stats.Collections;
+			stats.Freed += freed;
+			stats.LastFreed = freed;
+			stats.TotalPauseMs += pause;
+			stats.MaxPauseMs = std::max(stats.MaxPauseMs, pause);
+			span.Arg("freed", (int64_t)freed);
+			if (SchemeStats::TrackingCells())
+				Walk(state);
+		}
+
+		SchemeHeapStats SchemeHeap::Stats() {
+			SchemeHeapSpace &state = State();
+			SchemeHeapStats stats = state._stats;
+			stats.Live = state._objects.size();
+			return stats;
+		}
+
+		SchemeHeapCensus SchemeHeap::Census() {
+			Collect();
+			return Walk(State());
+		}
+
+		void SchemeHeap::Track(bool tracking) {
+			SchemeStats::TrackCells(tracking);
+		}
+
+		SchemeHeapCensus SchemeHeap::Walk(SchemeHeapSpace &state) {
+			SchemeHeapCensus census;
+			CensusTaker taker(census);
+			for (auto it = state._objects.cbegin(); it != state._objects.cend(); ++it) {
+				const SchemeEnvironment &env = **it;
+				++census.Environments;
+				census.Slots += env._slots.size();
+				census.MapEntries += env._map.size();
+				census.LargestMap = std::max(census.LargestMap, env._map.size());
+				// Map nodes as the common implementations lay them out: a next
+				// pointer and the cached hash before each entry
+				census.EnvironmentBytes += sizeof(SchemeEnvironment)
+					+ env._keys.capacity() * sizeof(AtomType)
+					+ env._slots.capacity() * sizeof(SchemeCell)
+					+ env._map.size() * (sizeof(SchemeEnvironment::MapType::value_type) + 2 * sizeof(void*))
+					+ env._map.bucket_count() * sizeof(void*);
+				for (auto slot = env._slots.cbegin(); slot != env._slots.cend(); ++slot)
+					taker.Count(*slot);
+				for (auto entry = env._map.cbegin(); entry != env._map.cend(); ++entry)
+					taker.Count(entry->second);
+			}
+			census.Bytes = census.EnvironmentBytes + census.Pairs * sizeof(SchemePair);
+			for (size_t type = 0; type < SchemeHeapCensus::CellTypes; ++type)
+				census.Bytes += census.ByType[type].StringBytes + census.ByType[type].ListBytes;
+			census.Tracking = SchemeStats::TrackingCells();
+			for (size_t type = 0; type < SchemeHeapCensus::CellTypes; ++type) {
+				SchemeHeapCensus::Cells &cells = census.ByType[type];
+				state._peak_cells[type] = std::max(state._peak_cells[type], cells.Live);
+				cells.PeakLive = state._peak_cells[type];
+				if (census.Tracking)
+					cells.Allocated = SchemeStats::CellsMade((CellType)type);
+			}
+			state._peak_bytes = std::max(state._peak_bytes, census.Bytes);
+			census.PeakBytes = state._peak_bytes;
+			census.PeakEnvironments = state._stats.PeakLive;
+			return census;
+		}
+
+		EnvironmentType SchemeHeap::Manage(SchemeEnvironment *env) {
+			SchemeHeapSpace &state = State();
+#ifdef SCHEME_GC_STRESS
+			const bool collect = true;
+#else
+			const bool collect = state._objects.size() >= state._threshold;
+#endif
+			if (collect) {
+				// Not yet in the heap, but what it holds must survive
+				Root env_root(env);
+				Collect();
+			}
+			state._objects.push_back(env);
+			++state._stats.Allocated;
+			state._stats.PeakLive = std::max(state._stats.PeakLive, state._objects.size());
+			SchemeStats::Environment();
+			return env;
+		}
+	}
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "SchemeCell.h"
+#include "SchemeEnvironment.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		struct SchemeHeapStats {
+			size_t Collections = 0;
+			size_t Allocated = 0;     // environments allocated, all time
+			size_t Freed = 0;         // environments freed, all time
+			size_t Live = 0;          // environments allocated and not yet freed
+			size_t LastFreed = 0;     // freed by the most recent collection
+			size_t PeakLive = 0;      // the most environments live at once
+			double TotalPauseMs = 0;
+			double MaxPauseMs = 0;
+		};
+
+		// What the environments of a heap hold, from SchemeHeap::Census. Cells are
+		// those bound in an environment, and those in the lists and closures they
+		// hold; a pair shared by several is counted once.
+		struct SchemeHeapCensus {
+			static const size_t CellTypes = ENVPTR + 1;
+			struct Cells {
+				size_t Live = 0;
+				size_t PeakLive = 0;     // the most Live found, by this census or an earlier one
+				// While tracking: cells made with a value of this type, on any thread,
+				// temporaries included. Copies are not counted.
+				uint64_t Allocated = 0;
+				size_t StringBytes = 0;  // held by Value strings beyond the cell
+				size_t ListBytes = 0;    // held by ListValue vectors beyond the cell
+			};
+			Cells ByType[CellTypes];
+			size_t Pairs = 0;            // list pairs, and the (params body) of closures
+			size_t Environments = 0;
+			size_t Slots = 0;            // parameters of lambda frames
+			size_t MapEntries = 0;       // defined names, the globals among them
+			size_t LargestMap = 0;
+			size_t EnvironmentBytes = 0; // an estimate of the frames and their bindings
+			size_t Bytes = 0;            // environments, pairs, strings and lists together
+			// High-water marks: environments live at once, and the most Bytes found.
+			// Censuses are taken after every collection while tracking, so the marks
+			// found by a census follow the heap between those asked for.
+			size_t PeakEnvironments = 0;
+			size_t PeakBytes = 0;
+			bool Tracking = false;
+
+			std::string ToString() const;
+		};
+
+		// Marks everything reachable from the values it is given. Used by the
+		// collector, and by root trace functions to mark what they hold.
+		class SchemeMarker {
+		public:
+			explicit SchemeMarker(uint32_t epoch) : _epoch(epoch) { }
+			void Mark(const SchemeCell &cell);
+			void Mark(const VectorType &cells);
+			void Mark(EnvironmentType env);
+			void Mark(const SchemeCompiled &compiled);
+			// A pair list, or the (params body) of a closure, held apart from any cell
+			void Mark(const PairType &pair);
+			// Trace the environments marked so far, and what they reach
+			void Drain();
+		private:
+			uint32_t _epoch;
+			std::vector<EnvironmentType> _pending;
+		};
+
+		// The environments, roots and statistics of one heap. The process has one,
+		// used by every thread that has not made another current (SchemeHeap::Use);
+		// each SchemeIsolate owns another. A space must only be used by one thread
+		// at a time, so nothing in it needs a lock.
+		class SchemeHeapSpace {
+			friend struct SchemeHeap;
+		public:
+			SchemeHeapSpace();
+			// Frees every environment still in the space
+			~SchemeHeapSpace();
+			SchemeHeapSpace(const SchemeHeapSpace &) = delete;
+			SchemeHeapSpace &operator = (const SchemeHeapSpace &) = delete;
+		private:
+			struct RootEntry {
+				const void *value;
+				void(*trace)(const void *value, SchemeMarker &marker);
+			};
+			std::vector<SchemeEnvironment*> _objects;
+			std::vector<RootEntry> _roots;
+			uint32_t _epoch = 0;
+			size_t _threshold;
+			SchemeHeapStats _stats;
+			size_t _peak_bytes = 0; // see SchemeHeapCensus
+			size_t _peak_cells[SchemeHeapCensus::CellTypes] = {};
+		};
+
+		// Owner of every SchemeEnvironment. Closures and the environments they
+		// capture refer to each other in cycles, so environments are reclaimed by
+		// mark and sweep rather than by reference counting.
+		//
+		// Each thread allocates from its current SchemeHeapSpace, and a collection
+		// only looks at the current space.
+		//
+		// The roots are whatever is registered with SchemeHeap::Root: the global
+		// environment of each REPL or test run, and the locals evaluators hold
+		// across a call. A collection may run on any allocation, so a value that
+		// is only held by a C++ local must be rooted before anything is evaluated
+		// or allocated.
+		struct SchemeHeap {
+			typedef void(*TraceType)(const void *value, SchemeMarker &marker);
+
+			// Registers a value as a root for as long as this object is in scope.
+			// Roots are released in reverse order, so only declare them as locals.
+			class Root {
+			public:
+				Root(const SchemeCell &cell);
+				Root(const VectorType &cells);
+				Root(const EnvironmentType &env);
+				// Any other value, marked by trace
+				Root(const void *value, TraceType trace);
+				~Root();
+				Root(const Root &) = delete;
+				Root &operator = (const Root &) = delete;
+			};
+
+			// Makes space the current heap of this thread for as long as this object
+			// is in scope. Everything allocated, rooted or collected meanwhile is in it.
+			class Use {
+			public:
+				explicit Use(SchemeHeapSpace &space);
+				~Use();
+				Use(const Use &) = delete;
+				Use &operator = (const Use &) = delete;
+			private:
+				SchemeHeapSpace *_previous;
+			};
+
+			// Allocate an environment, collecting first if the heap has grown enough
+			template<typename... Args>
+			static EnvironmentType New(Args&&... args) SCHEME_THROW {
+				return Manage(new SchemeEnvironment(std::forward<Args>(args)...));
+			}
+			static void Collect();
+			static SchemeHeapStats Stats();
+			// Collect, then count what the environments left hold
+			static SchemeHeapCensus Census();
+			// Allocation tracking: count the cells made by type (see SchemeStats),
+			// and take a census after every collection so the high-water marks
+			// follow the heap between the censuses asked for
+			static void Track(bool tracking);
+		private:
+			static SchemeHeapCensus Walk(SchemeHeapSpace &state);
+			static EnvironmentType Manage(SchemeEnvironment *env);
+			static void PushRoot(const void *value, TraceType trace);
+			static void PopRoot();
+		};
+	}
+}
@@ -0,0 +1,514 @@
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "SchemeAssert.h"
+#include "SchemeBinary.h"
+#include "SchemeHeap.h"
+#include "SchemeImage.h"
+#include "SchemeRuntime.h"
+#include "SchemeSymbols.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		namespace {
+			const std::string_view Magic("SIMAGE");
+
+			enum Tags : uint8_t {
+				TAG_SYMBOL, TAG_STRING, TAG_INTEGER, TAG_FLOAT, TAG_BIGINT, TAG_LIST,
+				TAG_PAIR, TAG_LAMBDA, TAG_MACRO, TAG_PROC, TAG_PROCENV, TAG_ENVPTR,
+				TAG_PROC_ADDRESS, TAG_PROCENV_ADDRESS // local images only
+			};
+			enum Objects : uint8_t { OBJECT_ENV, OBJECT_PAIR };
+
+			class ImageWriter {
+			public:
+				// Names of the builtin procedures
+				const std::unordered_map<const void*, std::string> &names;
+				SchemeBinaryWriter symbols, builtins, body;
+				std::unordered_map<AtomType, uint64_t> atoms;
+				std::unordered_map<std::string, uint64_t> procs;
+				std::unordered_map<const SchemeEnvironment*, uint64_t> envs;
+				std::unordered_map<const SchemePair*, uint64_t> pairs;
+				// Objects referred to but not yet written, in the order of their indices
+				std::deque<EnvironmentType> pending_envs;
+				std::deque<const SchemePair*> pending_pairs;
+
+				// Whether the image is only for this process, so may hold any procedure by address
+				bool local;
+				// The environment bindings written: by name, or all those of an
+				// environment in whole. All bindings if named is nullptr.
+				const std::unordered_set<AtomType> *named = nullptr;
+				const std::unordered_set<const SchemeEnvironment*> *whole = nullptr;
+
+				ImageWriter(const std::unordered_map<const void*, std::string> &names, bool local) : names(names), local(local) { }
+
+				bool Keeps(const SchemeEnvironment *env, AtomType atom) const {
+					return named == nullptr || named->count(atom) != 0 || whole->count(env) != 0;
+				}
+
+				void Atom(AtomType atom) {
+					auto found = atoms.find(atom);
+					if (found == atoms.end()) {
+						found = atoms.emplace(atom, atoms.size()).first;
+						symbols.Text(SchemeSymbols::Name(atom));
+					}
+					body.Varint(found->second);
+				}
+
+				uint64_t Index(EnvironmentType env) {
+					auto found = envs.find(env);
+					if (found == envs.end()) {
+						found = envs.emplace(env, envs.size()).first;
+						pending_envs.push_back(env);
+					}
+					return found->second;
+				}
+
+				// 0 for none, otherwise index + 1
+				void Env(EnvironmentType env) {
+					body.Varint(env == nullptr ? 0 : Index(env) + 1);
+				}
+
+				void Pair(const PairType &pair) {
+					auto found = pairs.find(pair.get());
+					if (found == pairs.end()) {
+						found = pairs.emplace(pair.get(), pairs.size()).first;
+						pending_pairs.push_back(pair.get());
+					}
+					body.Varint(found->second);
+				}
+
+				void Proc(uint8_t tag, uint8_t address_tag, const void *proc) SCHEME_THROW {
+					auto name = names.find(proc);
+					if (name == names.end()) {
+						if (!local)
+							throw critical_error(CRIT_TYPE_NOT_IMPL, std::string("image cannot hold a procedure that is not a global builtin"));
+						body.Byte(address_tag);
+						body.Varint((uint64_t)(uintptr_t)proc);
+						return;
+					}
+					body.Byte(tag);
+					auto found = procs.find(name->second);
+					if (found == procs.end()) {
+						found = procs.emplace(name->second, procs.size()).first;
+						builtins.Text(name->second);
+					}
+					body.Varint(found->second);
+				}
+
+				// Recurses only into LIST elements; environments and pairs are queued
+				void Cell(const SchemeCell &cell) SCHEME_THROW {
+					switch (cell.Type) {
+						case SYMBOL:
+							body.Byte(TAG_SYMBOL);
+							Atom(cell.AtomValue);
+							body.Varint(cell.LexicalDepth);
+							body.Varint(cell.LexicalSlot);
+							break;
+						case STRING:
+							body.Byte(TAG_STRING);
+							body.Text(cell.Value);
+							break;
+						case INTEGER:
+							body.Byte(TAG_INTEGER);
+							body.Signed(cell.IntegerValue);
+							break;
+						case FLOAT:
+							body.Byte(TAG_FLOAT);
+							body.Float(cell.FloatValue);
+							break;
+						case BIGINT:
+							body.Byte(TAG_BIGINT);
+							body.Text(cell.ToString());
+							break;
+						case LIST:
+							body.Byte(TAG_LIST);
+							body.Varint(cell.ListValue.size());
+							for (auto it = cell.ListValue.cbegin(); it != cell.ListValue.cend(); ++it)
+								Cell(*it);
+							break;
+						case PAIR:
+							body.Byte(TAG_PAIR);
+							Pair(cell.PairValue);
+							break;
+						case LAMBDA:
+						case MACRO:
+							body.Byte(cell.Type == LAMBDA ? TAG_LAMBDA : TAG_MACRO);
+							Pair(cell.PairValue);
+							Env(cell.Environment);
+							break;
+						case PROC:
+							Proc(TAG_PROC, TAG_PROC_ADDRESS, (const void*)cell.ProcValue);
+							break;
+						case PROCENV:
+							Proc(TAG_PROCENV, TAG_PROCENV_ADDRESS, (const void*)cell.ProcEnvValue);
+							break;
+						case ENVPTR:
+							body.Byte(TAG_ENVPTR);
+							Env(cell.Environment);
+							break;
+						default:
+							throw critical_error(CRIT_TYPE_NOT_IMPL, "image cannot hold " + CellTypeToString(cell.Type));
+					}
+				}
+			};
+
+			class ImageReader {
+			public:
+				SchemeBinaryReader &in;
+				VectorType symbols;
+				VectorType procs;
+				std::vector<EnvironmentType> &envs;
+				std::vector<PairType> pairs;
+
+				bool local;
+
+				ImageReader(SchemeBinaryReader &in, std::vector<EnvironmentType> &envs, bool local) : in(in), envs(envs), local(local) { }
+
+				const SchemeCell &Symbol() SCHEME_THROW { return symbols[Index(symbols.size())]; }
+
+				EnvironmentType Env() SCHEME_THROW {
+					uint64_t index = in.Varint();
+					if (index == 0)
+						return nullptr;
+					if (index > envs.size())
+						throw critical_error(CRIT_SYNTAX, std::string("image reference out of range"));
+					return envs[(size_t)index - 1];
+				}
+
+				size_t Index(size_t size) SCHEME_THROW {
+					uint64_t index = in.Varint();
+					if (index >= size)
+						throw critical_error(CRIT_SYNTAX, std::string("image reference out of range"));
+					return (size_t)index;
+				}
+
+				SchemeCell Cell() SCHEME_THROW {
+					uint8_t tag = in.Byte();
+					switch (tag) {
+						case TAG_SYMBOL: {
+							SchemeCell cell(Symbol());
+							cell.LexicalDepth = (uint16_t)in.Varint();
+							cell.LexicalSlot = (uint16_t)in.Varint();
+							return cell;
+						}
+						case TAG_STRING:
+							return SchemeCell(std::string(in.Text()), STRING);
+						case TAG_INTEGER:
+							return SchemeCell((IntegerType)in.Signed());
+						case TAG_FLOAT:
+							return SchemeCell(in.Float());
+						case TAG_BIGINT:
+							return SchemeCell(std::string(in.Text()), BIGINT);
+						case TAG_LIST: {
+							VectorType elements;
+							elements.reserve((size_t)in.Count());
+							for (size_t i = elements.capacity(); i > 0; --i)
+								elements.push_back(Cell());
+							return SchemeCell(std::move(elements));
+						}
+						case TAG_PAIR: {
+							SchemeCell cell(PAIR);
+							cell.PairValue = pairs[Index(pairs.size())];
+							return cell;
+						}
+						case TAG_LAMBDA:
+						case TAG_MACRO: {
+							SchemeCell cell(tag == TAG_LAMBDA ? LAMBDA : MACRO);
+							cell.PairValue = pairs[Index(pairs.size())];
+							cell.Environment = Env();
+							return cell;
+						}
+						case TAG_PROC:
+						case TAG_PROCENV: {
+							const SchemeCell &proc = procs[Index(procs.size())];
+							if (proc.Type != (tag == TAG_PROC ? PROC : PROCENV))
+								throw critical_error(CRIT_SYNTAX, std::string("image builtin has changed"));
+							return proc;
+						}
+						case TAG_PROC_ADDRESS:
+						case TAG_PROCENV_ADDRESS: {
+							if (!local)
+								throw critical_error(CRIT_SYNTAX, std::string("image holds a procedure of another process"));
+							uintptr_t address = (uintptr_t)in.Varint();
+							if (tag == TAG_PROC_ADDRESS)
+								return SchemeCell(reinterpret_cast<ProcType>(address));
+							return SchemeCell(reinterpret_cast<ProcEnvType>(address));
+						}
+						case TAG_ENVPTR:
+							return SchemeCell(Env());
+						default:
+							throw critical_error(CRIT_SYNTAX, std::string("image tag unknown"));
+					}
+				}
+			};
+		}
+
+		struct SchemeImage::Builtins {
+			std::unordered_map<const void*, std::string> names;
+			std::unordered_map<std::string, SchemeCell> procs;
+		};
+
+		const SchemeImage::Builtins &SchemeImage::GetBuiltins() {
+			static const Builtins builtins = [] {
+				Builtins result;
+				SchemeEnvironment globals;
+				SchemeRuntime::AddGlobals(&globals);
+				for (auto it = globals._map.cbegin(); it != globals._map.cend(); ++it) {
+					const SchemeCell &proc = it->second;
+					const std::string &name = SchemeSymbols::Name(it->first);
+					if (proc.Type == PROC)
+						result.names.emplace((const void*)proc.ProcValue, name);
+					else if (proc.Type == PROCENV)
+						result.names.emplace((const void*)proc.ProcEnvValue, name);
+					else
+						continue;
+					result.procs.emplace(name, proc);
+				}
+				return result;
+			}();
+			return builtins;
+		}
+
+		// The bindings a value may use, for an image of only those. The code of
+		// the closures it reaches names bindings, which may hold more closures,
+		// and so on until no more names are found. Environments reached as
+		// values (ENVPTR) are kept whole, with the environments outside them.
+		struct SchemeImage::NamedBindings {
+			std::unordered_set<AtomType> atoms;
+			// Environments written with all their bindings
+			std::unordered_set<const SchemeEnvironment*> whole;
+
+			explicit NamedBindings(const SchemeCell &root) {
+				pending.push_back(&root);
+				while (!pending.empty()) {
+					const SchemeCell &cell = *pending.back();
+					pending.pop_back();
+					Cell(cell);
+				}
+			}
+
+		private:
+			std::unordered_set<const SchemeEnvironment*> envs;
+			std::vector<EnvironmentType> seen;
+			std::unordered_set<const SchemePair*> pairs;
+			// Cells to scan: bindings and slots never move while the scan runs
+			std::vector<const SchemeCell*> pending;
+
+			void Cell(const SchemeCell &cell) {
+				switch (cell.Type) {
+					case SYMBOL:
+						// Newly named: its bindings in the environments already seen are used
+						if (atoms.insert(cell.AtomValue).second) {
+							for (auto it = seen.cbegin(); it != seen.cend(); ++it) {
+								auto found = (*it)->_map.find(cell.AtomValue);
+								if (found != (*it)->_map.end())
+									pending.push_back(&found->second);
+							}
+						}
+						break;
+					case LIST:
+						for (auto it = cell.ListValue.cbegin(); it != cell.ListValue.cend(); ++it)
+							pending.push_back(&*it);
+						break;
+					case PAIR:
+						Pair(cell.PairValue.get());
+						break;
+					case LAMBDA:
+					case MACRO:
+						Pair(cell.PairValue.get());
+						Env(cell.Environment, false);
+						break;
+					case ENVPTR:
+						Env(cell.Environment, true);
+						break;
+					default:
+						break;
+				}
+			}
+
+			void Pair(const SchemePair *pair) {
+				if (pair != nullptr && pairs.insert(pair).second) {
+					pending.push_back(&pair->Head);
+					pending.push_back(&pair->Tail);
+				}
+			}
+
+			void Env(EnvironmentType env, bool all) {
+				for (; env != nullptr; env = env->_outer) {
+					bool first = envs.insert(env).second;
+					if (all) {
+						if (!whole.insert(env).second)
+							return;
+						for (auto it = env->_map.cbegin(); it != env->_map.cend(); ++it)
+							pending.push_back(&it->second);
+					} else if (!first) {
+						return;
+					} else {
+						for (auto it = atoms.cbegin(); it != atoms.cend(); ++it) {
+							auto found = env->_map.find(*it);
+							if (found != env->_map.end())
+								pending.push_back(&found->second);
+						}
+					}
+					if (first) {
+						// Lambda frames are kept whole: SchemeLexical addresses their slots
+						seen.push_back(env);
+						for (auto it = env->_slots.cbegin(); it != env->_slots.cend(); ++it)
+							pending.push_back(&*it);
+					}
+				}
+			}
+		};
+
+		std::string SchemeImage::Write(EnvironmentType env) SCHEME_THROW {
+			runtime_assert(env != nullptr);
+			return WriteValue(SchemeCell(env));
+		}
+
+		EnvironmentType SchemeImage::Read(std::string_view data) SCHEME_THROW {
+			SchemeCell root = ReadValue(data);
+			if (root.Type != ENVPTR || root.Environment == nullptr)
+				throw critical_error(CRIT_SYNTAX, std::string("image has no environment"));
+			return root.Environment;
+		}
+
+		std::string SchemeImage::WriteValue(const SchemeCell &value, bool local, bool named_only) SCHEME_THROW {
+			ImageWriter writer(GetBuiltins().names, local);
+			std::unique_ptr<NamedBindings> bindings;
+			if (named_only) {
+				bindings = std::make_unique<NamedBindings>(value);
+				writer.named = &bindings->atoms;
+				writer.whole = &bindings->whole;
+			}
+			// The root comes first; what it refers to follows as objects
+			writer.Cell(value);
+			SchemeBinaryWriter root;
+			std::swap(root.Data, writer.body.Data);
+			// Objects reached while writing others are queued, so nothing here
+			// recurses through environments or along lists of pairs
+			while (!writer.pending_envs.empty() || !writer.pending_pairs.empty()) {
+				if (!writer.pending_envs.empty()) {
+					EnvironmentType next = writer.pending_envs.front();
+					writer.pending_envs.pop_front();
+					writer.body.Byte(OBJECT_ENV);
+					writer.Env(next->_outer);
+					writer.body.Varint(next->_keys.size());
+					for (size_t i = 0; i < next->_keys.size(); ++i) {
+						writer.Atom(next->_keys[i]);
+						writer.Cell(next->_slots[i]);
+					}
+					writer.body.Varint((uint64_t)std::count_if(next->_map.cbegin(), next->_map.cend(),
+						[&writer, next](const SchemeEnvironment::MapType::value_type &binding) { return writer.Keeps(next, binding.first); }));
+					for (auto it = next->_map.cbegin(); it != next->_map.cend(); ++it) {
+						if (!writer.Keeps(next, it->first))
+							continue;
+						writer.Atom(it->first);
+						writer.Cell(it->second);
+					}
+				} else {
+					const SchemePair *next = writer.pending_pairs.front();
+					writer.pending_pairs.pop_front();
+					writer.body.Byte(OBJECT_PAIR);
+					writer.Cell(next->Head);
+					writer.Cell(next->Tail);
+				}
+			}
+
+			SchemeBinaryWriter out;
+			out.Data = Magic;
+			out.Byte(Version);
+			out.Varint(writer.atoms.size());
+			out.Data += writer.symbols.Data;
+			out.Varint(writer.procs.size());
+			out.Data += writer.builtins.Data;
+			out.Varint(writer.envs.size());
+			out.Varint(writer.pairs.size());
+			out.Data += root.Data;
+			out.Data += writer.body.Data;
+			return out.Data;
+		}
+
+		SchemeCell SchemeImage::ReadValue(std::string_view data, bool local) SCHEME_THROW {
+			SchemeBinaryReader in(data);
+			if (in.Bytes(Magic.size()) != Magic || in.Byte() != Version)
+				throw critical_error(CRIT_SYNTAX, std::string("not an image file, or another version"));
+
+			// Restored environments are roots until the caller has the root value
+			std::vector<EnvironmentType> envs;
+			SchemeHeap::Root envs_root(&envs, [](const void *value, SchemeMarker &marker) {
+				const std::vector<EnvironmentType> &envs = *static_cast<const std::vector<EnvironmentType>*>(value);
+				for (auto it = envs.cbegin(); it != envs.cend(); ++it)
+					marker.Mark(*it);
+			});
+			ImageReader reader(in, envs, local);
+
+			reader.symbols.reserve((size_t)in.Count());
+			for (size_t i = reader.symbols.capacity(); i > 0; --i)
+				reader.symbols.emplace_back(std::string(in.Text()), SYMBOL);
+			reader.procs.reserve((size_t)in.Count());
+			const Builtins &known = GetBuiltins();
+			for (size_t i = reader.procs.capacity(); i > 0; --i) {
+				auto found = known.procs.find(std::string(in.Text()));
+				if (found == known.procs.end())
+					throw critical_error(CRIT_SYNTAX, std::string("image builtin does not exist"));
+				reader.procs.push_back(found->second);
+			}
+
+			// Every object exists before any is read, so references may point forward
+			uint64_t env_count = in.Count(), pair_count = in.Count();
+			envs.reserve((size_t)env_count);
+			for (uint64_t i = 0; i < env_count; ++i)
+				envs.push_back(SchemeHeap::New());
+			reader.pairs.reserve((size_t)pair_count);
+			for (uint64_t i = 0; i < pair_count; ++i)
+				reader.pairs.push_back(std::make_shared<SchemePair>(SchemeConstants::Nil, SchemeConstants::Nil));
+			SchemeCell root = reader.Cell();
+
+			size_t next_env = 0, next_pair = 0;
+			while (next_env < envs.size() || next_pair < reader.pairs.size()) {
+				if (in.Byte() == OBJECT_ENV) {
+					if (next_env == envs.size())
+						throw critical_error(CRIT_SYNTAX, std::string("image has too many objects"));
+					SchemeEnvironment &env = *envs[next_env++];
+					env._outer = reader.Env();
+					size_t slots = (size_t)in.Count();
+					env._keys.reserve(slots);
+					env._slots.reserve(slots);
+					for (size_t i = 0; i < slots; ++i) {
+						env._keys.push_back(reader.Symbol().AtomValue);
+						env._slots.push_back(reader.Cell());
+					}
+					for (uint64_t i = in.Count(); i > 0; --i) {
+						AtomType key = reader.Symbol().AtomValue;
+						env._map[key] = reader.Cell();
+					}
+				} else {
+					if (next_pair == reader.pairs.size())
+						throw critical_error(CRIT_SYNTAX, std::string("image has too many objects"));
+					SchemePair &pair = *reader.pairs[next_pair++];
+					pair.Head = reader.Cell();
+					pair.Tail = reader.Cell();
+				}
+			}
+			if (!in.AtEnd())
+				throw critical_error(CRIT_SYNTAX, std::string("image data has trailing bytes"));
+			return root;
+		}
+
+		void SchemeImage::Save(const std::string &path, EnvironmentType env) SCHEME_THROW {
+			if (!WriteFileAtomic(path, Write(env)))
+				throw critical_error(CRIT_INVALID_PROC, path + ": cannot write image");
+		}
+
+		EnvironmentType SchemeImage::Load(const std::string &path) SCHEME_THROW {
+			SchemeMappedFile data(path);
+			if (data.Data().empty())
+				throw critical_error(CRIT_INVALID_PROC, path + ": cannot read image");
+			return Read(data.Data());
+		}
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "SchemeCell.h"
+#include "SchemeEnvironment.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		// A heap image: an environment and everything reachable from it (outer
+		// environments, closures and the environments they capture, lists), saved
+		// so that a later process can restore it rather than evaluate again the
+		// definitions that built it.
+		//
+		// Objects refer to each other by index into the image's tables, relocated
+		// to the new objects as the image is read. Sharing and cycles survive:
+		// each environment and pair is restored once, however often it is referred to.
+		// Builtin procedures are saved by the name SchemeRuntime::AddGlobals gives
+		// them, symbols by name. Compiled closure bodies are not saved; evaluators
+		// compile them again when first called.
+		//
+		// Any value may be the root of an image, which is how SchemeMessage copies
+		// closures and lists from one heap to another.
+		struct SchemeImage {
+			static const uint8_t Version = 2;
+
+			static std::string Write(EnvironmentType env) SCHEME_THROW;
+			// The restored environment is not yet a root: root it before anything is allocated.
+			static EnvironmentType Read(std::string_view data) SCHEME_THROW;
+			// A local image is read back only by this process, so may hold any
+			// procedure (such as one the REPL adds) by its address. With named_only,
+			// the environments closures capture keep only the bindings named by the
+			// code reached, not every global: enough to call them, unless a name is
+			// built as they run, as for eval.
+			static std::string WriteValue(const SchemeCell &value, bool local = false, bool named_only = false) SCHEME_THROW;
+			// Restored in the current heap, and likewise not yet a root
+			static SchemeCell ReadValue(std::string_view data, bool local = false) SCHEME_THROW;
+
+			static void Save(const std::string &path, EnvironmentType env) SCHEME_THROW;
+			// Read an image from a memory mapped file
+			static EnvironmentType Load(const std::string &path) SCHEME_THROW;
+
+		private:
+			// Builtin procedures by name, as AddGlobals defines them
+			struct Builtins;
+			static const Builtins &GetBuiltins();
+			// The bindings a value may use, for WriteValue with named_only
+			struct NamedBindings;
+		};
+	}
+}
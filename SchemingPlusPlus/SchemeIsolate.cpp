@@ -0,0 +1,30 @@
+#include "SchemeIsolate.h"
+#include "SchemeRuntime.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		SchemeIsolate::SchemeIsolate() {
+			Scope scope(*this);
+			// The isolate's first root, so the last released
+			_globals_root = std::make_unique<SchemeHeap::Root>(_globals);
+			_globals = SchemeHeap::New();
+			SchemeRuntime::AddGlobals(_globals);
+		}
+
+		SchemeIsolate::~SchemeIsolate() {
+			// Release the root in the heap it was made in; the heap then frees everything
+			Scope scope(*this);
+			_globals_root.reset();
+		}
+
+		SchemeCell SchemeIsolate::Eval(const SchemeCell &x, SchemeEvaluator &evaluator) THROW(critical_error) {
+			Scope scope(*this);
+			return evaluator.Eval(x, SchemeCell(_globals));
+		}
+
+		SchemeHeapStats SchemeIsolate::Stats() {
+			Scope scope(*this);
+			return SchemeHeap::Stats();
+		}
+	}
+}
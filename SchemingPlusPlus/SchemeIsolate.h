@@ -0,0 +1,41 @@
+#pragma once
+
+#include <memory>
+
+#include "SchemeCell.h"
+#include "SchemeEnvironment.h"
+#include "SchemeEval.h"
+#include "SchemeHeap.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		// An interpreter of its own: a heap, and a global environment in it with
+		// the builtins. Isolates share nothing but the symbol table and constants,
+		// so different isolates run on different threads without locks. One isolate
+		// must only be used by one thread at a time; it may move between threads
+		// (see SchemeExecutor), as long as the moves are synchronised.
+		class SchemeIsolate {
+		public:
+			SchemeIsolate();
+			~SchemeIsolate();
+			SchemeIsolate(const SchemeIsolate &) = delete;
+			SchemeIsolate &operator = (const SchemeIsolate &) = delete;
+
+			// Makes the isolate's heap current on this thread while in scope.
+			// Needed around anything that allocates in the isolate or holds its values.
+			class Scope : public SchemeHeap::Use {
+			public:
+				explicit Scope(SchemeIsolate &isolate) : SchemeHeap::Use(isolate._heap) { }
+			};
+
+			EnvironmentType Globals() const { return _globals; }
+			// Evaluate x in the global environment, with the heap current meanwhile
+			SchemeCell Eval(const SchemeCell &x, SchemeEvaluator &evaluator) THROW(critical_error);
+			SchemeHeapStats Stats();
+		private:
+			SchemeHeapSpace _heap;
+			EnvironmentType _globals = nullptr;
+			std::unique_ptr<SchemeHeap::Root> _globals_root;
+		};
+	}
+}
@@ -0,0 +1,95 @@
+#include <vector>
+
+#include "SchemeCell.h"
+#include "SchemeLexical.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		namespace {
+			// Parameter atoms of each enclosing lambda, innermost last
+			typedef std::vector<std::vector<AtomType>> ScopeStack;
+
+			AtomType ParamAtom(const SchemeCell &param) {
+				if (param.Type == SYMBOL) return param.AtomValue;
+				if (param.Type == STRING) return SchemeSymbols::Intern(param.Value);
+				return ATOM_NONE;
+			}
+
+			// Must lay out slots the same way as the lambda frame constructor in SchemeEnvironment
+			std::vector<AtomType> ParamAtoms(const SchemeCell &params) {
+				std::vector<AtomType> atoms;
+				if (params.Type == LIST) {
+					atoms.reserve(params.ListValue.size());
+					for (auto it = params.ListValue.cbegin(); it != params.ListValue.cend(); ++it)
+						atoms.push_back(ParamAtom(*it));
+				} else {
+					// Single symbol capturing all arguments
+					atoms.push_back(ParamAtom(params));
+				}
+				return atoms;
+			}
+
+			void ResolveSymbol(SchemeCell &symbol, const ScopeStack &scopes) {
+				symbol.LexicalDepth = 0;
+				symbol.LexicalSlot = 0;
+				for (size_t depth = 0; depth < scopes.size() && depth < SchemeLexical::MaxDepth; ++depth) {
+					const std::vector<AtomType> &keys = scopes[scopes.size() - 1 - depth];
+					for (size_t slot = 0; slot < keys.size(); ++slot) {
+						if (keys[slot] == symbol.AtomValue) {
+							if (slot <= SchemeLexical::MaxSlot) {
+								symbol.LexicalDepth = (uint16_t)(depth + 1);
+								symbol.LexicalSlot = (uint16_t)slot;
+							}
+							return;
+						}
+					}
+				}
+			}
+
+			void ResolveIn(SchemeCell &expr, ScopeStack &scopes) {
+				// Code built by cons (e.g. a macro expansion): evaluators index forms as vectors
+				if (expr.Type == PAIR)
+					expr = expr.ToList();
+				if (expr.Type == SYMBOL) {
+					ResolveSymbol(expr, scopes);
+					return;
+				}
+				if (expr.Type != LIST || expr.ListValue.empty())
+					return;
+
+				VectorType &list = expr.ListValue;
+				size_t first = 0;
+				if (list[0].Type == SYMBOL) {
+					switch (list[0].AtomValue) {
+						case ATOM_QUOTE:
+							return;
+						case ATOM_LAMBDA: // Fall through
+						case ATOM_MACRO: {
+							if (list.size() < 2) return;
+							if (list[1].Type == PAIR)
+								list[1] = list[1].ToList();
+							scopes.push_back(ParamAtoms(list[1]));
+							for (size_t i = 2; i < list.size(); ++i)
+								ResolveIn(list[i], scopes);
+							scopes.pop_back();
+							return;
+						}
+						case ATOM_IF: // Fall through
+						case ATOM_SET: // Fall through
+						case ATOM_DEFINE: // Fall through
+						case ATOM_BEGIN:
+							first = 1;
+							break;
+					}
+				}
+				for (size_t i = first; i < list.size(); ++i)
+					ResolveIn(list[i], scopes);
+			}
+		}
+
+		void SchemeLexical::Resolve(SchemeCell &expr) {
+			ScopeStack scopes;
+			ResolveIn(expr, scopes);
+		}
+	}
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "Scheme.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		// Lexical addressing pass, run over an expression before it is evaluated.
+		//
+		// Every symbol bound by an enclosing lambda or macro parameter list is
+		// annotated with the number of frames outward and the slot index of
+		// that parameter, so evaluation can index the flat argument array of a
+		// lambda frame instead of searching by name. Other symbols are left
+		// unresolved and are looked up by name as before.
+		//
+		// Annotations are verified when used (see SchemeEnvironment::LookupLexical),
+		// so code assembled at runtime, such as macro expansions containing
+		// fragments resolved in another scope, still finds the right binding.
+		struct SchemeLexical {
+			static const size_t MaxDepth = 0xFFFE;
+			static const size_t MaxSlot = 0xFFFF;
+
+			// Annotate expr in place, treating its outermost scope as unknown.
+			// PAIR lists in code are converted to LIST; quoted data is left as is.
+			static void Resolve(SchemeCell &expr);
+		};
+	}
+}
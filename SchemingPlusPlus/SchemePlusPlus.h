@@ -9,10 +9,27 @@
 #include "Scheme.h"
 #include "SchemeCell.h"
 #include "SchemeEnvironment.h"
+#include "SchemeHeap.h"
 #include "SchemeParser.h"
+#include "SchemeReader.h"
+#include "SchemeFasl.h"
+#include "SchemeImage.h"
 #include "SchemeAssert.h"
 #include "SchemeRuntime.h"
 #include "SchemeEvalSimple.h"
+#include "SchemeEvalAnalyze.h"
+#include "SchemeEvalVM.h"
+#include "SchemeEvalFrame.h"
+#include "SchemeTaskMachine.h"
+#include "SchemeExecutor.h"
+#include "SchemeIsolate.h"
+#include "SchemeProcess.h"
+#include "SchemeFuture.h"
+#include "SchemeEventLoop.h"
+#include "SchemePorts.h"
+#include "SchemeProfiler.h"
+#include "SchemeStats.h"
+#include "SchemeTrace.h"
 
 
 namespace SchemingPlusPlus {
@@ -0,0 +1,221 @@
+#include <cerrno>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "SchemeAssert.h"
+#include "SchemeEvalFrame.h"
+#include "SchemeEventLoop.h"
+#include "SchemePorts.h"
+#include "SchemeProcess.h"
+
+#ifndef COMPILER_MSC
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		namespace {
+			struct Port {
+				int fd;
+				int child = -1;      // the command writing to a pipe, if any
+				std::mutex lock;
+				std::string buffer;  // read, and not yet taken
+				bool end = false;    // nothing more to read
+			};
+
+			struct Ports {
+				std::mutex lock;
+				std::unordered_map<int, std::shared_ptr<Port>> open;
+			};
+
+			Ports &GetPorts() {
+				static Ports ports;
+				return ports;
+			}
+
+			SchemeCell Add(int fd, int child) {
+				std::shared_ptr<Port> port = std::make_shared<Port>();
+				port->fd = fd;
+				port->child = child;
+				Ports &ports = GetPorts();
+				std::lock_guard<std::mutex> guard(ports.lock);
+				ports.open[fd] = std::move(port);
+				return SchemeCell((IntegerType)fd);
+			}
+
+			// The port args name, standard input if none
+			std::shared_ptr<Port> Find(const VectorType &args) SCHEME_THROW {
+				int fd = 0;
+				if (!args.empty()) {
+					runtime_assert(args[0].Type == INTEGER);
+					fd = (int)args[0].IntegerValue;
+				}
+				Ports &ports = GetPorts();
+				std::lock_guard<std::mutex> guard(ports.lock);
+				auto found = ports.open.find(fd);
+				if (found != ports.open.end())
+					return found->second;
+				if (fd != 0)
+					throw critical_error(CRIT_INVALID_INDEX, "port " + std::to_string(fd) + " is not open");
+				std::shared_ptr<Port> input = std::make_shared<Port>();
+				input->fd = 0;
+				ports.open[0] = input;
+				return input;
+			}
+
+			// Read more of port into its buffer. False if the running process has to
+			// wait for input: it is woken once there is some, and should call Block
+			// for BLOCK_EVENT.
+			bool Fill(Port &port) SCHEME_THROW {
+#ifdef COMPILER_MSC
+				throw critical_error(CRIT_TYPE_NOT_IMPL, std::string("ports are not implemented on this platform"));
+#else
+				SchemeProcess::IdType waiter = SchemeProcess::Running();
+				if (waiter != 0 && SchemeEventLoop::Supported()) {
+					pollfd ready{ port.fd, POLLIN, 0 };
+					if (poll(&ready, 1, 0) == 0) {
+						SchemeEventLoop::Instance().WaitReadable(port.fd, waiter);
+						return false;
+					}
+				}
+				char chunk[4096];
+				ssize_t got;
+				do
+					got = read(port.fd, chunk, sizeof chunk);
+				while (got < 0 && errno == EINTR);
+				if (got <= 0)
+					port.end = true;
+				else
+					port.buffer.append(chunk, (size_t)got);
+				return true;
+#endif
+			}
+		}
+
+		SchemeCell SchemePorts::proc_open_input_file(const VectorType &args) SCHEME_THROW {
+			runtime_assert(args.size() > 0);
+#ifdef COMPILER_MSC
+			throw critical_error(CRIT_TYPE_NOT_IMPL, std::string("ports are not implemented on this platform"));
+#else
+			int fd = open(args[0].Value.c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				throw critical_error(CRIT_INVALID_PROC, args[0].Value + ": cannot open");
+			return Add(fd, -1);
+#endif
+		}
+
+		SchemeCell SchemePorts::proc_open_input_pipe(const VectorType &args) SCHEME_THROW {
+			runtime_assert(args.size() > 0);
+#ifdef COMPILER_MSC
+			throw critical_error(CRIT_TYPE_NOT_IMPL, std::string("ports are not implemented on this platform"));
+#else
+			// The command's standard output is the write end; the read end is the port
+			int ends[2];
+			if (pipe(ends) != 0)
+				throw critical_error(CRIT_INVALID_PROC, args[0].Value + ": cannot make a pipe");
+			fcntl(ends[0], F_SETFD, FD_CLOEXEC);
+			fcntl(ends[1], F_SETFD, FD_CLOEXEC);
+			posix_spawn_file_actions_t actions;
+			posix_spawn_file_actions_init(&actions);
+			posix_spawn_file_actions_adddup2(&actions, ends[1], 1);
+			std::string command = args[0].Value;
+			char shell[] = "sh", option[] = "-c";
+			char *argv[] = { shell, option, &command[0], nullptr };
+			pid_t child;
+			int failed = posix_spawn(&child, "/bin/sh", &actions, nullptr, argv, environ);
+			posix_spawn_file_actions_destroy(&actions);
+			close(ends[1]);
+			if (failed != 0) {
+				close(ends[0]);
+				throw critical_error(CRIT_INVALID_PROC, args[0].Value + ": cannot run");
+			}
+			return Add(ends[0], (int)child);
+#endif
+		}
+
+		SchemeCell SchemePorts::proc_read_line(const VectorType &args) SCHEME_THROW {
+			std::shared_ptr<Port> port = Find(args);
+			std::lock_guard<std::mutex> guard(port->lock);
+			for (size_t scanned = 0;;) {
+				size_t end = port->buffer.find('\n', scanned);
+				if (end != std::string::npos) {
+					SchemeCell line(port->buffer.substr(0, end), STRING);
+					port->buffer.erase(0, end + 1);
+					return line;
+				}
+				scanned = port->buffer.size();
+				if (port->end) {
+					if (port->buffer.empty())
+						return SchemeConstants::Nil;
+					SchemeCell line(port->buffer, STRING);
+					port->buffer.clear();
+					return line;
+				}
+				if (!Fill(*port)) {
+					SchemeFrameState::Block(SchemeFrameState::BLOCK_EVENT);
+					return SchemeConstants::Nil;
+				}
+			}
+		}
+
+		SchemeCell SchemePorts::proc_read_all(const VectorType &args) SCHEME_THROW {
+			std::shared_ptr<Port> port = Find(args);
+			std::lock_guard<std::mutex> guard(port->lock);
+			// What has been read stays in the buffer while the process waits for more
+			while (!port->end) {
+				if (!Fill(*port)) {
+					SchemeFrameState::Block(SchemeFrameState::BLOCK_EVENT);
+					return SchemeConstants::Nil;
+				}
+			}
+			SchemeCell rest(port->buffer, STRING);
+			port->buffer.clear();
+			return rest;
+		}
+
+		SchemeCell SchemePorts::proc_close_port(const VectorType &args) SCHEME_THROW {
+			runtime_assert(args.size() > 0);
+			std::shared_ptr<Port> port = Find(args);
+			{
+				Ports &ports = GetPorts();
+				std::lock_guard<std::mutex> guard(ports.lock);
+				ports.open.erase(port->fd);
+			}
+#ifdef COMPILER_MSC
+			return SchemeConstants::Nil;
+#else
+			SchemeEventLoop::Forget(port->fd);
+			close(port->fd);
+			if (port->child < 0)
+				return SchemeConstants::Nil;
+			// The exit status of a command
+			int status = 0;
+			while (waitpid((pid_t)port->child, &status, 0) < 0 && errno == EINTR)
+				;
+			return SchemeCell((IntegerType)(WIFEXITED(status) ? WEXITSTATUS(status) : -1));
+#endif
+		}
+
+		SchemeCell SchemePorts::proc_sleep(const VectorType &args) SCHEME_THROW {
+			runtime_assert(args.size() > 0);
+			std::chrono::milliseconds duration(args[0].ToInteger());
+			SchemeProcess::IdType waiter = SchemeProcess::Running();
+			if (waiter != 0 && SchemeEventLoop::Supported()) {
+				if (!SchemeEventLoop::Instance().SleepUntil(SchemeEventLoop::ClockType::now() + duration, waiter))
+					SchemeFrameState::Block(SchemeFrameState::BLOCK_EVENT);
+				return SchemeConstants::Nil;
+			}
+			std::this_thread::sleep_for(duration);
+			return SchemeConstants::Nil;
+		}
+	}
+}
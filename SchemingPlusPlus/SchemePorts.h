@@ -0,0 +1,27 @@
+#pragma once
+
+#include "SchemeCell.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		// Input ports: files, and the output of commands, read a line or all at a
+		// time. A port is named by its file descriptor; 0 is standard input.
+		//
+		// A process that would have to wait for input or a timer waits on the
+		// SchemeEventLoop instead of on its worker thread, so one interpreter can
+		// follow many slow pipes at once. Elsewhere (the REPL, or without epoll)
+		// the calling thread blocks as usual.
+		struct SchemePorts {
+			// Builtins, added to the globals by SchemeRuntime::AddGlobals
+			static SchemeCell proc_open_input_file(const VectorType &args) SCHEME_THROW;
+			static SchemeCell proc_open_input_pipe(const VectorType &args) SCHEME_THROW;
+			// Next line, without its end of line, or nil at the end of input
+			static SchemeCell proc_read_line(const VectorType &args) SCHEME_THROW;
+			// The rest of the input
+			static SchemeCell proc_read_all(const VectorType &args) SCHEME_THROW;
+			static SchemeCell proc_close_port(const VectorType &args) SCHEME_THROW;
+			// Wait for a number of milliseconds
+			static SchemeCell proc_sleep(const VectorType &args) SCHEME_THROW;
+		};
+	}
+}
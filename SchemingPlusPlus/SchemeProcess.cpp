@@ -0,0 +1,344 @@
+#include <iostream>
+#include <iterator>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "SchemeAssert.h"
+#include "SchemeEventLoop.h"
+#include "SchemeExecutor.h"
+#include "SchemeImage.h"
+#include "SchemeProcess.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		namespace {
+			// Whether a value refers to no environment or pair, so may be carried as it is
+			bool IsPlain(const SchemeCell &cell) {
+				switch (cell.Type) {
+					case LIST:
+						for (auto it = cell.ListValue.cbegin(); it != cell.ListValue.cend(); ++it)
+							if (!IsPlain(*it))
+								return false;
+						return true;
+					case PAIR:
+					case LAMBDA:
+					case MACRO:
+					case ENVPTR:
+						return false;
+					default:
+						return true;
+				}
+			}
+
+			// Every process by id, and the pool that runs them, started by the first spawn
+			struct Scheduler {
+				std::shared_mutex lock;
+				std::unordered_map<SchemeProcess::IdType, std::shared_ptr<SchemeProcess>> processes;
+				std::atomic<SchemeProcess::IdType> next_id{ 1 };
+				std::atomic<bool> stopping{ false };
+				std::atomic<SchemeExecutor*> pool{ nullptr };  // the shared pool, once a process has used it
+
+				// The pool is started first, so it outlives the scheduler
+				Scheduler() {
+					SchemeExecutor::Shared();
+				}
+
+				// Processes still running at exit get no more slices, nor wake ups
+				~Scheduler() {
+					stopping = true;
+					SchemeEventLoop::Stop();
+					SchemeExecutor::Shared().Wait();
+				}
+
+				SchemeExecutor &Executor() {
+					SchemeExecutor &shared = SchemeExecutor::Shared();
+					pool = &shared;
+					return shared;
+				}
+
+				std::shared_ptr<SchemeProcess> Find(SchemeProcess::IdType id) {
+					std::shared_lock<std::shared_mutex> guard(lock);
+					auto found = processes.find(id);
+					return found == processes.end() ? nullptr : found->second;
+				}
+
+				void Add(SchemeProcess::IdType id, std::shared_ptr<SchemeProcess> process) {
+					std::unique_lock<std::shared_mutex> guard(lock);
+					processes.emplace(id, std::move(process));
+				}
+
+				void Remove(SchemeProcess::IdType id) {
+					// The process, and its heap, may be freed here: not under the lock
+					std::shared_ptr<SchemeProcess> process;
+					std::unique_lock<std::shared_mutex> guard(lock);
+					auto found = processes.find(id);
+					if (found == processes.end())
+						return;
+					process = std::move(found->second);
+					processes.erase(found);
+				}
+			};
+
+			Scheduler &GetScheduler() {
+				static Scheduler scheduler;
+				return scheduler;
+			}
+
+			// The process whose slice this thread is running
+			thread_local SchemeProcess *running = nullptr;
+
+			// A thread's own process, which it leaves as it exits
+			struct OwnProcess {
+				std::shared_ptr<SchemeProcess> process;
+				SchemeProcess::IdType id = 0;
+				~OwnProcess() {
+					if (process != nullptr)
+						GetScheduler().Remove(id);
+				}
+			};
+			thread_local OwnProcess own;
+		}
+
+		SchemeMessage SchemeMessage::Copy(const SchemeCell &value, bool named_only) SCHEME_THROW {
+			SchemeMessage message;
+			if (IsPlain(value))
+				message._value = value;
+			else
+				message._image = SchemeImage::WriteValue(value, true, named_only);
+			return message;
+		}
+
+		SchemeMessage SchemeMessage::Move(SchemeCell &&value, bool named_only) SCHEME_THROW {
+			SchemeMessage message;
+			if (IsPlain(value))
+				message._value = std::move(value);
+			else
+				message._image = SchemeImage::WriteValue(value, true, named_only);
+			return message;
+		}
+
+		SchemeCell SchemeMessage::Open() SCHEME_THROW {
+			if (_image.empty())
+				return std::move(_value);
+			return SchemeImage::ReadValue(_image, true);
+		}
+
+		SchemeMailbox::SchemeMailbox() : _head(new Node()), _tail(_head.load()) {
+		}
+
+		SchemeMailbox::~SchemeMailbox() {
+			while (_tail != nullptr) {
+				Node *next = _tail->next.load();
+				delete _tail;
+				_tail = next;
+			}
+		}
+
+		void SchemeMailbox::Push(SchemeMessage message) {
+			Node *node = new Node();
+			node->message = std::move(message);
+			// Senders are serialised by the exchange alone. Until the store, the
+			// receiver sees the queue end at previous.
+			Node *previous = _head.exchange(node);
+			previous->next.store(node);
+			++_count;
+		}
+
+		bool SchemeMailbox::Pop(SchemeMessage &message) {
+			Node *next = _tail->next.load();
+			if (next == nullptr)
+				return false;
+			message = std::move(next->message);
+			delete _tail;
+			_tail = next;
+			--_count;
+			return true;
+		}
+
+		SchemeProcess::SchemeProcess(IdType id) : _id(id) {
+			SchemeHeap::Use use(_heap);
+			// The heap's first root, so the last released
+			_root = std::make_unique<SchemeHeap::Root>(this, [](const void *value, SchemeMarker &marker) {
+				const SchemeProcess &process = *static_cast<const SchemeProcess*>(value);
+				if (process._state != nullptr)
+					process._state->Mark(marker);
+			});
+		}
+
+		SchemeProcess::~SchemeProcess() {
+			SchemeHeap::Use use(_heap);
+			_state.reset();
+			_root.reset();
+		}
+
+		SchemeProcess::IdType SchemeProcess::Spawn(const SchemeCell &proc, const VectorType &args) SCHEME_THROW {
+			VectorType call;
+			call.reserve(args.size() + 1);
+			call.push_back(proc);
+			call.insert(call.end(), args.cbegin(), args.cend());
+			SchemeMessage start = SchemeMessage::Copy(SchemeCell(std::move(call)));
+
+			Scheduler &scheduler = GetScheduler();
+			IdType id = scheduler.next_id++;
+			std::shared_ptr<SchemeProcess> process(new SchemeProcess(id));
+			{
+				SchemeHeap::Use use(process->_heap);
+				SchemeCell values = start.Open();
+				SchemeHeap::Root values_root(values);
+				// (quote proc) (quote arg)*: each evaluates to the value as it is
+				const SchemeCell quote(std::string("quote"));
+				VectorType form;
+				form.reserve(values.ListValue.size());
+				for (auto it = values.ListValue.begin(); it != values.ListValue.end(); ++it)
+					form.push_back(SchemeCell(VectorType{ quote, *it }));
+				EnvironmentType env = SchemeHeap::New();
+				process->_state = std::make_unique<SchemeFrameState>(SchemeCell(std::move(form)), env);
+			}
+			scheduler.Add(id, process);
+			scheduler.Executor().Submit([process] { Resume(process); });
+			return id;
+		}
+
+		bool SchemeProcess::Send(IdType id, SchemeMessage message) {
+			std::shared_ptr<SchemeProcess> process = GetScheduler().Find(id);
+			if (process == nullptr)
+				return false;
+			process->_mailbox.Push(std::move(message));
+			// After the push: a receiver that saw the mailbox empty has set WAITING
+			// first, so one of the two sees the other
+			Status waiting = WAITING;
+			if (process->_status.compare_exchange_strong(waiting, RUNNING))
+				Wake(process);
+			return true;
+		}
+
+		SchemeProcess::IdType SchemeProcess::Self() {
+			return running != nullptr ? running->_id : Own()._id;
+		}
+
+		SchemeProcess::IdType SchemeProcess::Running() {
+			return running != nullptr ? running->_id : 0;
+		}
+
+		void SchemeProcess::Notify(IdType id) {
+			std::shared_ptr<SchemeProcess> process = GetScheduler().Find(id);
+			if (process == nullptr)
+				return;
+			// As Send: set first, then seen by a process about to wait, or it is woken
+			process->_notified = true;
+			Status parked = PARKED;
+			if (process->_status.compare_exchange_strong(parked, RUNNING))
+				Wake(process);
+		}
+
+		void SchemeProcess::Wait() {
+			SchemeExecutor *pool = GetScheduler().pool;
+			if (pool == nullptr)
+				return;
+			// Processes waiting on I/O or timers will run again
+			do
+				pool->Wait();
+			while (SchemeEventLoop::WaitIdle());
+		}
+
+		size_t SchemeProcess::Count() {
+			Scheduler &scheduler = GetScheduler();
+			std::shared_lock<std::shared_mutex> guard(scheduler.lock);
+			return scheduler.processes.size();
+		}
+
+		void SchemeProcess::Resume(const std::shared_ptr<SchemeProcess> &process) {
+			Scheduler &scheduler = GetScheduler();
+			if (scheduler.stopping)
+				return;
+			bool finished;
+			{
+				SchemeHeap::Use use(process->_heap);
+				running = process.get();
+				try {
+					finished = process->_state->Run(Slice);
+				} catch (critical_error &ce) {
+					std::cerr << "process " << process->_id << ": " << ce.what() << std::endl;
+					finished = true;
+				}
+				running = nullptr;
+			}
+			if (finished) {
+				scheduler.Remove(process->_id);
+				return;
+			}
+			if (process->_state->Blocked()) {
+				// Only what the blocked call waits for wakes it: a message does not
+				// end a sleep, nor does input end a receive
+				bool for_message = process->_state->BlockReason() == SchemeFrameState::BLOCK_MAILBOX;
+				Status waiting = for_message ? WAITING : PARKED;
+				process->_status = waiting;
+				// A message or notice may have come before the status was set. Whoever
+				// sets the process RUNNING again queues it: here, or the sender. Once
+				// the status is set a sender may wake the process on another worker,
+				// so only the mailbox's count is read here, not its nodes.
+				bool ready = for_message ? !process->_mailbox.Empty() : process->_notified.exchange(false);
+				if (!ready || !process->_status.compare_exchange_strong(waiting, RUNNING))
+					return;
+			}
+			scheduler.Executor().Requeue([process] { Resume(process); });
+		}
+
+		void SchemeProcess::Wake(const std::shared_ptr<SchemeProcess> &process) {
+			if (process->_state != nullptr) {
+				GetScheduler().Executor().Submit([process] { Resume(process); });
+			} else {
+				std::lock_guard<std::mutex> guard(process->_lock);
+				process->_wake.notify_one();
+			}
+		}
+
+		SchemeProcess &SchemeProcess::Own() {
+			if (own.process == nullptr) {
+				Scheduler &scheduler = GetScheduler();
+				own.id = scheduler.next_id++;
+				own.process.reset(new SchemeProcess(own.id));
+				scheduler.Add(own.id, own.process);
+			}
+			return *own.process;
+		}
+
+		SchemeCell SchemeProcess::proc_spawn(const VectorType &args) SCHEME_THROW {
+			runtime_assert(args.size() > 0);
+			VectorType rest(args.cbegin() + 1, args.cend());
+			return SchemeCell((IntegerType)Spawn(args[0], rest));
+		}
+
+		SchemeCell SchemeProcess::proc_send(const VectorType &args) SCHEME_THROW {
+			runtime_assert(args.size() > 1 && args[0].Type == INTEGER);
+			return SchemeCell(Send((IdType)args[0].IntegerValue, SchemeMessage::Copy(args[1])));
+		}
+
+		SchemeCell SchemeProcess::proc_receive(const VectorType &) SCHEME_THROW {
+			SchemeMessage message;
+			if (running != nullptr) {
+				// Give up the slice until a message comes; the call is made again then
+				if (!running->_mailbox.Pop(message)) {
+					SchemeFrameState::Block(SchemeFrameState::BLOCK_MAILBOX);
+					return SchemeConstants::Nil;
+				}
+				return message.Open();
+			}
+			SchemeProcess &process = Own();
+			while (!process._mailbox.Pop(message)) {
+				std::unique_lock<std::mutex> guard(process._lock);
+				process._status = WAITING;
+				if (!process._mailbox.Empty()) {
+					process._status = RUNNING;
+					continue;
+				}
+				process._wake.wait(guard, [&process] { return process._status != WAITING; });
+			}
+			return message.Open();
+		}
+
+		SchemeCell SchemeProcess::proc_self(const VectorType &) {
+			return SchemeCell((IntegerType)Self());
+		}
+	}
+}
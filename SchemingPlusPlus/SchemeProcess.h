@@ -0,0 +1,135 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "SchemeCell.h"
+#include "SchemeEvalFrame.h"
+#include "SchemeHeap.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		// A value on its way from one heap to another. Plain data (numbers, strings,
+		// symbols, procedures and lists of them) travels as it is. Anything that
+		// refers to environments or pairs travels as a heap image (see SchemeImage),
+		// and is restored as new objects in the receiver's heap, so the two heaps
+		// never share an object.
+		class SchemeMessage {
+		public:
+			SchemeMessage() = default;
+			// Copy value out of the current heap. A value only to be called, or passed
+			// to what is called, may be named_only (see SchemeImage::WriteValue).
+			static SchemeMessage Copy(const SchemeCell &value, bool named_only = false) SCHEME_THROW;
+			// Take value, which the sender gives up: plain data moves rather than copies
+			static SchemeMessage Move(SchemeCell &&value, bool named_only = false) SCHEME_THROW;
+			// The value, in the current heap. It is not yet a root.
+			SchemeCell Open() SCHEME_THROW;
+		private:
+			SchemeCell _value;
+			std::string _image;  // the value, if it is not plain data
+		};
+
+		// A lock-free queue of messages with many senders and one receiver, after
+		// Vyukov's MPSC node queue. A send is one atomic exchange, a store and an
+		// increment; the receiver takes messages with loads and a decrement.
+		class SchemeMailbox {
+		public:
+			SchemeMailbox();
+			~SchemeMailbox();
+			SchemeMailbox(const SchemeMailbox &) = delete;
+			SchemeMailbox &operator = (const SchemeMailbox &) = delete;
+
+			// Any thread
+			void Push(SchemeMessage message);
+			// Whether no message has been pushed and not yet taken. Any thread: it
+			// reads a count, not the nodes, which the receiver may be freeing.
+			bool Empty() const { return _count.load() <= 0; }
+			// Receiver only. False if no message has arrived in full.
+			bool Pop(SchemeMessage &message);
+		private:
+			struct Node {
+				std::atomic<Node*> next{ nullptr };
+				SchemeMessage message;
+			};
+			std::atomic<Node*> _head;  // newest node; senders swap in theirs
+			Node *_tail;               // node before the oldest message, its own already taken
+			// Messages pushed less those taken. Counted after the link, so a message
+			// may be taken before it is counted, and the count dip below zero.
+			std::atomic<int64_t> _count{ 0 };
+		};
+
+		// An Erlang style process: a SchemeFrameState in a heap of its own, with a
+		// mailbox. Processes are run a slice at a time on a shared SchemeExecutor,
+		// one thread per core. They share nothing, and talk only by messages, so
+		// nothing they evaluate takes a lock. A process waiting in receive is not
+		// run again until a message arrives, nor one waiting for input or a timer
+		// (see SchemeEventLoop) until it is notified, whatever its mailbox holds.
+		//
+		// A thread that is not running a process, such as the REPL, is given one
+		// when it first calls self or receive: it has a mailbox, but evaluates in
+		// the thread's own heap, and receive blocks the thread.
+		class SchemeProcess {
+		public:
+			typedef uint32_t IdType;
+			// Expressions a process evaluates before the next has a turn
+			static const size_t Slice = 1000;
+
+			~SchemeProcess();
+			SchemeProcess(const SchemeProcess &) = delete;
+			SchemeProcess &operator = (const SchemeProcess &) = delete;
+
+			// Start a process evaluating (proc arg*), with proc and args copied into its heap
+			static IdType Spawn(const SchemeCell &proc, const VectorType &args) SCHEME_THROW;
+			// Queue a message for process id. False if there is no such process.
+			static bool Send(IdType id, SchemeMessage message);
+			// The calling process, or the calling thread's own
+			static IdType Self();
+			// The process whose slice this thread is running, or 0. Only such a
+			// process can wait by SchemeFrameState::Block.
+			static IdType Running();
+			// Wake process id if it is waiting, so its blocked call is made again:
+			// for whatever it waits on other than its mailbox (see SchemeEventLoop)
+			static void Notify(IdType id);
+			// Wait until no process can run: every one has finished, or waits for a
+			// message. Those waiting on I/O or a timer are waited for. Not from within a process.
+			static void Wait();
+			// Processes alive, including those threads have been given
+			static size_t Count();
+
+			// Builtins, added to the globals by SchemeRuntime::AddGlobals
+			static SchemeCell proc_spawn(const VectorType &args) SCHEME_THROW;
+			static SchemeCell proc_send(const VectorType &args) SCHEME_THROW;
+			static SchemeCell proc_receive(const VectorType &args) SCHEME_THROW;
+			static SchemeCell proc_self(const VectorType &args);
+		private:
+			enum Status : uint8_t {
+				RUNNING,   // queued or running: only the scheduler touches it
+				WAITING,   // in receive with an empty mailbox; a sender wakes it
+				PARKED     // blocked for SchemeEventLoop; only Notify wakes it
+			};
+
+			IdType _id;
+			SchemeHeapSpace _heap;
+			// What the process evaluates; nullptr for a thread's own process
+			std::unique_ptr<SchemeFrameState> _state;
+			std::unique_ptr<SchemeHeap::Root> _root;
+			SchemeMailbox _mailbox;
+			std::atomic<Status> _status{ RUNNING };
+			std::atomic<bool> _notified{ false };  // by Notify, since the process last waited
+			// A thread's own process sleeps on these in receive
+			std::mutex _lock;
+			std::condition_variable _wake;
+
+			explicit SchemeProcess(IdType id);
+			// Run one slice, then queue the next, wait for a message, or end
+			static void Resume(const std::shared_ptr<SchemeProcess> &process);
+			// Called by whoever sets a WAITING or PARKED process RUNNING
+			static void Wake(const std::shared_ptr<SchemeProcess> &process);
+			static SchemeProcess &Own();
+		};
+	}
+}
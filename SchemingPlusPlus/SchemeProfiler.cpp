@@ -0,0 +1,370 @@
+#include <algorithm>
+#include <cerrno>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "SchemeAssert.h"
+#include "SchemeEnvironment.h"
+#include "SchemeProfiler.h"
+#include "SchemeTrace.h"
+
+#ifndef COMPILER_MSC
+#include <csignal>
+#include <sys/time.h>
+#endif
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		std::atomic<bool> SchemeProfiler::profiling{ false };
+		std::atomic<int> SchemeProfiler::stack_users{ 0 };
+
+		namespace {
+			typedef SchemeProfiler::Entry Entry;
+
+			// Trivially constructible, so a signal handler can reach it on any thread
+			struct ShadowStack {
+				Entry entries[SchemeProfiler::MaxDepth];
+				volatile size_t depth;  // may run past MaxDepth; those frames are not kept
+			};
+			thread_local ShadowStack stack;
+
+			// Samples one after another: a SAMPLE entry whose Key is the depth of
+			// the stack, then the entries recorded of it, outermost first
+			const size_t SampleCapacity = (size_t)1 << 21;
+			std::atomic<Entry*> samples{ nullptr };
+			std::atomic<size_t> sample_cursor{ 0 };
+			std::atomic<size_t> samples_dropped{ 0 };
+			std::atomic<int> handlers_running{ 0 };
+			std::unique_ptr<Entry[]> sample_storage;
+			unsigned sample_hz = SchemeProfiler::DefaultHz;
+
+			// Closures called while profiling are kept until Stop, so that those
+			// no binding holds can still be shown by their source
+			struct KeptClosures {
+				std::mutex lock;
+				std::unordered_map<const void*, PairType> pairs;
+				std::atomic<uint32_t> generation{ 1 };
+			};
+
+			KeptClosures &GetKept() {
+				static KeptClosures kept;
+				return kept;
+			}
+
+			void Keep(const PairType &pair) {
+				// Which closures this thread has kept this profile, to lock only once each
+				thread_local std::unordered_set<const void*> seen;
+				thread_local uint32_t seen_generation = 0;
+				KeptClosures &kept = GetKept();
+				uint32_t generation = kept.generation.load(std::memory_order_relaxed);
+				if (seen_generation != generation) {
+					seen.clear();
+					seen_generation = generation;
+				}
+				if (!seen.insert(pair.get()).second)
+					return;
+				std::lock_guard<std::mutex> guard(kept.lock);
+				kept.pairs.emplace(pair.get(), pair);
+			}
+
+#ifndef COMPILER_MSC
+			void OnSample(int) {
+				int saved_errno = errno;
+				handlers_running.fetch_add(1);
+				Entry *buffer = samples.load();
+				if (buffer != nullptr) {
+					size_t depth = stack.depth;
+					size_t kept = depth < SchemeProfiler::MaxDepth ? depth : SchemeProfiler::MaxDepth;
+					size_t at = sample_cursor.fetch_add(kept + 1, std::memory_order_relaxed);
+					if (at + kept + 1 > SampleCapacity) {
+						samples_dropped.fetch_add(1, std::memory_order_relaxed);
+					} else {
+						buffer[at].Key = (const void*)depth;
+						buffer[at].Kind = SchemeProfiler::SAMPLE;
+						std::copy(stack.entries, stack.entries + kept, buffer + at + 1);
+					}
+				}
+				handlers_running.fetch_sub(1);
+				errno = saved_errno;
+			}
+#endif
+
+			// keep: whether a profile is taken, that may need the closure's source
+			Entry MakeEntry(const SchemeCell &proc, bool keep) {
+				Entry entry{ SchemeProfiler::Key(proc), SchemeProfiler::EMPTY };
+				if (proc.Type == LAMBDA || proc.Type == MACRO) {
+					entry.Kind = SchemeProfiler::CLOSURE;
+					if (keep)
+						Keep(proc.PairValue);
+				} else if (proc.Type == PROC || proc.Type == PROCENV) {
+					entry.Kind = SchemeProfiler::BUILTIN;
+				}
+				return entry;
+			}
+
+			// A sampled procedure's name: the one it is bound to, or its source
+			std::string Name(const Entry &entry, const std::unordered_map<const void*, std::string> &bound) {
+				auto found = bound.find(entry.Key);
+				if (found != bound.end())
+					return found->second;
+				if (entry.Kind == SchemeProfiler::BUILTIN) {
+					std::ostringstream name;
+					name << "<builtin " << entry.Key << ">";
+					return name.str();
+				}
+				auto pair = GetKept().pairs.find(entry.Key);
+				if (pair == GetKept().pairs.end())
+					return "<lambda>";
+				const SchemeCell &params = pair->second->Head;
+				const SchemeCell &body = pair->second->Tail.PairValue->Head;
+				std::string text = "(lambda " + params.ToString(true) + " " + body.ToString(true) + ")";
+				if (text.size() > 48)
+					text = text.substr(0, 45) + "...";
+				return text;
+			}
+
+			// A name as it can appear in folded stacks
+			std::string Folded(std::string name) {
+				std::replace(name.begin(), name.end(), ';', ':');
+				std::replace(name.begin(), name.end(), '\n', ' ');
+				return name;
+			}
+		}
+
+		const void *SchemeProfiler::Key(const SchemeCell &proc) {
+			switch (proc.Type) {
+				case LAMBDA: /* Fall through */
+				case MACRO: return proc.PairValue.get();
+				case PROC: return (const void*)proc.ProcValue;
+				case PROCENV: return (const void*)proc.ProcEnvValue;
+				default: return nullptr;
+			}
+		}
+
+		std::unordered_map<const void*, std::string> SchemeProfiler::Names(EnvironmentType env) {
+			std::unordered_map<const void*, std::string> names;
+			auto bind = [&names](AtomType atom, const SchemeCell &value) {
+				const void *key = Key(value);
+				if (key == nullptr)
+					return;
+				const std::string &name = SchemeSymbols::Name(atom);
+				auto found = names.find(key);
+				if (found == names.end())
+					names.emplace(key, name);
+				else if (name.size() < found->second.size() || (name.size() == found->second.size() && name < found->second))
+					found->second = name;
+			};
+			for (; env != nullptr; env = env->_outer) {
+				for (auto it = env->_map.cbegin(); it != env->_map.cend(); ++it)
+					bind(it->first, it->second);
+				for (size_t i = 0; i < env->_keys.size() && i < env->_slots.size(); ++i)
+					bind(env->_keys[i], env->_slots[i]);
+			}
+			return names;
+		}
+
+		size_t SchemeProfiler::Depth() {
+			return stack.depth;
+		}
+
+		void SchemeProfiler::Push(const SchemeCell &proc, bool follow) {
+			Entry entry = MakeEntry(proc, profiling.load(std::memory_order_relaxed));
+			size_t depth = stack.depth;
+			if (depth < MaxDepth)
+				stack.entries[depth] = entry;
+			// The entry is whole before a sample on this thread can see it
+			std::atomic_signal_fence(std::memory_order_seq_cst);
+			stack.depth = depth + 1;
+			if (follow && SchemeTrace::Following())
+				SchemeTrace::Enter(entry.Key, depth);
+		}
+
+		void SchemeProfiler::Replace(const SchemeCell &proc) {
+			Entry entry = MakeEntry(proc, profiling.load(std::memory_order_relaxed));
+			// Hidden from samples while it is rewritten, as if popped and pushed again
+			size_t depth = stack.depth - 1;
+			stack.depth = depth;
+			std::atomic_signal_fence(std::memory_order_seq_cst);
+			if (depth < MaxDepth)
+				stack.entries[depth] = entry;
+			std::atomic_signal_fence(std::memory_order_seq_cst);
+			stack.depth = depth + 1;
+			if (SchemeTrace::Following())
+				SchemeTrace::Enter(entry.Key, depth);
+		}
+
+		void SchemeProfiler::Pop() {
+			size_t depth = stack.depth - 1;
+			stack.depth = depth;
+			if (SchemeTrace::Following())
+				SchemeTrace::Leave(depth);
+		}
+
+		void SchemeProfiler::Truncate(size_t depth) {
+			stack.depth = depth;
+			if (SchemeTrace::Following())
+				SchemeTrace::Leave(depth);
+		}
+
+#ifdef COMPILER_MSC
+		void SchemeProfiler::Start(unsigned hz) SCHEME_THROW {
+			throw critical_error(CRIT_TYPE_NOT_IMPL, std::string("the profiler is not implemented on this platform"));
+		}
+
+		SchemeProfiler::Report SchemeProfiler::Stop(EnvironmentType env) SCHEME_THROW {
+			throw critical_error(CRIT_TYPE_NOT_IMPL, std::string("the profiler is not implemented on this platform"));
+		}
+#else
+		void SchemeProfiler::Start(unsigned hz) SCHEME_THROW {
+			runtime_assert(hz > 0 && hz <= 1000000);
+			if (profiling.exchange(true))
+				throw critical_error(CRIT_OP_INVALID, std::string("a profile is already being taken"));
+			UseStacks(true);
+			sample_hz = hz;
+			sample_storage.reset(new Entry[SampleCapacity]);
+			sample_cursor = 0;
+			samples_dropped = 0;
+			samples = sample_storage.get();
+			// The handler stays once installed: a SIGPROF still pending after Stop
+			// finds no buffer and is ignored, where the default would end the process
+			static std::once_flag installed;
+			std::call_once(installed, [] {
+				struct sigaction action {};
+				action.sa_handler = OnSample;
+				action.sa_flags = SA_RESTART;
+				sigemptyset(&action.sa_mask);
+				sigaction(SIGPROF, &action, nullptr);
+			});
+			itimerval timer{};
+			long interval = 1000000L / hz;
+			timer.it_interval.tv_sec = interval / 1000000L;
+			timer.it_interval.tv_usec = (suseconds_t)(interval % 1000000L);
+			timer.it_value = timer.it_interval;
+			setitimer(ITIMER_PROF, &timer, nullptr);
+		}
+
+		SchemeProfiler::Report SchemeProfiler::Stop(EnvironmentType env) SCHEME_THROW {
+			if (!profiling.load())
+				throw critical_error(CRIT_OP_INVALID, std::string("no profile is being taken"));
+			itimerval timer{};
+			setitimer(ITIMER_PROF, &timer, nullptr);
+			Entry *buffer = samples.exchange(nullptr);
+			while (handlers_running.load() != 0)
+				std::this_thread::yield();
+			profiling = false;
+			UseStacks(false);
+
+			// Count each distinct stack, named outermost first
+			std::unordered_map<const void*, std::string> bound = Names(env), names;
+			auto name = [&names, &bound](const Entry &entry) -> const std::string & {
+				auto found = names.find(entry.Key);
+				if (found == names.end())
+					found = names.emplace(entry.Key, Folded(Name(entry, bound))).first;
+				return found->second;
+			};
+			std::map<std::vector<std::string>, size_t> stacks;
+			size_t total = 0, end = std::min(sample_cursor.load(), SampleCapacity);
+			for (size_t at = 0; at < end;) {
+				runtime_assert(buffer[at].Kind == SAMPLE);
+				size_t depth = (size_t)buffer[at].Key, kept = depth < MaxDepth ? depth : MaxDepth;
+				std::vector<std::string> frames;
+				for (size_t i = 0; i < kept; ++i)
+					frames.push_back(name(buffer[at + 1 + i]));
+				if (depth > kept)
+					frames.push_back("[deeper]");
+				if (frames.empty())
+					frames.push_back("<top level>");
+				++stacks[frames];
+				++total;
+				at += kept + 1;
+			}
+			sample_storage.reset();
+			{
+				KeptClosures &kept = GetKept();
+				std::lock_guard<std::mutex> guard(kept.lock);
+				kept.pairs.clear();
+				++kept.generation;
+			}
+
+			// Self: samples in which a procedure was running. Total: samples in
+			// which it was on the stack, once however deep it recursed.
+			struct Times { size_t self = 0, total = 0; };
+			std::unordered_map<std::string, Times> times;
+			std::ostringstream folded;
+			for (auto it = stacks.cbegin(); it != stacks.cend(); ++it) {
+				const std::vector<std::string> &frames = it->first;
+				times[frames.back()].self += it->second;
+				std::unordered_set<std::string> counted;
+				for (auto frame = frames.cbegin(); frame != frames.cend(); ++frame) {
+					if (counted.insert(*frame).second)
+						times[*frame].total += it->second;
+					folded << (frame == frames.cbegin() ? "" : ";") << *frame;
+				}
+				folded << " " << it->second << std::endl;
+			}
+			std::vector<std::pair<std::string, Times>> sorted(times.cbegin(), times.cend());
+			std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, Times> &a, const std::pair<std::string, Times> &b) {
+				if (a.second.self != b.second.self)
+					return a.second.self > b.second.self;
+				if (a.second.total != b.second.total)
+					return a.second.total > b.second.total;
+				return a.first < b.first;
+			});
+
+			std::ostringstream text;
+			double ms_per_sample = 1000.0 / sample_hz;
+			text << total << " samples at " << sample_hz << " Hz";
+			if (samples_dropped > 0)
+				text << ", " << samples_dropped << " dropped once the buffer was full";
+			text << std::endl;
+			text << std::setw(10) << "self ms" << std::setw(8) << "self%"
+				<< std::setw(10) << "total ms" << std::setw(8) << "total%" << "  procedure" << std::endl;
+			text << std::fixed;
+			for (auto it = sorted.cbegin(); it != sorted.cend(); ++it) {
+				text << std::setprecision(1)
+					<< std::setw(10) << it->second.self * ms_per_sample
+					<< std::setw(8) << (total == 0 ? 0.0 : 100.0 * it->second.self / total)
+					<< std::setw(10) << it->second.total * ms_per_sample
+					<< std::setw(8) << (total == 0 ? 0.0 : 100.0 * it->second.total / total)
+					<< "  " << it->first << std::endl;
+			}
+			return Report{ text.str(), folded.str() };
+		}
+#endif
+
+		SchemeCell SchemeProfiler::Macro(EnvironmentType env) SCHEME_THROW {
+			// (profile expr file) becomes (profile-stop (begin (profile-start) expr) file)
+			return SchemeCell::Closure(Read(
+				"(macro args (append (list (quote profile-stop) (list (quote begin) (list (quote profile-start)) (head args))) (tail args)))"),
+				env);
+		}
+
+		SchemeCell SchemeProfiler::proc_profile_start(const VectorType &args) SCHEME_THROW {
+			unsigned hz = DefaultHz;
+			if (!args.empty())
+				hz = (unsigned)args[0].ToInteger();
+			Start(hz);
+			return SchemeConstants::Nil;
+		}
+
+		SchemeCell SchemeProfiler::proc_profile_stop(const VectorType &args, EnvironmentType env) SCHEME_THROW {
+			Report report = Stop(env);
+			std::cerr << report.Text;
+			if (args.size() > 1) {
+				std::ofstream out(args[1].Value);
+				out << report.Folded;
+				if (!out)
+					throw critical_error(CRIT_INVALID_PROC, args[1].Value + ": cannot write");
+			}
+			return args.empty() ? SchemeConstants::Nil : args[0];
+		}
+	}
+}
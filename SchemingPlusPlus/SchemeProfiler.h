@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include "SchemeCell.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		// Sampling profiler. While a profile is taken, or a trace follows calls
+		// (see SchemeTrace), the evaluators keep a shadow stack of the procedures
+		// they apply on each thread. While a profile is taken, a SIGPROF
+		// timer copies the stack of whichever thread it interrupts. Stop names
+		// what was sampled by the bindings that hold it, and reports the self and
+		// total time of each procedure, and the stacks folded for flame graphs
+		// (one "outer;inner;leaf count" line per distinct stack).
+		//
+		// A tail call replaces its caller on the stack, as it does in the
+		// evaluators. The frame evaluator keeps no call stack of its own, so
+		// under it only the running procedure is seen.
+		class SchemeProfiler {
+		public:
+			static const unsigned DefaultHz = 1000;
+			// Frames beyond this depth are counted but not recorded
+			static const size_t MaxDepth = 256;
+
+			enum Kinds : uint32_t { EMPTY, SAMPLE, CLOSURE, BUILTIN };
+			struct Entry {
+				const void *Key;  // CLOSURE: its (params body) pair; BUILTIN: its function
+				Kinds Kind;
+			};
+
+			// The calls one evaluator invocation makes. Whatever it pushed on the
+			// shadow stack is popped when it goes out of scope, exceptions included.
+			// Does nothing until a profile is being taken, which may start while
+			// the invocation runs.
+			class Scope {
+			public:
+				Scope() : _base(Active() ? Depth() : Inactive) { }
+				~Scope() { if (_base != Inactive) Truncate(_base); }
+				Scope(const Scope &) = delete;
+				Scope &operator = (const Scope &) = delete;
+
+				// proc is called, and returns here
+				void Call(const SchemeCell &proc) { if (Live()) Push(proc); }
+				// proc replaces the procedure this scope is running, if any
+				void TailCall(const SchemeCell &proc) {
+					if (!Live())
+						return;
+					if (Depth() > _base)
+						Replace(proc);
+					else
+						Push(proc);
+				}
+				// proc is what this scope runs now, whatever ran before: where
+				// the calls themselves are not seen, so none of them is traced
+				void Running(const SchemeCell &proc) {
+					if (!Live())
+						return;
+					if (Depth() > _base)
+						Pop();
+					Push(proc, false);
+				}
+				// The innermost call made here has returned
+				void Return() { if (_base != Inactive && Depth() > _base) Pop(); }
+			private:
+				static const size_t Inactive = ~(size_t)0;
+				size_t _base;
+
+				bool Live() {
+					if (_base == Inactive && Active())
+						_base = Depth();
+					return _base != Inactive;
+				}
+			};
+
+			struct Report {
+				std::string Text;    // self and total time per procedure
+				std::string Folded;  // collapsed stacks, for flamegraph.pl and the like
+			};
+
+			// Whether shadow stacks are kept
+			static bool Active() { return stack_users.load(std::memory_order_relaxed) > 0; }
+			// Keep shadow stacks, or stop keeping them, for other than a profile
+			static void UseStacks(bool use) { stack_users.fetch_add(use ? 1 : -1); }
+			// What a shadow stack entry is keyed by: see Entry. Null if proc is
+			// not a procedure.
+			static const void *Key(const SchemeCell &proc);
+			// Sample hz times a second of CPU time. Throws if a profile is already
+			// being taken, or where there is no SIGPROF.
+			static void Start(unsigned hz = DefaultHz) SCHEME_THROW;
+			// Stop sampling. Procedures are named by the bindings of env and the
+			// environments around it; others by their source.
+			static Report Stop(EnvironmentType env) SCHEME_THROW;
+
+			// (profile expr [file]): the value of expr, with a report of its
+			// evaluation on standard error and its folded stacks in file, if given
+			static SchemeCell Macro(EnvironmentType env) SCHEME_THROW;
+
+			// Builtins, added to the globals by SchemeRuntime::AddGlobals
+			static SchemeCell proc_profile_start(const VectorType &args) SCHEME_THROW;
+			// (profile-stop value [file]): stop, report as profile does, and return value
+			static SchemeCell proc_profile_stop(const VectorType &args, EnvironmentType env) SCHEME_THROW;
+		private:
+			static std::atomic<bool> profiling;
+			static std::atomic<int> stack_users;
+
+			static size_t Depth();
+			// follow: whether a trace following calls is told of it
+			static void Push(const SchemeCell &proc, bool follow = true);
+			static void Replace(const SchemeCell &proc);
+			static void Pop();
+			static void Truncate(size_t depth);
+			// What env and the environments around it bind procedures to, by the
+			// key of their entries; the shortest name where there are several
+			static std::unordered_map<const void*, std::string> Names(EnvironmentType env);
+		};
+	}
+}
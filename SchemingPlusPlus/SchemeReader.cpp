@@ -0,0 +1,137 @@
+#include <ctype.h>
+
+#include "SchemeReader.h"
+#include "SchemeTrace.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		void SchemeReader::Feed(std::string_view text) {
+			// Editors on Windows start UTF-8 files with a byte order mark
+			if (!_fed && text.substr(0, 3) == "\xEF\xBB\xBF")
+				text.remove_prefix(3);
+			_fed = true;
+			Compact();
+			_buffer.append(text.data(), text.size());
+		}
+
+		void SchemeReader::Reset() {
+			_buffer.clear();
+			_start = _scan = 0;
+			_state = BETWEEN;
+			_depth = 0;
+			_quote = 0;
+			_escape = false;
+			_finished = false;
+			_fed = false;
+		}
+
+		bool SchemeReader::Pending() const {
+			return _depth > 0 || _state == ATOM || _state == STRING;
+		}
+
+		void SchemeReader::Compact() {
+			// Only once the consumed prefix is worth moving the rest for
+			if (_start == 0 || _start < _buffer.size() / 2)
+				return;
+			_buffer.erase(0, _start);
+			_scan -= _start;
+			_start = 0;
+		}
+
+		size_t SchemeReader::Scan() SCHEME_THROW {
+			const size_t size = _buffer.size();
+			for (; _scan < size; ++_scan) {
+				const char c = _buffer[_scan];
+				switch (_state) {
+				case COMMENT:
+					if (c == '\n' || c == '\r')
+						_state = BETWEEN;
+					if (_depth == 0)
+						_start = _scan + 1;
+					continue;
+				case STRING:
+					if (_escape)
+						_escape = false;
+					else if (c == '\\')
+						_escape = true;
+					else if (c == _quote) {
+						_state = BETWEEN;
+						if (_depth == 0)
+							return _scan + 1;
+					}
+					continue;
+				case ATOM:
+					if (!isspace((unsigned char)c) && c != '(' && c != ')')
+						continue;
+					_state = BETWEEN;
+					if (_depth == 0)
+						return _scan;
+					// Fall through
+				case BETWEEN:
+					break;
+				}
+				if (isspace((unsigned char)c)) {
+					if (_depth == 0)
+						_start = _scan + 1;
+				} else if (c == ';' && (_scan + 1 < size || !_finished)) {
+					if (_scan + 1 == size)
+						return std::string::npos; // ;; or an atom: wait for the next character
+					if (_buffer[_scan + 1] == ';')
+						_state = COMMENT;
+					else
+						_state = ATOM;
+				} else if (c == '(') {
+					++_depth;
+				} else if (c == ')') {
+					if (_depth == 0) {
+						_start = ++_scan;
+						throw critical_error(CRIT_SYNTAX, std::string("unexpected )"));
+					}
+					if (--_depth == 0)
+						return _scan + 1;
+				} else if (c == QUOTE_DOUBLE || c == QUOTE_SINGLE) {
+					_state = STRING;
+					_quote = c;
+				} else {
+					_state = ATOM;
+				}
+			}
+			if (_finished && _state == ATOM && _depth == 0)
+				return _scan;
+			return std::string::npos;
+		}
+
+		bool SchemeReader::Next(SchemeCell &form) SCHEME_THROW {
+			size_t end = Scan();
+			if (end == std::string::npos) {
+				if (_finished && Pending()) {
+					Reset();
+					_finished = true;
+					throw critical_error(CRIT_SYNTAX, std::string("unexpected end of input"));
+				}
+				return false;
+			}
+			std::string_view text(_buffer.data() + _start, end - _start);
+			_start = _scan = end;
+			_state = BETWEEN;
+			SchemeTrace::Span span("parse", form);
+			form = Read(text);
+			return true;
+		}
+
+		bool SchemeReader::NextFrom(std::istream &in, SchemeCell &form, size_t chunk) SCHEME_THROW {
+			std::string buffer;
+			while (!Next(form)) {
+				if (_finished)
+					return false;
+				buffer.resize(chunk);
+				in.read(&buffer[0], chunk);
+				if (in.gcount() > 0)
+					Feed(std::string_view(buffer.data(), (size_t)in.gcount()));
+				if (!in)
+					Finish();
+			}
+			return true;
+		}
+	}
+}
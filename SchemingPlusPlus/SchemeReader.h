@@ -0,0 +1,60 @@
+#pragma once
+
+#include <istream>
+#include <string>
+#include <string_view>
+
+#include "SchemeCell.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		// Incremental reader: input is fed in pieces of any size, and each top
+		// level form can be taken as soon as its parentheses balance. Only the
+		// form being read is buffered, so memory is bounded by the largest form
+		// rather than by the input.
+		//
+		// Forms are split by the same rules as TokeniseView (;; comments, quoted
+		// strings with backslash escapes) and parsed with Read.
+		class SchemeReader {
+		public:
+			static const size_t DefaultChunk = 64 * 1024;
+
+			SchemeReader() { Reset(); }
+
+			// Append input
+			void Feed(std::string_view text);
+			// No more input will be fed: a trailing atom completes, an open form is an error
+			void Finish() { _finished = true; }
+			// Discard buffered input and start afresh, e.g. after an error
+			void Reset();
+
+			// Take the next complete form. False if more input is needed first,
+			// or if input is finished and exhausted.
+			bool Next(SchemeCell &form) SCHEME_THROW;
+			// Feed from in, up to chunk bytes at a time, until the next form is
+			// complete. False once in is exhausted and no forms remain.
+			bool NextFrom(std::istream &in, SchemeCell &form, size_t chunk = DefaultChunk) SCHEME_THROW;
+
+			// True if part of a form has been read, i.e. more input is expected
+			bool Pending() const;
+
+		private:
+			enum States { BETWEEN, ATOM, STRING, COMMENT };
+
+			std::string _buffer;
+			size_t _start;     // start of the form being read
+			size_t _scan;      // next character to examine
+			States _state;
+			size_t _depth;     // open parentheses
+			char _quote;       // STRING: the quote that closes it
+			bool _escape;      // STRING: the previous character was a backslash
+			bool _finished;
+			bool _fed;         // input has been fed since Reset
+
+			// Scan for the end of the current form; npos if it is not complete yet
+			size_t Scan() SCHEME_THROW;
+			// Drop consumed input from the front of the buffer
+			void Compact();
+		};
+	}
+}
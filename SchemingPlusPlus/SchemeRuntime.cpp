@@ -1,218 +1,287 @@
-#include <iostream>
-#include <string>
-
-#include "SchemeAssert.h"
-#include "SchemeRuntime.h"
-#include "SchemeCell.h"
-#include "SchemeEnvironment.h"
-#include "TextUtils.h"
-
-namespace SchemingPlusPlus {
-	namespace Core {
-		// Big complex macros are bad.
-		#define MATH_COMPARE(op, check) do { \
-			runtime_assert(args.empty() == false); \
-			runtime_assert(args.size() > 1); \
-			SchemeCell first = args[0]; \
-			for (auto it = args.cbegin() + 1; it != args.cend(); ++it) { \
-				switch (it->Type) { \
-					case INTEGER: \
-						if (first.ToInteger() check it->ToInteger()) \
-							return SchemeConstants::False; \
-						break; \
-					case FLOAT: \
-						if (first.ToFloat() check it->ToFloat()) \
-							return SchemeConstants::False; \
-						break; \
-					default: \
-						throw critical_error(CRIT_OP_INVALID, first.ToString() + " " + #op + " " + it->ToString(true)); \
-				} \
-			} \
-			return SchemeConstants::True; \
-        } while(0)
-
-		bool SchemeRuntime::IsBasicType(CellType type) {
-			switch (type) {
-				case INTEGER:
-				case FLOAT:
-				case SYMBOL:
-				case STRING:
-					return true;
-				default: return false;
-			}
-		}
-		bool SchemeRuntime::CanCoerce(CellType from, CellType to) {
-			// Same: no coerce required
-			if (from == to) return true;
-			// Basic types: can coerce between
-			if (IsBasicType(from) && IsBasicType(to)) return true;
-			// Complex types: cannot coerce between
-			return false;
-		}
-
-		//SchemeCell SchemeRuntime::proc_greater(const VectorType &args) SCHEME_THROW { MATH_COMPARE(>, <=); }
-		SchemeCell SchemeRuntime::proc_greater(const VectorType &args) SCHEME_THROW { 
-			runtime_assert(args.empty() == false); 
-			runtime_assert(args.size() > 1); 
-			SchemeCell first = args[0]; 
-			for (auto it = args.cbegin() + 1; it != args.cend(); ++it) { 
-				switch (it->Type) { 
-					case INTEGER: 
-						if (first.ToInteger() <= it->ToInteger()) 
-							return SchemeConstants::False; 
-						break;
-					case FLOAT: 
-						if (first.ToFloat() <= it->ToFloat()) 
-							return SchemeConstants::False; 
-						break;
-					default: 
-						throw critical_error(CRIT_OP_INVALID, first.ToString() + " > " + it->ToString(true)); 
-				} 
-			} 
-			return SchemeConstants::True; 
-		}
-		SchemeCell SchemeRuntime::proc_less(const VectorType &args) SCHEME_THROW { MATH_COMPARE(<, >=); }
-		SchemeCell SchemeRuntime::proc_less_equal(const VectorType &args) SCHEME_THROW { MATH_COMPARE(<=, >); }
-		SchemeCell SchemeRuntime::proc_equal(const VectorType &args) SCHEME_THROW {
-			runtime_assert(args.empty() == false); 
-			runtime_assert(args.size() > 1); 
-			SchemeCell first = args[0]; 
-			for (auto it = args.cbegin() + 1; it != args.cend(); ++it) { 
-				if (first != *it) return SchemeConstants::False;
-			} 
-			return SchemeConstants::True; 
-		}
-		inline SchemeCell _not(const SchemeCell &arg) {
-			if (arg == SchemeConstants::False)
-				return SchemeConstants::True;
-			return SchemeConstants::False;
-		}
-		inline SchemeCell _truthy(bool truthy) {
-			return truthy ? SchemeConstants::True : SchemeConstants::False;
-		}
-		SchemeCell SchemeRuntime::proc_not(const VectorType &args) SCHEME_THROW {
-			return _not(args[0]);
-		}
-		SchemeCell SchemeRuntime::_not(const SchemeCell &arg) SCHEME_THROW {
-			if (arg == SchemeConstants::False)
-				return SchemeConstants::True;
-			return SchemeConstants::False;
-		}
-		SchemeCell SchemeRuntime::proc_not_equal(const VectorType &args) SCHEME_THROW {
-			return _not(SchemeRuntime::proc_equal(args));
-		}
-
-		SchemeCell SchemeRuntime::proc_add(const VectorType &args) SCHEME_THROW {
-			runtime_assert(args.size() > 0);
-			SchemeCell value = args[0];
-			for (auto it = args.cbegin() + 1; it != args.cend(); ++it) {
-				const SchemeCell &cell = *it;
-				value += cell;
-			}
-			return value;
-		}
-
-		SchemeCell SchemeRuntime::proc_sub(const VectorType &args) SCHEME_THROW {
-			runtime_assert(args.size() > 0);
-			SchemeCell value = args[0];
-			for (auto it = args.cbegin() + 1; it != args.cend(); ++it) {
-				const SchemeCell &cell = *it;
-				value -= cell;
-			}
-			return value;
-		}
-
-		SchemeCell SchemeRuntime::proc_mul(const VectorType &args) SCHEME_THROW {
-			runtime_assert(args.size() > 0);
-			SchemeCell value = args[0];
-			for (auto it = args.cbegin() + 1; it != args.cend(); ++it) {
-				const SchemeCell &cell = *it;
-				value *= cell;
-			}
-			return value;
-		}
-
-		SchemeCell SchemeRuntime::proc_div(const VectorType &args) SCHEME_THROW {
-			runtime_assert(args.size() > 0);
-			SchemeCell value = args[0];
-			for (auto it = args.cbegin() + 1; it != args.cend(); ++it) {
-				const SchemeCell &cell = *it;
-				value /= cell;
-			}
-			return value;
-		}
-
-		// List functions
-		SchemeCell SchemeRuntime::proc_length(const VectorType &args) SCHEME_THROW {
-			runtime_assert(args.size() > 0);
-			return SchemeCell((IntegerType)args[0].ListValue.size());
-		}
-		SchemeCell SchemeRuntime::proc_nullp(const VectorType &args) SCHEME_THROW {
-			runtime_assert(args.size() > 0);
-			return _truthy(args[0].ListValue.empty());
-		}
-		SchemeCell SchemeRuntime::proc_head(const VectorType &args) SCHEME_THROW {
-			runtime_assert(args.size() > 0);
-			return args[0].Head();
-		}
-		SchemeCell SchemeRuntime::proc_tail(const VectorType &args) SCHEME_THROW {
-			runtime_assert(args.size() > 0);
-			return args[0].Tail();
-		}
-		SchemeCell SchemeRuntime::proc_append(const VectorType &args) SCHEME_THROW {
-			runtime_assert(args.size() > 1);
-			SchemeCell result(args[0].ListValue);
-			const SchemeCell &arg1 = args[1];
-			for (auto it = arg1.ListValue.cbegin(); it != arg1.ListValue.cend(); ++it) {
-				result.ListValue.push_back(*it);
-			}
-			return result;
-		}
-		SchemeCell SchemeRuntime::proc_cons(const VectorType &args) SCHEME_THROW {
-			runtime_assert(args.size() > 1);
-			SchemeCell result("", LIST);
-			result.ListValue.push_back(args[0]);
-			const SchemeCell &arg1 = args[1];
-			for (auto it = arg1.ListValue.cbegin(); it != arg1.ListValue.cend(); ++it) {
-				result.ListValue.push_back(*it);
-			}
-			return result;
-		}
-		SchemeCell SchemeRuntime::proc_list(const VectorType &args) {
-			return SchemeCell(args);
-		}
-
-		// SchemeCell mapper function
-		auto map_cell_to_string(bool expr) {
-			return [expr] (const SchemeCell &cell) { return cell.ToString(expr); };
-		}
-		// IO functions
-		SchemeCell SchemeRuntime::proc_print(const VectorType &args) {
-			std::cout << TextUtils::Join(args, " ", map_cell_to_string(false)) << std::endl;
-			return SchemeConstants::Nil;
-		}
-		SchemeCell SchemeRuntime::proc_expr(const VectorType &args) {
-			return SchemeCell(TextUtils::Join(args, " ", map_cell_to_string(true)), STRING);
-		}
-
-		void SchemeRuntime::AddGlobals(EnvironmentType _env) {
-			SchemeEnvironment &env = *_env;
-			env["nil"] = SchemeConstants::Nil;
-			env["#f"] = SchemeConstants::False;
-			env["#t"] = SchemeConstants::True;
-			env["<"] = proc_less; env["<="] = proc_less_equal;
-			env[">"] = proc_greater;
-			env["="] = proc_equal; env["=="] = proc_equal;
-			env["!"] = proc_not; env["!="] = proc_not_equal;
-			env["+"] = proc_add; env["-"] = proc_sub;
-			env["*"] = proc_mul; env["/"] = proc_div;
-			// List functions
-			env["length"] = proc_length; env["null?"] = proc_nullp;
-			env["head"] = proc_head; env["tail"] = proc_tail;
-			env["append"] = proc_append; env["cons"] = proc_cons;
-			env["list"] = proc_list;
-			// IO functions
-			env["print"] = proc_print; env["expr"] = proc_expr;
-		}
-	}
-}
+#include <cctype>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+#include "SchemeAssert.h"
+#include "SchemeRuntime.h"
+#include "SchemeCell.h"
+#include "SchemeEnvironment.h"
+#include "SchemeFuture.h"
+#include "SchemeHeap.h"
+#include "SchemePorts.h"
+#include "SchemeProcess.h"
+#include "SchemeProfiler.h"
+#include "SchemeStats.h"
+#include "TextUtils.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		// Big complex macros are bad.
+		#define MATH_COMPARE(op, check) do { \
+			runtime_assert(args.empty() == false); \
+			runtime_assert(args.size() > 1); \
+			const SchemeCell &first = args[0]; \
+			for (auto it = args.cbegin() + 1; it != args.cend(); ++it) { \
+				if (!it->IsNumber()) \
+					throw critical_error(CRIT_OP_INVALID, first.ToString() + " " + #op + " " + it->ToString(true)); \
+				if (SchemeCell::NumericCompare(first, *it) check 0) \
+					return SchemeConstants::False; \
+			} \
+			return SchemeConstants::True; \
+        } while(0)
+
+		bool SchemeRuntime::IsBasicType(CellType type) {
+			switch (type) {
+				case INTEGER:
+				case FLOAT:
+				case BIGINT:
+				case SYMBOL:
+				case STRING:
+					return true;
+				default: return false;
+			}
+		}
+		bool SchemeRuntime::CanCoerce(CellType from, CellType to) {
+			// Same: no coerce required
+			if (from == to) return true;
+			// Basic types: can coerce between
+			if (IsBasicType(from) && IsBasicType(to)) return true;
+			// Complex types: cannot coerce between
+			return false;
+		}
+
+		//SchemeCell SchemeRuntime::proc_greater(const VectorType &args) SCHEME_THROW { MATH_COMPARE(>, <=); }
+		SchemeCell SchemeRuntime::proc_greater(const VectorType &args) SCHEME_THROW { 
+			runtime_assert(args.empty() == false); 
+			runtime_assert(args.size() > 1); 
+			const SchemeCell &first = args[0]; 
+			for (auto it = args.cbegin() + 1; it != args.cend(); ++it) { 
+				if (!it->IsNumber())
+					throw critical_error(CRIT_OP_INVALID, first.ToString() + " > " + it->ToString(true));
+				if (SchemeCell::NumericCompare(first, *it) <= 0)
+					return SchemeConstants::False;
+			} 
+			return SchemeConstants::True; 
+		}
+		SchemeCell SchemeRuntime::proc_less(const VectorType &args) SCHEME_THROW { MATH_COMPARE(<, >=); }
+		SchemeCell SchemeRuntime::proc_less_equal(const VectorType &args) SCHEME_THROW { MATH_COMPARE(<=, >); }
+		SchemeCell SchemeRuntime::proc_equal(const VectorType &args) SCHEME_THROW {
+			runtime_assert(args.empty() == false); 
+			runtime_assert(args.size() > 1); 
+			const SchemeCell &first = args[0]; 
+			for (auto it = args.cbegin() + 1; it != args.cend(); ++it) { 
+				if (first != *it) return SchemeConstants::False;
+			} 
+			return SchemeConstants::True; 
+		}
+		inline SchemeCell _not(const SchemeCell &arg) {
+			if (arg == SchemeConstants::False)
+				return SchemeConstants::True;
+			return SchemeConstants::False;
+		}
+		inline SchemeCell _truthy(bool truthy) {
+			return truthy ? SchemeConstants::True : SchemeConstants::False;
+		}
+		SchemeCell SchemeRuntime::proc_not(const VectorType &args) SCHEME_THROW {
+			return _not(args[0]);
+		}
+		SchemeCell SchemeRuntime::_not(const SchemeCell &arg) SCHEME_THROW {
+			if (arg == SchemeConstants::False)
+				return SchemeConstants::True;
+			return SchemeConstants::False;
+		}
+		SchemeCell SchemeRuntime::proc_not_equal(const VectorType &args) SCHEME_THROW {
+			return _not(SchemeRuntime::proc_equal(args));
+		}
+
+		SchemeCell SchemeRuntime::proc_add(const VectorType &args) SCHEME_THROW {
+			runtime_assert(args.size() > 0);
+			SchemeCell value = args[0];
+			for (auto it = args.cbegin() + 1; it != args.cend(); ++it) {
+				const SchemeCell &cell = *it;
+				value += cell;
+			}
+			return value;
+		}
+
+		SchemeCell SchemeRuntime::proc_sub(const VectorType &args) SCHEME_THROW {
+			runtime_assert(args.size() > 0);
+			SchemeCell value = args[0];
+			for (auto it = args.cbegin() + 1; it != args.cend(); ++it) {
+				const SchemeCell &cell = *it;
+				value -= cell;
+			}
+			return value;
+		}
+
+		SchemeCell SchemeRuntime::proc_mul(const VectorType &args) SCHEME_THROW {
+			runtime_assert(args.size() > 0);
+			SchemeCell value = args[0];
+			for (auto it = args.cbegin() + 1; it != args.cend(); ++it) {
+				const SchemeCell &cell = *it;
+				value *= cell;
+			}
+			return value;
+		}
+
+		SchemeCell SchemeRuntime::proc_div(const VectorType &args) SCHEME_THROW {
+			runtime_assert(args.size() > 0);
+			SchemeCell value = args[0];
+			for (auto it = args.cbegin() + 1; it != args.cend(); ++it) {
+				const SchemeCell &cell = *it;
+				value /= cell;
+			}
+			return value;
+		}
+
+		// List functions
+		SchemeCell SchemeRuntime::proc_length(const VectorType &args) SCHEME_THROW {
+			runtime_assert(args.size() > 0);
+			return SchemeCell((IntegerType)args[0].Size());
+		}
+		SchemeCell SchemeRuntime::proc_nullp(const VectorType &args) SCHEME_THROW {
+			runtime_assert(args.size() > 0);
+			return _truthy(args[0].Type != PAIR && args[0].ListValue.empty());
+		}
+		SchemeCell SchemeRuntime::proc_head(const VectorType &args) SCHEME_THROW {
+			runtime_assert(args.size() > 0);
+			return args[0].Head();
+		}
+		SchemeCell SchemeRuntime::proc_tail(const VectorType &args) SCHEME_THROW {
+			runtime_assert(args.size() > 0);
+			return args[0].Tail();
+		}
+		SchemeCell SchemeRuntime::proc_append(const VectorType &args) SCHEME_THROW {
+			runtime_assert(args.size() > 1);
+			const SchemeCell &arg0 = args[0];
+			const SchemeCell &arg1 = args[1];
+			if (arg0.Type != PAIR && arg1.Type != PAIR) {
+				SchemeCell result(arg0.ListValue);
+				result.ListValue.insert(result.ListValue.end(), arg1.ListValue.cbegin(), arg1.ListValue.cend());
+				return result;
+			}
+			// Copy the first list only; the result shares the second
+			const SchemeCell &first = arg0.ToList();
+			return SchemeCell::Cons(first.ListValue.cbegin(), first.ListValue.cend(), arg1);
+		}
+		SchemeCell SchemeRuntime::proc_cons(const VectorType &args) SCHEME_THROW {
+			runtime_assert(args.size() > 1);
+			return SchemeCell::Cons(args[0], args[1]);
+		}
+		SchemeCell SchemeRuntime::proc_list(const VectorType &args) {
+			return SchemeCell(args);
+		}
+
+		// SchemeCell mapper function
+		auto map_cell_to_string(bool expr) {
+			return [expr] (const SchemeCell &cell) { return cell.ToString(expr); };
+		}
+		// IO functions
+		SchemeCell SchemeRuntime::proc_print(const VectorType &args) {
+			// Processes print from any thread; a line is written whole, and not
+			// flushed, so a run of prints does not make a system call each
+			static std::mutex output;
+			std::string line = TextUtils::Join(args, " ", map_cell_to_string(false));
+			line += '\n';
+			std::lock_guard<std::mutex> guard(output);
+			std::cout << line;
+			return SchemeConstants::Nil;
+		}
+		SchemeCell SchemeRuntime::proc_expr(const VectorType &args) {
+			return SchemeCell(TextUtils::Join(args, " ", map_cell_to_string(true)), STRING);
+		}
+
+		// Memory functions
+		SchemeCell SchemeRuntime::proc_gc(const VectorType &) {
+			SchemeHeap::Collect();
+			SchemeHeapStats stats = SchemeHeap::Stats();
+			auto entry = [](const std::string &name, SchemeCell value) {
+				return SchemeCell(VectorType{ SchemeCell(name), value });
+			};
+			return SchemeCell(VectorType{
+				entry("collections", (IntegerType)stats.Collections),
+				entry("allocated", (IntegerType)stats.Allocated),
+				entry("freed", (IntegerType)stats.Freed),
+				entry("live", (IntegerType)stats.Live),
+				entry("last-freed", (IntegerType)stats.LastFreed),
+				entry("peak-live", (IntegerType)stats.PeakLive),
+				entry("total-pause-ms", (FloatType)stats.TotalPauseMs),
+				entry("max-pause-ms", (FloatType)stats.MaxPauseMs)
+			});
+		}
+
+		SchemeCell SchemeRuntime::proc_heap_census(const VectorType &args) {
+			if (!args.empty())
+				SchemeHeap::Track(args[0] != SchemeConstants::False);
+			SchemeHeapCensus census = SchemeHeap::Census();
+			auto entry = [](const std::string &name, SchemeCell value) {
+				return SchemeCell(VectorType{ SchemeCell(name), value });
+			};
+			VectorType types;
+			for (size_t type = 0; type < SchemeHeapCensus::CellTypes; ++type) {
+				const SchemeHeapCensus::Cells &cells = census.ByType[type];
+				if (cells.PeakLive == 0 && cells.Allocated == 0)
+					continue;
+				std::string name = CellTypeToString((CellType)type);
+				for (auto it = name.begin(); it != name.end(); ++it)
+					*it = (char)std::tolower((unsigned char)*it);
+				VectorType counts{ SchemeCell(name), entry("live", (IntegerType)cells.Live), entry("peak-live", (IntegerType)cells.PeakLive) };
+				if (census.Tracking)
+					counts.push_back(entry("allocated", (IntegerType)cells.Allocated));
+				counts.push_back(entry("string-bytes", (IntegerType)cells.StringBytes));
+				counts.push_back(entry("list-bytes", (IntegerType)cells.ListBytes));
+				types.push_back(SchemeCell(counts));
+			}
+			return SchemeCell(VectorType{
+				entry("environments", (IntegerType)census.Environments),
+				entry("peak-environments", (IntegerType)census.PeakEnvironments),
+				entry("slots", (IntegerType)census.Slots),
+				entry("map-entries", (IntegerType)census.MapEntries),
+				entry("largest-map", (IntegerType)census.LargestMap),
+				entry("environment-bytes", (IntegerType)census.EnvironmentBytes),
+				entry("pairs", (IntegerType)census.Pairs),
+				entry("bytes", (IntegerType)census.Bytes),
+				entry("peak-bytes", (IntegerType)census.PeakBytes),
+				entry("tracking", census.Tracking ? SchemeConstants::True : SchemeConstants::False),
+				entry("cells", SchemeCell(types))
+			});
+		}
+
+		void SchemeRuntime::AddGlobals(EnvironmentType _env) {
+			SchemeEnvironment &env = *_env;
+			env["nil"] = SchemeConstants::Nil;
+			env["#f"] = SchemeConstants::False;
+			env["#t"] = SchemeConstants::True;
+			env["<"] = proc_less; env["<="] = proc_less_equal;
+			env[">"] = proc_greater;
+			env["="] = proc_equal; env["=="] = proc_equal;
+			env["!"] = proc_not; env["!="] = proc_not_equal;
+			env["+"] = proc_add; env["-"] = proc_sub;
+			env["*"] = proc_mul; env["/"] = proc_div;
+			// List functions
+			env["length"] = proc_length; env["null?"] = proc_nullp;
+			env["head"] = proc_head; env["tail"] = proc_tail;
+			env["append"] = proc_append; env["cons"] = proc_cons;
+			env["list"] = proc_list;
+			// IO functions
+			env["print"] = proc_print; env["expr"] = proc_expr;
+			env["open-input-file"] = SchemePorts::proc_open_input_file; env["open-input-pipe"] = SchemePorts::proc_open_input_pipe;
+			env["read-line"] = SchemePorts::proc_read_line; env["read-all"] = SchemePorts::proc_read_all;
+			env["close-port"] = SchemePorts::proc_close_port; env["sleep"] = SchemePorts::proc_sleep;
+			// Memory functions
+			env["gc"] = proc_gc; env["heap-census"] = proc_heap_census;
+			// Process functions
+			env["spawn"] = SchemeProcess::proc_spawn; env["send"] = SchemeProcess::proc_send;
+			env["receive"] = SchemeProcess::proc_receive; env["self"] = SchemeProcess::proc_self;
+			// Parallel functions
+			env["future"] = SchemeFuture::proc_future; env["touch"] = SchemeFuture::proc_touch;
+			env["pmap"] = SchemeFuture::proc_pmap; env["preduce"] = SchemeFuture::proc_preduce;
+			// Profiling functions
+			env["profile-start"] = SchemeProfiler::proc_profile_start; env["profile-stop"] = SchemeProfiler::proc_profile_stop;
+			env["profile"] = SchemeProfiler::Macro(_env);
+			env["runtime-stats"] = SchemeStats::proc_runtime_stats;
+			SchemeStats::AddPrimitives(_env);
+		}
+	}
+}
@@ -31,6 +31,10 @@ namespace SchemingPlusPlus {
 			// IO functions
 			static SchemeCell proc_print(const VectorType &args);
 			static SchemeCell proc_expr(const VectorType &args);
+			// Memory functions
+			static SchemeCell proc_gc(const VectorType &args);
+			// (heap-census [track]): see SchemeHeap::Census; track turns allocation tracking on or off first
+			static SchemeCell proc_heap_census(const VectorType &args);
 
 			static bool IsBasicType(CellType type);
 			static bool CanCoerce(CellType from, CellType to);
@@ -0,0 +1,215 @@
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "SchemeCell.h"
+#include "SchemeEnvironment.h"
+#include "SchemeStats.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		namespace {
+			// The counters of every thread that has counted anything
+			struct Blocks {
+				std::mutex lock;
+				std::vector<std::unique_ptr<SchemeCounters>> all;
+			};
+
+			Blocks &GetBlocks() {
+				// Never destroyed: threads may still count as statics are
+				static Blocks *blocks = new Blocks();
+				return *blocks;
+			}
+
+			// The builtins of the globals by function, hashed open to their
+			// index and name. Made once, and never changed after.
+			struct PrimitiveTable {
+				static const size_t Slots = 512;
+				struct Slot {
+					const void *proc = nullptr;
+					size_t index = 0;
+				};
+				Slot slots[Slots];
+				std::vector<std::string> names;
+
+				static size_t Hash(const void *proc) {
+					uintptr_t bits = (uintptr_t)proc;
+					return (size_t)((bits >> 4) ^ (bits >> 13)) % Slots;
+				}
+
+				// The index of proc, or MaxPrimitives if it is not in the table
+				size_t Find(const void *proc) const {
+					for (size_t at = Hash(proc);; at = (at + 1) % Slots) {
+						if (slots[at].proc == proc)
+							return slots[at].index;
+						if (slots[at].proc == nullptr)
+							return SchemeCounters::MaxPrimitives;
+					}
+				}
+			};
+
+			std::atomic<const PrimitiveTable*> primitives{ nullptr };
+
+			const char *SpecialFormNames[SchemeCounters::SPECIAL_FORMS] = {
+				"quote", "if", "set!", "define", "lambda", "macro", "begin"
+			};
+
+			// Every thread's counts, summed
+			struct Sums {
+				uint64_t primitives[SchemeCounters::MaxPrimitives + 1] = {};
+				uint64_t special_forms[SchemeCounters::SPECIAL_FORMS] = {};
+				uint64_t environments = 0;
+				uint64_t copies = 0;
+				uint64_t lookups[SchemeCounters::LookupDepths] = {};
+			};
+
+			Sums Sum() {
+				Sums sums;
+				Blocks &blocks = GetBlocks();
+				std::lock_guard<std::mutex> guard(blocks.lock);
+				for (auto it = blocks.all.cbegin(); it != blocks.all.cend(); ++it) {
+					const SchemeCounters &counters = **it;
+					for (size_t i = 0; i <= SchemeCounters::MaxPrimitives; ++i)
+						sums.primitives[i] += counters.Primitives[i].Get();
+					for (size_t i = 0; i < SchemeCounters::SPECIAL_FORMS; ++i)
+						sums.special_forms[i] += counters.SpecialForms[i].Get();
+					sums.environments += counters.Environments.Get();
+					sums.copies += counters.Copies.Get();
+					for (size_t i = 0; i < SchemeCounters::LookupDepths; ++i)
+						sums.lookups[i] += counters.Lookups[i].Get();
+				}
+				return sums;
+			}
+
+			// Builtins called, most first: those outside the table as "other"
+			std::vector<std::pair<std::string, uint64_t>> PrimitiveCalls(const Sums &sums) {
+				std::vector<std::pair<std::string, uint64_t>> calls;
+				const PrimitiveTable *table = primitives.load(std::memory_order_acquire);
+				for (size_t i = 0; i <= SchemeCounters::MaxPrimitives; ++i) {
+					if (sums.primitives[i] == 0)
+						continue;
+					bool named = table != nullptr && i < table->names.size();
+					calls.emplace_back(named ? table->names[i] : std::string("other"), sums.primitives[i]);
+				}
+				std::stable_sort(calls.begin(), calls.end(), [](const std::pair<std::string, uint64_t> &a, const std::pair<std::string, uint64_t> &b) {
+					return a.second > b.second;
+				});
+				return calls;
+			}
+
+			std::string DepthName(size_t depth) {
+				std::string name = std::to_string(depth);
+				return depth + 1 == SchemeCounters::LookupDepths ? name + "+" : name;
+			}
+		}
+
+		std::atomic<bool> SchemeStats::tracking_cells{ false };
+
+		SchemeCounters *SchemeStats::Attach() {
+			Blocks &blocks = GetBlocks();
+			std::lock_guard<std::mutex> guard(blocks.lock);
+			blocks.all.push_back(std::make_unique<SchemeCounters>());
+			return blocks.all.back().get();
+		}
+
+		uint64_t SchemeStats::CellsMade(CellType type) {
+			uint64_t made = 0;
+			Blocks &blocks = GetBlocks();
+			std::lock_guard<std::mutex> guard(blocks.lock);
+			for (auto it = blocks.all.cbegin(); it != blocks.all.cend(); ++it)
+				made += (*it)->CellsMade[type].Get();
+			return made;
+		}
+
+		void SchemeStats::Primitive(const void *proc) {
+			const PrimitiveTable *table = primitives.load(std::memory_order_acquire);
+			Local().Primitives[table == nullptr ? SchemeCounters::MaxPrimitives : table->Find(proc)].Bump();
+		}
+
+		void SchemeStats::AddPrimitives(EnvironmentType globals) {
+			static std::once_flag added;
+			std::call_once(added, [globals] {
+				// Each builtin once, by the shortest of its names
+				std::vector<std::pair<const void*, std::string>> found;
+				for (auto it = globals->_map.cbegin(); it != globals->_map.cend(); ++it) {
+					const void *proc;
+					if (it->second.Type == PROC)
+						proc = (const void*)it->second.ProcValue;
+					else if (it->second.Type == PROCENV)
+						proc = (const void*)it->second.ProcEnvValue;
+					else
+						continue;
+					found.emplace_back(proc, SchemeSymbols::Name(it->first));
+				}
+				std::sort(found.begin(), found.end(), [](const std::pair<const void*, std::string> &a, const std::pair<const void*, std::string> &b) {
+					if (a.second.size() != b.second.size())
+						return a.second.size() < b.second.size();
+					return a.second < b.second;
+				});
+				PrimitiveTable *table = new PrimitiveTable();
+				for (auto it = found.cbegin(); it != found.cend() && table->names.size() < SchemeCounters::MaxPrimitives; ++it) {
+					if (table->Find(it->first) != SchemeCounters::MaxPrimitives)
+						continue;
+					size_t at = PrimitiveTable::Hash(it->first);
+					while (table->slots[at].proc != nullptr)
+						at = (at + 1) % PrimitiveTable::Slots;
+					table->slots[at].proc = it->first;
+					table->slots[at].index = table->names.size();
+					table->names.push_back(it->second);
+				}
+				primitives.store(table, std::memory_order_release);
+			});
+		}
+
+		SchemeCell SchemeStats::Totals() {
+			Sums sums = Sum();
+			auto entry = [](const std::string &name, SchemeCell value) {
+				return SchemeCell(VectorType{ SchemeCell(name), value });
+			};
+			VectorType calls;
+			std::vector<std::pair<std::string, uint64_t>> primitive_calls = PrimitiveCalls(sums);
+			for (auto it = primitive_calls.cbegin(); it != primitive_calls.cend(); ++it)
+				calls.push_back(entry(it->first, (IntegerType)it->second));
+			VectorType forms;
+			for (size_t i = 0; i < SchemeCounters::SPECIAL_FORMS; ++i)
+				forms.push_back(entry(SpecialFormNames[i], (IntegerType)sums.special_forms[i]));
+			VectorType lookups;
+			for (size_t i = 0; i < SchemeCounters::LookupDepths; ++i) {
+				SchemeCell depth = i + 1 == SchemeCounters::LookupDepths ? SchemeCell(DepthName(i)) : SchemeCell((IntegerType)i);
+				lookups.push_back(SchemeCell(VectorType{ depth, SchemeCell((IntegerType)sums.lookups[i]) }));
+			}
+			return SchemeCell(VectorType{
+				entry("primitives", SchemeCell(calls)),
+				entry("special-forms", SchemeCell(forms)),
+				entry("environments", (IntegerType)sums.environments),
+				entry("copies", (IntegerType)sums.copies),
+				entry("lookups", SchemeCell(lookups))
+			});
+		}
+
+		std::string SchemeStats::Report() {
+			Sums sums = Sum();
+			std::ostringstream text;
+			text << "Runtime statistics" << std::endl;
+			text << "  environments " << sums.environments << ", copies " << sums.copies << std::endl;
+			text << "  special forms:";
+			for (size_t i = 0; i < SchemeCounters::SPECIAL_FORMS; ++i)
+				text << " " << SpecialFormNames[i] << " " << sums.special_forms[i];
+			text << std::endl << "  lookups by depth:";
+			for (size_t i = 0; i < SchemeCounters::LookupDepths; ++i)
+				text << " " << DepthName(i) << ": " << sums.lookups[i];
+			text << std::endl << "  primitive calls:" << std::endl;
+			std::vector<std::pair<std::string, uint64_t>> calls = PrimitiveCalls(sums);
+			for (auto it = calls.cbegin(); it != calls.cend(); ++it)
+				text << "    " << it->first << " " << it->second << std::endl;
+			return text.str();
+		}
+
+		SchemeCell SchemeStats::proc_runtime_stats(const VectorType &) {
+			return Totals();
+		}
+	}
+}
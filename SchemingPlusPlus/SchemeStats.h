@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "Scheme.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		// Counters of what the runtime does, always kept. Each thread counts into
+		// a block of its own, so counting takes no lock and shares no cache line;
+		// blocks outlive their threads, and reading them sums them all.
+		struct SchemeCounters {
+			// Counted by one thread, read by any: relaxed, so an increment is a plain add
+			struct Counter {
+				std::atomic<uint64_t> Value{ 0 };
+				void Bump() { Value.store(Value.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+				uint64_t Get() const { return Value.load(std::memory_order_relaxed); }
+			};
+
+			// Builtins beyond this many are counted as one, with those not added by AddGlobals
+			static const size_t MaxPrimitives = 128;
+			// Lookups this many frames out or further share the last count
+			static const size_t LookupDepths = 8;
+			enum Forms { QUOTE, IF, SET, DEFINE, LAMBDA, MACRO, BEGIN, SPECIAL_FORMS };
+
+			Counter Primitives[MaxPrimitives + 1];  // calls, by the index SchemeStats gives each builtin
+			Counter SpecialForms[SPECIAL_FORMS];    // evaluations
+			Counter Environments;                   // frames allocated
+			Counter Copies;                         // SchemeCell copies; moves are not counted
+			Counter Lookups[LookupDepths];          // symbols resolved, by frames walked out
+			Counter CellsMade[ENVPTR + 1];          // made with a value, by type, while tracking (see SchemeHeap::Track)
+		};
+
+		// Where the counters are counted. Calls of builtins are counted by the
+		// evaluators, special forms as they are evaluated: the vm evaluator
+		// compiles quote and begin away, so counts neither. Frames are counted
+		// by SchemeHeap, lookups by SchemeEnvironment, copies by SchemeCell.
+		struct SchemeStats {
+			// This thread's counters
+			static SchemeCounters &Local() {
+				thread_local SchemeCounters *local = nullptr;
+				if (local == nullptr)
+					local = Attach();
+				return *local;
+			}
+
+			// A call of the builtin whose function is proc
+			static void Primitive(const void *proc);
+			static void SpecialForm(SchemeCounters::Forms kind) { Local().SpecialForms[kind].Bump(); }
+			static void Environment() { Local().Environments.Bump(); }
+			static void Copy() { Local().Copies.Bump(); }
+			// A symbol found depth frames out from where it was looked up
+			static void Lookup(size_t depth) { Local().Lookups[depth < SchemeCounters::LookupDepths ? depth : SchemeCounters::LookupDepths - 1].Bump(); }
+			static bool TrackingCells() { return tracking_cells.load(std::memory_order_relaxed); }
+			static void TrackCells(bool tracking) { tracking_cells = tracking; }
+			static void CellMade(CellType type) { Local().CellsMade[type].Bump(); }
+			// Cells of type made while tracking, on every thread
+			static uint64_t CellsMade(CellType type);
+
+			// Name the builtins of globals, made by SchemeRuntime::AddGlobals.
+			// Only the first call does anything: every set of globals has the same.
+			static void AddPrimitives(EnvironmentType globals);
+
+			// Every thread's counts summed, as an association list:
+			// ((primitives ((name calls)...)) (special-forms ((if n)...))
+			//  (environments n) (copies n) (lookups ((0 n) (1 n)... (7+ n))))
+			static SchemeCell Totals();
+			// The same, as text, for standard error on exit
+			static std::string Report();
+
+			// (runtime-stats): Totals
+			static SchemeCell proc_runtime_stats(const VectorType &args);
+		private:
+			static std::atomic<bool> tracking_cells;
+			static SchemeCounters *Attach();
+		};
+	}
+}
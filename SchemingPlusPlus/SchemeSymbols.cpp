@@ -0,0 +1,87 @@
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "SchemeCell.h"
+#include "SchemeSymbols.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		namespace {
+			// Shared by every thread. Readers share the lock; interning a new name takes it alone.
+			struct SymbolTable {
+				std::shared_mutex lock;
+				std::unordered_map<std::string, AtomType> ids;
+				// deque: names never move once interned
+				std::deque<std::string> names;
+
+				SymbolTable() {
+					// Order must match KnownAtoms
+					const char *known[] = {
+						"", "#nil", "#true",
+						"quote", "if", "set!", "define", "lambda", "macro", "begin"
+					};
+					static_assert(sizeof(known) / sizeof(known[0]) == ATOM_KNOWN_COUNT,
+						"KnownAtoms and the known symbol names are out of step");
+					for (const char *name : known)
+						Add(name);
+				}
+
+				// Call with the lock held alone
+				AtomType Add(const std::string &name) {
+					auto found = ids.find(name);
+					if (found != ids.end())
+						return found->second; // interned by another thread meanwhile
+					AtomType atom = (AtomType)names.size();
+					names.push_back(name);
+					ids.emplace(name, atom);
+					return atom;
+				}
+			};
+
+			// Function local so that static SchemeCells (SchemeConstants) can intern safely
+			SymbolTable &Table() {
+				static SymbolTable table;
+				return table;
+			}
+		}
+
+		AtomType SchemeSymbols::Intern(const std::string &name) {
+			// Each thread remembers the atoms it has seen, so that only a name new
+			// to this thread touches the shared table
+			thread_local std::unordered_map<std::string, AtomType> seen;
+			auto it = seen.find(name);
+			if (it != seen.end())
+				return it->second;
+
+			SymbolTable &table = Table();
+			AtomType atom;
+			{
+				std::shared_lock<std::shared_mutex> read(table.lock);
+				auto found = table.ids.find(name);
+				atom = found != table.ids.end() ? found->second : ATOM_NONE;
+			}
+			if (atom == ATOM_NONE && !name.empty()) {
+				std::unique_lock<std::shared_mutex> write(table.lock);
+				atom = table.Add(name);
+			}
+			seen.emplace(name, atom);
+			return atom;
+		}
+
+		const std::string &SchemeSymbols::Name(AtomType atom) SCHEME_THROW {
+			SymbolTable &table = Table();
+			std::shared_lock<std::shared_mutex> read(table.lock);
+			if (atom >= table.names.size())
+				throw critical_error(CRIT_SYMBOL_NOT_FOUND, "atom " + std::to_string(atom));
+			return table.names[atom];
+		}
+
+		size_t SchemeSymbols::Count() {
+			SymbolTable &table = Table();
+			std::shared_lock<std::shared_mutex> read(table.lock);
+			return table.names.size();
+		}
+	}
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+
+#include "Scheme.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		// Atoms interned before anything else, so their IDs are fixed and can be
+		// used directly in switch statements.
+		enum KnownAtoms : AtomType {
+			ATOM_NONE,    // Not a symbol
+			ATOM_NIL,     // #nil
+			ATOM_TRUE,    // #true
+			ATOM_QUOTE,
+			ATOM_IF,
+			ATOM_SET,     // set!
+			ATOM_DEFINE,
+			ATOM_LAMBDA,
+			ATOM_MACRO,
+			ATOM_BEGIN,
+			ATOM_KNOWN_COUNT
+		};
+
+		// Global symbol interning table. Every distinct symbol name maps to one
+		// AtomType, so symbols compare and hash as integers. Shared by all threads
+		// and isolates; each thread caches the atoms it has looked up.
+		struct SchemeSymbols {
+			// Get the atom for the given name, creating it if it does not exist.
+			static AtomType Intern(const std::string &name);
+			// Get the name of an interned atom.
+			static const std::string &Name(AtomType atom) SCHEME_THROW;
+			// Number of atoms interned so far.
+			static size_t Count();
+		};
+	}
+}
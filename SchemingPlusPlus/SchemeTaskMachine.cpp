@@ -0,0 +1,80 @@
+#include "SchemeLexical.h"
+#include "SchemeTaskMachine.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		SchemeTaskMachine::SchemeTaskMachine(size_t iterations)
+			: _iterations(iterations),
+			  _root(this, [](const void *value, SchemeMarker &marker) {
+				const SchemeTaskMachine &machine = *static_cast<const SchemeTaskMachine*>(value);
+				for (auto it = machine._tasks.cbegin(); it != machine._tasks.cend(); ++it)
+					(*it)->State.Mark(marker);
+			  }) {
+		}
+
+		uint32_t SchemeTaskMachine::Spawn(const SchemeCell &item, EnvironmentType env, const std::string &title, int priority) {
+			runtime_assert(env != nullptr);
+			SchemeCell x = item;
+			SchemeLexical::Resolve(x);
+			uint32_t task_id = ++_task_id_counter;
+			std::string name = title.empty() ? std::to_string(task_id) + ".FrameTask" : title;
+			_tasks.push_back(std::make_unique<SchemeTask>(task_id, name, priority, std::move(x), env));
+			++_stats.Spawned;
+			return task_id;
+		}
+
+		bool SchemeTaskMachine::RunTasks() {
+			// Offer each task its turn at most once; a turn it does not take
+			// counts it down toward PRI_RUN
+			for (size_t offered = _tasks.size(); offered > 0; --offered) {
+				std::unique_ptr<SchemeTask> task = std::move(_tasks.front());
+				_tasks.pop_front();
+				// Levels at or past PRI_RUN, as PRI_HIGHEST is, count no further
+				if (task->PriorityLevel > SchemeTask::PRI_RUN)
+					--task->PriorityLevel;
+				if (task->PriorityLevel > SchemeTask::PRI_RUN) {
+					_tasks.push_back(std::move(task));
+					continue;
+				}
+				task->PriorityLevel = task->Priority;
+
+				++_stats.Slices;
+				// The task is off the queue while it runs: keep it marked
+				SchemeHeap::Root task_root(&task->State, [](const void *value, SchemeMarker &marker) {
+					static_cast<const SchemeFrameState*>(value)->Mark(marker);
+				});
+				try {
+					if (!task->State.Run(_iterations))
+						++_stats.Preempted;
+				} catch (critical_error &ce) {
+					task->Failed = true;
+					task->Error = ce.what();
+				}
+				if (!task->Finished()) {
+					_tasks.push_back(std::move(task));
+					return true;
+				}
+				++_stats.Completed;
+				if (task->Failed)
+					++_stats.Failed;
+				if (OnComplete)
+					OnComplete(*task);
+				return true;
+			}
+			return false;
+		}
+
+		bool SchemeTaskMachine::Runnable() const {
+			for (auto it = _tasks.cbegin(); it != _tasks.cend(); ++it)
+				if ((*it)->Priority != SchemeTask::PRI_IDLE)
+					return true;
+			return false;
+		}
+
+		void SchemeTaskMachine::Loop() {
+			// A round where no task runs may only be priorities counting down
+			while (RunTasks() || Runnable())
+				;
+		}
+	}
+}
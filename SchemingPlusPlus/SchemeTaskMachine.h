@@ -0,0 +1,85 @@
+#pragma once
+
+#include <climits>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "SchemeCell.h"
+#include "SchemeEvalFrame.h"
+#include "SchemeHeap.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		// One evaluation scheduled by SchemeTaskMachine: a SchemeFrameState run a
+		// slice at a time.
+		struct SchemeTask {
+			static const int PRI_DEFAULT = 20;
+			static const int PRI_IDLE = INT_MAX;
+			static const int PRI_RUN = -20;
+			static const int PRI_HIGHEST = INT_MIN;
+
+			uint32_t TaskId;
+			std::string Title;
+			// Lower runs more often: a task runs once for every Priority - PRI_RUN + 1 turns it is offered
+			int Priority;
+			int PriorityLevel;
+			SchemeFrameState State;
+			// Finished by an error rather than a value
+			bool Failed = false;
+			std::string Error;
+
+			SchemeTask(uint32_t task_id, const std::string &title, int priority, SchemeCell item, EnvironmentType env)
+				: TaskId(task_id), Title(title), Priority(priority), PriorityLevel(priority), State(std::move(item), env) { }
+
+			bool Finished() const { return Failed || State.Finished(); }
+			const SchemeCell &Result() const { return State.Result(); }
+		};
+
+		struct SchemeTaskMachineStats {
+			size_t Spawned = 0;
+			size_t Completed = 0;
+			size_t Failed = 0;
+			size_t Slices = 0;        // turns a task has run for
+			size_t Preempted = 0;     // slices that ended with the budget spent
+		};
+
+		// Runs many evaluations in turn on one thread. Each runs for a budget of
+		// Iterations steps (expressions evaluated), then yields to the next.
+		// Priorities follow the C# TaskMachine.
+		//
+		// The machine is a root for everything its tasks hold, and like any
+		// SchemeHeap::Root it must only be declared as a local.
+		class SchemeTaskMachine {
+		public:
+			static const size_t Iterations = 100;
+
+			explicit SchemeTaskMachine(size_t iterations = Iterations);
+			SchemeTaskMachine(const SchemeTaskMachine &) = delete;
+			SchemeTaskMachine &operator = (const SchemeTaskMachine &) = delete;
+
+			// Start evaluating item in env. Returns the new task's id.
+			uint32_t Spawn(const SchemeCell &item, EnvironmentType env, const std::string &title = "", int priority = SchemeTask::PRI_DEFAULT);
+			// Run one slice of the next task whose turn it is. False if no task could run.
+			bool RunTasks();
+			// Run until no task can run: all have finished, or all are idle
+			void Loop();
+			// A task is not idle, so will run once its priority comes round
+			bool Runnable() const;
+
+			size_t Count() const { return _tasks.size(); }
+			const SchemeTaskMachineStats &Stats() const { return _stats; }
+
+			// Called with each task as it finishes, before it is removed
+			std::function<void(const SchemeTask &)> OnComplete;
+		private:
+			size_t _iterations;
+			uint32_t _task_id_counter = 0;
+			// Run queue: the task at the front has the next turn
+			std::deque<std::unique_ptr<SchemeTask>> _tasks;
+			SchemeTaskMachineStats _stats;
+			SchemeHeap::Root _root;
+		};
+	}
+}
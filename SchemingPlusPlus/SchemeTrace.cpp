@@ -0,0 +1,320 @@
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+
+#include "SchemeAssert.h"
+#include "SchemeEnvironment.h"
+#include "SchemeProfiler.h"
+#include "SchemeTrace.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		std::atomic<bool> SchemeTrace::active{ false };
+		std::atomic<bool> SchemeTrace::following{ false };
+
+		namespace {
+			typedef SchemeTrace::Clock Clock;
+
+			struct Event {
+				std::string name;
+				const char *category;
+				Clock::time_point start, end;
+				uint32_t thread;
+				const char *arg_key;
+				int64_t arg;
+			};
+
+			// The chosen procedures by key, and the names they were chosen by
+			typedef std::unordered_map<const void*, std::string> CallTable;
+
+			struct Trace {
+				std::mutex lock;
+				std::vector<Event> events;
+				Clock::time_point origin;
+				SchemeTrace::Options options;
+				std::vector<AtomType> calls;
+				// Replaced whole as procedures are found, and never freed: a thread
+				// may still be reading one as the trace stops
+				std::vector<std::unique_ptr<CallTable>> tables;
+				std::atomic<const CallTable*> table{ nullptr };
+				// The options spans are filtered by, read without the lock
+				std::atomic<uint64_t> min_micros{ 0 };
+				std::atomic<unsigned> every{ 1 };
+				std::atomic<uint64_t> forms{ 0 };
+				std::atomic<uint32_t> generation{ 0 };
+				std::atomic<uint32_t> threads{ 0 };
+			};
+
+			Trace &GetTrace() {
+				// Never destroyed: threads may still trace as statics are
+				static Trace *trace = new Trace();
+				return *trace;
+			}
+
+			// Top level forms not traced that this thread is evaluating
+			thread_local unsigned skipping = 0;
+
+			uint32_t ThreadId() {
+				thread_local uint32_t id = GetTrace().threads.fetch_add(1) + 1;
+				return id;
+			}
+
+			// Calls of chosen procedures this thread has open, outermost first
+			struct OpenCall {
+				size_t depth;
+				const void *key;
+				Clock::time_point start;
+			};
+			struct OpenCalls {
+				uint32_t generation = 0;
+				std::vector<OpenCall> calls;
+			};
+
+			OpenCalls &GetOpenCalls() {
+				thread_local OpenCalls open;
+				uint32_t generation = GetTrace().generation.load(std::memory_order_relaxed);
+				if (open.generation != generation) {
+					open.calls.clear();
+					open.generation = generation;
+				}
+				return open;
+			}
+
+			std::string JsonString(const std::string &text) {
+				std::string quoted = "\"";
+				for (char c : text) {
+					if (c == '"' || c == '\\') {
+						quoted += '\\';
+						quoted += c;
+					} else if ((unsigned char)c < 0x20) {
+						std::ostringstream escape;
+						escape << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c;
+						quoted += escape.str();
+					} else {
+						quoted += c;
+					}
+				}
+				return quoted + "\"";
+			}
+
+			// The first line of what named prints, shortened to fit a timeline
+			std::string SpanName(const SchemeCell &named) {
+				std::string text = named.ToString(true);
+				size_t newline = text.find('\n');
+				if (newline != std::string::npos)
+					text = text.substr(0, newline) + "...";
+				if (text.size() > 64)
+					text = text.substr(0, 61) + "...";
+				return text;
+			}
+
+			double Micros(Clock::duration duration) {
+				return std::chrono::duration<double, std::micro>(duration).count();
+			}
+
+			// The value of option name=value, which must be all digits
+			uint64_t Number(const std::string &option, const std::string &value) SCHEME_THROW {
+				char *end = nullptr;
+				errno = 0;
+				uint64_t number = std::strtoull(value.c_str(), &end, 10);
+				if (!std::isdigit((unsigned char)value[0]) || *end != '\0' || errno == ERANGE)
+					throw critical_error(CRIT_OP_INVALID, "trace option " + option + " is not a number");
+				return number;
+			}
+		}
+
+		SchemeTrace::Options SchemeTrace::Options::Parse(const std::string &spec) SCHEME_THROW {
+			Options options;
+			std::vector<std::string> parts;
+			std::istringstream in(spec);
+			for (std::string part; std::getline(in, part, ',');)
+				parts.push_back(part);
+			if (parts.empty() || parts[0].empty())
+				throw critical_error(CRIT_OP_INVALID, "no trace file in " + spec);
+			options.File = parts[0];
+			for (auto it = parts.cbegin() + 1; it != parts.cend(); ++it) {
+				size_t equals = it->find('=');
+				std::string key = it->substr(0, equals), value = equals == std::string::npos ? "" : it->substr(equals + 1);
+				if (value.empty())
+					throw critical_error(CRIT_OP_INVALID, "trace option " + *it + " has no value");
+				if (key == "min") {
+					options.MinMicros = Number(*it, value);
+				} else if (key == "every") {
+					uint64_t every = Number(*it, value);
+					if (every == 0 || every > std::numeric_limits<unsigned>::max())
+						throw critical_error(CRIT_OP_INVALID, "trace option " + *it + " must be from 1 to " + std::to_string(std::numeric_limits<unsigned>::max()));
+					options.Every = (unsigned)every;
+				} else if (key == "call") {
+					options.Calls.push_back(value);
+				} else {
+					throw critical_error(CRIT_OP_INVALID, "unknown trace option " + *it);
+				}
+			}
+			return options;
+		}
+
+		SchemeTrace::Span::Span(const char *category, const char *name, const SchemeCell *named)
+			: _category(category), _name(name), _named(named), _on(Recording()) {
+			if (_on)
+				_start = Clock::now();
+		}
+
+		SchemeTrace::Span::~Span() {
+			if (!_on || !Active())
+				return;
+			Clock::time_point end = Clock::now();
+			if (Micros(end - _start) < (double)GetTrace().min_micros.load(std::memory_order_relaxed))
+				return;
+			std::string name = _named != nullptr ? SpanName(*_named)
+				: _atom != ATOM_NONE ? SchemeSymbols::Name(_atom)
+				: std::string(_name);
+			Record(_category, std::move(name), _start, end, _arg_key, _arg);
+		}
+
+		SchemeTrace::Form::Form(const SchemeCell &form, EnvironmentType env)
+			: _skipped(Sample(env)), _span("form", form) {
+		}
+
+		SchemeTrace::Form::~Form() {
+			if (_skipped)
+				--skipping;
+		}
+
+		bool SchemeTrace::Sample(EnvironmentType env) {
+			if (!Active())
+				return false;
+			Trace &trace = GetTrace();
+			if (trace.forms.fetch_add(1, std::memory_order_relaxed) % trace.every.load(std::memory_order_relaxed) != 0) {
+				++skipping;
+				return true;
+			}
+			if (Following())
+				Choose(env);
+			return false;
+		}
+
+		bool SchemeTrace::Recording() {
+			return Active() && skipping == 0;
+		}
+
+		void SchemeTrace::Record(const char *category, std::string name, Clock::time_point start, Clock::time_point end, const char *arg_key, int64_t arg) {
+			uint32_t thread = ThreadId();
+			Trace &trace = GetTrace();
+			std::lock_guard<std::mutex> guard(trace.lock);
+			if (Active())
+				trace.events.push_back(Event{ std::move(name), category, start, end, thread, arg_key, arg });
+		}
+
+		void SchemeTrace::Choose(EnvironmentType env) {
+			Trace &trace = GetTrace();
+			std::lock_guard<std::mutex> guard(trace.lock);
+			const CallTable *table = trace.table.load(std::memory_order_relaxed);
+			std::unique_ptr<CallTable> chosen;
+			for (size_t i = 0; i < trace.calls.size(); ++i) {
+				const SchemeCell *binding = static_cast<const SchemeEnvironment&>(*env).Resolve(trace.calls[i]);
+				const void *key = binding == nullptr ? nullptr : SchemeProfiler::Key(*binding);
+				if (key == nullptr || (chosen ? chosen->count(key) : table->count(key)) != 0)
+					continue;
+				if (!chosen)
+					chosen = std::make_unique<CallTable>(*table);
+				chosen->emplace(key, trace.options.Calls[i]);
+			}
+			if (chosen) {
+				trace.table.store(chosen.get(), std::memory_order_release);
+				trace.tables.push_back(std::move(chosen));
+			}
+		}
+
+		void SchemeTrace::Enter(const void *key, size_t depth) {
+			if (skipping != 0)
+				return;
+			const CallTable *table = GetTrace().table.load(std::memory_order_acquire);
+			if (table == nullptr || table->count(key) == 0)
+				return;
+			OpenCalls &open = GetOpenCalls();
+			// A tail call in place of a call being traced is part of it
+			if (!open.calls.empty() && open.calls.back().depth >= depth)
+				return;
+			open.calls.push_back(OpenCall{ depth, key, Clock::now() });
+		}
+
+		void SchemeTrace::Leave(size_t depth) {
+			OpenCalls &open = GetOpenCalls();
+			if (open.calls.empty() || open.calls.back().depth < depth)
+				return;
+			Clock::time_point end = Clock::now();
+			const CallTable *table = GetTrace().table.load(std::memory_order_acquire);
+			uint64_t min = GetTrace().min_micros.load(std::memory_order_relaxed);
+			while (!open.calls.empty() && open.calls.back().depth >= depth) {
+				const OpenCall &call = open.calls.back();
+				if (Micros(end - call.start) >= (double)min)
+					Record("call", table->at(call.key), call.start, end, nullptr, 0);
+				open.calls.pop_back();
+			}
+		}
+
+		void SchemeTrace::Start(const Options &options) SCHEME_THROW {
+			runtime_assert(options.Every > 0);
+			Trace &trace = GetTrace();
+			{
+				std::lock_guard<std::mutex> guard(trace.lock);
+				if (Active())
+					throw critical_error(CRIT_OP_INVALID, std::string("a trace is already being taken"));
+				trace.events.clear();
+				trace.options = options;
+				trace.calls.clear();
+				for (auto it = options.Calls.cbegin(); it != options.Calls.cend(); ++it)
+					trace.calls.push_back(SchemeSymbols::Intern(*it));
+				trace.tables.push_back(std::make_unique<CallTable>());
+				trace.table.store(trace.tables.back().get(), std::memory_order_release);
+				trace.min_micros = options.MinMicros;
+				trace.every = options.Every;
+				trace.forms = 0;
+				++trace.generation;
+				trace.origin = Clock::now();
+				active = true;
+			}
+			if (!options.Calls.empty()) {
+				following = true;
+				SchemeProfiler::UseStacks(true);
+			}
+		}
+
+		std::string SchemeTrace::Stop() SCHEME_THROW {
+			Trace &trace = GetTrace();
+			std::vector<Event> events;
+			{
+				std::lock_guard<std::mutex> guard(trace.lock);
+				if (!Active())
+					throw critical_error(CRIT_OP_INVALID, std::string("no trace is being taken"));
+				active = false;
+				events.swap(trace.events);
+			}
+			if (following.exchange(false))
+				SchemeProfiler::UseStacks(false);
+
+			std::ostringstream json;
+			json << "{\"traceEvents\":[" << std::endl;
+			json << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"schemingplusplus\"}}";
+			json << std::fixed << std::setprecision(3);
+			for (auto it = events.cbegin(); it != events.cend(); ++it) {
+				json << "," << std::endl << "{\"name\":" << JsonString(it->name)
+					<< ",\"cat\":\"" << it->category << "\",\"ph\":\"X\""
+					<< ",\"ts\":" << Micros(it->start - trace.origin)
+					<< ",\"dur\":" << Micros(it->end - it->start)
+					<< ",\"pid\":1,\"tid\":" << it->thread;
+				if (it->arg_key != nullptr)
+					json << ",\"args\":{\"" << it->arg_key << "\":" << it->arg << "}";
+				json << "}";
+			}
+			json << std::endl << "],\"displayTimeUnit\":\"ms\"}" << std::endl;
+			return json.str();
+		}
+	}
+}
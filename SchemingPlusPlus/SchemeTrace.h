@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "SchemeCell.h"
+#include "SchemeSymbols.h"
+
+namespace SchemingPlusPlus {
+	namespace Core {
+		// Timeline tracing, written as Chrome trace_event JSON for Perfetto or
+		// about:tracing. While a trace is taken, spans are recorded for each
+		// top level form evaluated, each form parsed, each macro expanded, each
+		// collection of the heap, and each call of the procedures chosen by name.
+		//
+		// To keep the cost down, spans shorter than a minimum duration are
+		// dropped, and only one top level form in every so many is traced, with
+		// everything evaluated inside it. Spans begun outside any top level form,
+		// such as those of processes on threads of their own, are always traced.
+		//
+		// Calls are followed on the shadow stacks the profiler keeps. A call's
+		// span lasts until it returns: tail calls it makes are part of it, and a
+		// tail call to a chosen procedure already being traced opens no new span.
+		// The frame evaluator keeps no call stack of its own, nor runs macros in
+		// one piece, so under it only calls of builtins are traced, and no
+		// expansions.
+		class SchemeTrace {
+		public:
+			typedef std::chrono::steady_clock Clock;
+
+			struct Options {
+				std::string File;                // written by the command line on exit
+				uint64_t MinMicros = 0;          // spans shorter than this are dropped
+				unsigned Every = 1;              // trace one top level form in this many
+				std::vector<std::string> Calls;  // names of the procedures whose calls are traced
+
+				// file[,min=us][,every=n][,call=name]... as given to -T
+				static Options Parse(const std::string &spec) SCHEME_THROW;
+			};
+
+			// A span from construction to destruction, recorded if a trace is
+			// being taken at both ends and the span is long enough
+			class Span {
+			public:
+				// name must outlive the span
+				Span(const char *category, const char *name) : Span(category, name, nullptr) { }
+				// Named by what named prints, at most a line of it; named must outlive the span
+				Span(const char *category, const SchemeCell &named) : Span(category, nullptr, &named) { }
+				// Named by the symbol atom, or by category where it is ATOM_NONE
+				Span(const char *category, AtomType atom) : Span(category, category, nullptr) { _atom = atom; }
+				// The atom a form's operator names, for a span named after it
+				static AtomType Operator(const SchemeCell &form) {
+					const SchemeCell &op = form.ListValue[0];
+					return op.Type == SYMBOL ? op.AtomValue : (AtomType)ATOM_NONE;
+				}
+				~Span();
+				Span(const Span &) = delete;
+				Span &operator = (const Span &) = delete;
+
+				// A number shown with the span
+				void Arg(const char *key, int64_t value) { _arg_key = key; _arg = value; }
+			private:
+				const char *_category;
+				const char *_name;
+				const SchemeCell *_named;
+				AtomType _atom = ATOM_NONE;
+				const char *_arg_key = nullptr;
+				int64_t _arg = 0;
+				bool _on;
+				Clock::time_point _start;
+
+				Span(const char *category, const char *name, const SchemeCell *named);
+			};
+
+			// The evaluation of a top level form in env, where the chosen
+			// procedures are looked up. Whether it is traced is settled here.
+			class Form {
+			public:
+				Form(const SchemeCell &form, EnvironmentType env);
+				~Form();
+				Form(const Form &) = delete;
+				Form &operator = (const Form &) = delete;
+			private:
+				bool _skipped;
+				Span _span;
+			};
+
+			static bool Active() { return active.load(std::memory_order_relaxed); }
+			// Whether calls are followed: see SchemeProfiler
+			static bool Following() { return following.load(std::memory_order_relaxed); }
+			// Throws if a trace is already being taken
+			static void Start(const Options &options) SCHEME_THROW;
+			// Stop, and return the trace as JSON. Spans still open are not in it.
+			static std::string Stop() SCHEME_THROW;
+
+			// The shadow stack of this thread grew to depth + 1 with the procedure
+			// keyed by key at depth, or shrank to depth
+			static void Enter(const void *key, size_t depth);
+			static void Leave(size_t depth);
+		private:
+			static std::atomic<bool> active;
+			static std::atomic<bool> following;
+
+			// Whether the top level form begun in env is traced: false if skipped
+			static bool Sample(EnvironmentType env);
+			static bool Recording();
+			static void Record(const char *category, std::string name, Clock::time_point start, Clock::time_point end, const char *arg_key, int64_t arg);
+			// Look the chosen procedures up in env, for Enter to know them by key
+			static void Choose(EnvironmentType env);
+		};
+	}
+}
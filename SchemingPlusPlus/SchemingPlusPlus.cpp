@@ -1,7 +1,10 @@
 // SchemingPlusPlus.cpp : This file contains the 'main' function. Program execution begins and ends there.
 //
 
+#include <atomic>
+#include <fstream>
 #include <iostream>
+#include <memory>
 #include <vector>
 
 #include "SchemePlusPlus.h"
@@ -15,8 +18,10 @@ typedef void(*ReplModifier)(ReplState&);
 struct ReplState {
 	bool exit;
 	std::string prompt;
+	std::string continuation; // prompt while a form is incomplete
 
-	ReplState(std::string prompt = "> ") : exit(false), prompt(prompt) {
+	ReplState(std::string prompt = "> ", std::string continuation = "... ")
+		: exit(false), prompt(prompt), continuation(continuation) {
 	}
 };
 
@@ -69,10 +74,15 @@ Core::SchemeCell run_tests(const Core::VectorType &a) {
 	return Core::SchemeConstants::Nil;
 }
 
-void repl(Core::EnvironmentType env) {
+// Evaluate a top level form, as a span of the trace if one is being taken
+Core::SchemeCell eval_form(Core::SchemeEvaluator &evaluator, const Core::SchemeCell &form, const Core::SchemeCell &env_cell) {
+	Core::SchemeTrace::Form trace(form, env_cell.Environment);
+	return evaluator.Eval(form, env_cell);
+}
+
+void repl(Core::EnvironmentType env, Core::SchemeEvaluator &evaluator) {
 	ReplState state;
-	Core::SchemeSimpleEval evaluator;
-	Core::SchemeParser parser;
+	Core::SchemeReader reader;
 	Core::SchemeCell env_cell(env);
 
 	// Add unit tests function
@@ -80,38 +90,221 @@ void repl(Core::EnvironmentType env) {
 
 	invokeCommand("help", state);
 	while(state.exit == false) {
-		std::cout << state.prompt;
-		std::string line; std::getline(std::cin, line);
+		// A form may span lines; each is evaluated as soon as it is complete
+		std::cout << (reader.Pending() ? state.continuation : state.prompt);
+		std::string line;
+		if (!std::getline(std::cin, line)) {
+			std::cout << std::endl;
+			break;
+		}
 		// Check if line is a repl command
-		ReplCommand *cmd = getCommand(line);
+		ReplCommand *cmd = reader.Pending() ? nullptr : getCommand(line);
 		if (cmd != nullptr) {
 			cmd->modifier(state);
-		} else {
-			try {
-				parser.reset(line);
-				Core::SchemeCell read = parser.read();
-				Core::SchemeCell result = evaluator.Eval(read, env_cell);
+			continue;
+		}
+		reader.Feed(line);
+		reader.Feed("\n");
+		try {
+			Core::SchemeCell form;
+			while (reader.Next(form)) {
+				Core::SchemeCell result = eval_form(evaluator, form, env_cell);
 				std::cout << result.ToString() << std::endl;
-			} catch (SchemingPlusPlus::Core::critical_error &ce) {
-				std::cerr << ce.what() << std::endl;
 			}
+		} catch (SchemingPlusPlus::Core::critical_error &ce) {
+			std::cerr << ce.what() << std::endl;
+			reader.Reset();
+		}
+	}
+}
+
+// Evaluate each form of a script as soon as it is read. Stops at the first error.
+bool run_script(const std::string &name, Core::EnvironmentType env, Core::SchemeEvaluator &evaluator, bool cached) {
+	Core::SchemeReader reader;
+	Core::SchemeCell env_cell(env), form;
+	try {
+		if (name == "-") {
+			// Standard input: feed by line, so a pipe is evaluated as it arrives
+			std::string line;
+			for (;;) {
+				while (reader.Next(form))
+					eval_form(evaluator, form, env_cell);
+				if (!std::getline(std::cin, line))
+					break;
+				reader.Feed(line);
+				reader.Feed("\n");
+			}
+			reader.Finish();
+			while (reader.Next(form))
+				eval_form(evaluator, form, env_cell);
+		} else if (cached) {
+			// Parsed forms from the FASL cache beside the file, rebuilt if stale
+			Core::VectorType forms = Core::SchemeFasl::Load(name);
+			for (auto it = forms.cbegin(); it != forms.cend(); ++it)
+				eval_form(evaluator, *it, env_cell);
+		} else {
+			std::ifstream file(name, std::ios::binary);
+			if (!file) {
+				std::cerr << name << ": cannot open file" << std::endl;
+				return false;
+			}
+			while (reader.NextFrom(file, form))
+				eval_form(evaluator, form, env_cell);
 		}
+	} catch (SchemingPlusPlus::Core::critical_error &ce) {
+		std::cerr << name << ": " << ce.what() << std::endl;
+		return false;
 	}
+	return true;
+}
+
+// Run every script at once, each as a task taking turns with the others
+bool run_tasks(const std::vector<std::string> &names, Core::EnvironmentType env, bool cached) {
+	Core::SchemeTaskMachine machine;
+	bool ok = true;
+	machine.OnComplete = [&ok](const Core::SchemeTask &task) {
+		if (task.Failed) {
+			std::cerr << task.Title << ": " << task.Error << std::endl;
+			ok = false;
+		}
+	};
+	for (auto it = names.cbegin(); it != names.cend(); ++it) {
+		Core::VectorType forms{ Core::SchemeCell(std::string("begin")) };
+		try {
+			if (cached && *it != "-") {
+				Core::VectorType body = Core::SchemeFasl::Load(*it);
+				forms.insert(forms.end(), body.cbegin(), body.cend());
+			} else {
+				std::ifstream file;
+				if (*it != "-")
+					file.open(*it, std::ios::binary);
+				std::istream &in = *it == "-" ? std::cin : file;
+				if (!in) {
+					std::cerr << *it << ": cannot open file" << std::endl;
+					return false;
+				}
+				Core::SchemeReader reader;
+				Core::SchemeCell form;
+				while (reader.NextFrom(in, form))
+					forms.push_back(std::move(form));
+			}
+		} catch (SchemingPlusPlus::Core::critical_error &ce) {
+			std::cerr << *it << ": " << ce.what() << std::endl;
+			return false;
+		}
+		if (forms.size() > 1)
+			machine.Spawn(Core::SchemeCell(std::move(forms)), env, *it);
+	}
+	machine.Loop();
+	return ok;
+}
+
+std::unique_ptr<Core::SchemeEvaluator> make_evaluator(const std::string &name) {
+	if (name == "simple") return std::make_unique<Core::SchemeSimpleEval>();
+	if (name == "analyze") return std::make_unique<Core::SchemeAnalyzeEval>();
+	if (name == "vm") return std::make_unique<Core::SchemeVMEval>();
+	if (name == "frame") return std::make_unique<Core::SchemeFrameEval>();
+	return nullptr;
+}
+
+// Run every script at once, each in an isolate of its own, on a thread per core
+bool run_isolates(const std::vector<std::string> &names, const std::string &evaluator_name, bool cached) {
+	std::atomic<bool> ok(true);
+	Core::SchemeExecutor executor;
+	for (auto it = names.cbegin(); it != names.cend(); ++it) {
+		const std::string &name = *it;
+		executor.Submit([&ok, &name, &evaluator_name, cached]() {
+			Core::SchemeIsolate isolate;
+			Core::SchemeIsolate::Scope scope(isolate);
+			std::unique_ptr<Core::SchemeEvaluator> evaluator = make_evaluator(evaluator_name);
+			if (!run_script(name, isolate.Globals(), *evaluator, cached))
+				ok = false;
+		});
+	}
+	executor.Wait();
+	return ok;
 }
 
 struct {
 	bool run_tests = false;
 	bool run_repl = false;
 	bool show_help = false;
+	bool use_cache = false;
+	bool multitask = false;
+	bool parallel = false;
+	bool show_stats = false;
+	bool show_census = false;
+	bool bad_usage = false; // an option not understood: run nothing
+	std::string load_image;
+	std::string save_image;
+	std::string profile;
+	Core::SchemeTrace::Options trace;
 	std::vector<std::string> files;
+	std::string evaluator = "simple";
 
 	bool did_anything = false;
 
 	int exit_value = 0;
 } MainState;
 
-int main()
+int main(int argc, char *argv[])
 {
+	for (int i = 1; i < argc; ++i) {
+		std::string arg(argv[i]);
+		if (arg == "-t")
+			MainState.run_tests = true;
+		else if (arg == "-h")
+			MainState.show_help = true;
+		else if (arg == "-p")
+			MainState.parallel = true;
+		else if (arg == "-m")
+			MainState.multitask = true;
+		else if (arg == "-c")
+			MainState.use_cache = true;
+		else if (arg == "-S")
+			MainState.show_stats = true;
+		else if (arg == "-H") {
+			MainState.show_census = true;
+			Core::SchemeHeap::Track(true);
+		}
+		else if (arg == "-i" && i + 1 < argc)
+			MainState.load_image = argv[++i];
+		else if (arg == "-s" && i + 1 < argc)
+			MainState.save_image = argv[++i];
+		else if (arg == "-e" && i + 1 < argc)
+			MainState.evaluator = argv[++i];
+		else if (arg == "-P" && i + 1 < argc)
+			MainState.profile = argv[++i];
+		else if (arg == "-T" && i + 1 < argc) {
+			try {
+				MainState.trace = Core::SchemeTrace::Options::Parse(argv[++i]);
+			} catch (SchemingPlusPlus::Core::critical_error &ce) {
+				std::cerr << "trace: " << ce.what() << std::endl;
+				MainState.bad_usage = true;
+			}
+		}
+		else if (arg == "-" || arg[0] != '-')
+			MainState.files.push_back(arg);
+		else {
+			std::cerr << "Unknown option: " << arg << std::endl;
+			MainState.bad_usage = true;
+		}
+	}
+
+	if (MainState.bad_usage) {
+		MainState.show_help = true;
+		MainState.files.clear();
+		MainState.run_tests = false;
+	}
+
+	std::unique_ptr<Core::SchemeEvaluator> evaluator = make_evaluator(MainState.evaluator);
+	if (evaluator == nullptr) {
+		std::cerr << "Unknown evaluator: " << MainState.evaluator << std::endl;
+		MainState.show_help = true;
+		MainState.files.clear();
+		MainState.run_tests = false;
+	}
+
 	if (MainState.run_tests) {
 		bool result = Tests::RunTests();
 		MainState.exit_value = result ? 0 : 1;
@@ -119,24 +312,109 @@ int main()
 	}
 
 	// Default to repl if no filename given
-	if (MainState.files.empty()) MainState.run_repl = true;
+	if (MainState.files.empty() && !MainState.run_tests && !MainState.show_help) MainState.run_repl = true;
 
-	if (MainState.run_repl) {
-		Core::SchemeEnvironment *env = new Core::SchemeEnvironment();
-		Core::EnvironmentType env_t(env);
-		Core::SchemeRuntime::AddGlobals(env_t);
-		repl(env_t);
+	bool tracing = !MainState.trace.File.empty() && (!MainState.files.empty() || MainState.run_repl);
+	if (tracing)
+		Core::SchemeTrace::Start(MainState.trace);
+	if (MainState.parallel && !MainState.files.empty()) {
+		if (!run_isolates(MainState.files, MainState.evaluator, MainState.use_cache))
+			MainState.exit_value = 1;
+		MainState.did_anything = true;
+	} else if (!MainState.files.empty() || MainState.run_repl) {
+		Core::EnvironmentType env_t = nullptr;
+		Core::SchemeHeap::Root env_root(env_t);
+		if (MainState.load_image.empty()) {
+			env_t = Core::SchemeHeap::New();
+			Core::SchemeRuntime::AddGlobals(env_t);
+		} else {
+			try {
+				env_t = Core::SchemeImage::Load(MainState.load_image);
+			} catch (SchemingPlusPlus::Core::critical_error &ce) {
+				std::cerr << MainState.load_image << ": " << ce.what() << std::endl;
+				return 1;
+			}
+		}
+		if (!MainState.profile.empty()) {
+			try {
+				Core::SchemeProfiler::Start();
+			} catch (SchemingPlusPlus::Core::critical_error &ce) {
+				std::cerr << "profile: " << ce.what() << std::endl;
+				MainState.profile.clear();
+			}
+		}
+		if (MainState.multitask) {
+			if (!MainState.files.empty() && !run_tasks(MainState.files, env_t, MainState.use_cache))
+				MainState.exit_value = 1;
+		} else {
+			for (auto it = MainState.files.cbegin(); it != MainState.files.cend(); ++it) {
+				if (!run_script(*it, env_t, *evaluator, MainState.use_cache)) {
+					MainState.exit_value = 1;
+					break;
+				}
+			}
+		}
+		if (MainState.run_repl)
+			repl(env_t, *evaluator);
+		// Processes the scripts spawned run until they finish or wait for messages
+		Core::SchemeProcess::Wait();
+		if (!MainState.profile.empty()) {
+			Core::SchemeProfiler::Report report = Core::SchemeProfiler::Stop(env_t);
+			std::cerr << report.Text;
+			std::ofstream out(MainState.profile);
+			out << report.Folded;
+			if (!out) {
+				std::cerr << MainState.profile << ": cannot write" << std::endl;
+				MainState.exit_value = 1;
+			}
+		}
+		if (MainState.show_census)
+			std::cerr << Core::SchemeHeap::Census().ToString();
+		if (!MainState.save_image.empty() && MainState.exit_value == 0) {
+			try {
+				Core::SchemeImage::Save(MainState.save_image, env_t);
+			} catch (SchemingPlusPlus::Core::critical_error &ce) {
+				std::cerr << MainState.save_image << ": " << ce.what() << std::endl;
+				MainState.exit_value = 1;
+			}
+		}
 		MainState.did_anything = true;
 	}
 
+	if (tracing) {
+		std::ofstream out(MainState.trace.File);
+		out << Core::SchemeTrace::Stop();
+		if (!out) {
+			std::cerr << MainState.trace.File << ": cannot write" << std::endl;
+			MainState.exit_value = 1;
+		}
+	}
+
 	if (MainState.did_anything == false || MainState.show_help) {
 		MainState.exit_value = MainState.did_anything ? 0 : 1;
 
-		std::cerr << "Usage:" << std::endl;
+		std::cerr << "Usage: schemingplusplus [options] [file...]" << std::endl;
+		std::cerr << "file...         Run scripts in order, - for standard input" << std::endl;
+		std::cerr << "                With no files or -t, start the REPL" << std::endl;
+		std::cerr << "-c              Load files through a FASL cache (file.fasl), written when stale" << std::endl;
+		std::cerr << "-p              Run the files in parallel, each in an isolate of its own" << std::endl;
+		std::cerr << "-m              Run the files at once, as tasks taking turns (frame evaluator)" << std::endl;
+		std::cerr << "-i image        Start from a heap image instead of the builtin globals" << std::endl;
+		std::cerr << "-s image        Save the global environment to a heap image on exit" << std::endl;
+		std::cerr << "-e evaluator    Evaluator: simple (default), analyze, vm or frame" << std::endl;
+		std::cerr << "-P file         Profile the run: a report on exit, and the folded stacks to file" << std::endl;
+		std::cerr << "-T file[,opt]   Trace the run to file as Chrome trace events; options" << std::endl;
+		std::cerr << "                min=us (shortest span kept), every=n (one top level" << std::endl;
+		std::cerr << "                form in n), call=name (trace calls of name; repeatable)" << std::endl;
+		std::cerr << "-S              Print runtime statistics on exit" << std::endl;
+		std::cerr << "-H              Track allocations, and print a heap census on exit" << std::endl;
 		std::cerr << "-t              Run tests" << std::endl;
 		std::cerr << "-h              Show help" << std::endl;
 	}
 
+	if (MainState.show_stats)
+		std::cerr << Core::SchemeStats::Report();
+
 	return MainState.exit_value;
 }
 
@@ -1,94 +1,462 @@
-#include <iostream>
-
-#include "SchemePlusPlus.h"
-
-using namespace SchemingPlusPlus::Core;
-
-namespace SchemingPlusPlus {
-	namespace Tests {
-		unsigned g_test_count;
-		unsigned g_fault_count;
-
-		template <typename T1, typename T2, typename T3>
-		void test_equal_(const T1 &expr, const T2 & value, const T3 & expected_value, const char * file, int line) {
-			++g_test_count;
-			std::cerr
-				//<< file
-				<< expr
-				<< '(' << line << ") : "
-				<< " expected " << expected_value
-				<< ", got " << value;
-			if (value != expected_value) {
-				++g_fault_count;
-				std::cerr << " - FAIL\n";
-			} else {
-				std::cerr << " - success\n";
-			}
-		}
-
-		std::string to_string(const SchemeCell &cell) { return cell.ToString(); }
-
-		// write a message to std::cout if value != expected_value
-		#define TEST_EQUAL(expr, value, expected_value) test_equal_(expr, value, expected_value, __FILE__, __LINE__)
-		// evaluate the given Scheme expression and compare the result against the given expected_result
-		#define TEST(expr, expected_result) do { \
-			try { \
-				TEST_EQUAL(expr, to_string(evaluator.Eval(Read(expr), global_env)), expected_result); \
-			} catch (critical_error &ce) { \
-				std::cerr << "Caught error: " << ce.what() << std::endl; \
-			} \
-		} while(0)
-
-		bool RunTests() {
-			Core::EnvironmentType _global_env(new SchemeEnvironment());
-			Core::SchemeRuntime::AddGlobals(_global_env);
-			Core::SchemeCell global_env(_global_env);
-			Core::SchemeSimpleEval evaluator;
-
-			// the 29 unit tests for lis.py
-			TEST("(quote (testing 1 (2.0) -3.14e159))", "(testing 1 (2.0) -3.14e159)");
-			TEST("(+ 2 2)", "4");
-			TEST("(+ (* 2 100) (* 1 10))", "210");
-			TEST("(if (> 6 5) (+ 1 1) (+ 2 2))", "2");
-			TEST("(if (< 6 5) (+ 1 1) (+ 2 2))", "4");
-			TEST("(define x 3)", "3");
-			TEST("x", "3");
-			TEST("(+ x x)", "6");
-			TEST("(begin (define x 1) (set! x (+ x 1)) (+ x 1))", "3");
-			TEST("((lambda (x) (+ x x)) 5)", "10");
-			TEST("(define twice (lambda (x) (* 2 x)))", "<Lambda>");
-			TEST("(twice 5)", "10");
-			TEST("(define compose (lambda (f g) (lambda (x) (f (g x)))))", "<Lambda>");
-			TEST("((compose list twice) 5)", "(10)");
-			TEST("(define repeat (lambda (f) (compose f f)))", "<Lambda>");
-			TEST("((repeat twice) 5)", "20");
-			TEST("((repeat (repeat twice)) 5)", "80");
-			TEST("(define fact (lambda (n) (if (<= n 1) 1 (* n (fact (- n 1))))))", "<Lambda>");
-			TEST("(fact 3)", "6");
-			//TEST("(fact 50)", "30414093201713378043612608166064768844377641568960512000000000000");
-			TEST("(fact 12)", "479001600"); // no bignums; this is as far as we go with 32 bits
-			TEST("(define abs (lambda (n) ((if (> n 0) + -) 0 n)))", "<Lambda>");
-			TEST("(list (abs -3) (abs 0) (abs 3))", "(3 0 3)");
-			TEST("(define combine (lambda (f)"
-				"(lambda (x y)"
-				"(if (null? x) (quote ())"
-				"(f (list (head x) (head y))"
-				"((combine f) (tail x) (tail y)))))))", "<Lambda>");
-			TEST("(define zip (combine cons))", "<Lambda>");
-			TEST("(zip (list 1 2 3 4) (list 5 6 7 8))", "((1 5) (2 6) (3 7) (4 8))");
-			TEST("(define riff-shuffle (lambda (deck) (begin"
-				"(define take (lambda (n seq) (if (<= n 0) (quote ()) (cons (head seq) (take (- n 1) (tail seq))))))"
-				"(define drop (lambda (n seq) (if (<= n 0) seq (drop (- n 1) (tail seq)))))"
-				"(define mid (lambda (seq) (/ (length seq) 2)))"
-				"((combine append) (take (mid deck) deck) (drop (mid deck) deck)))))", "<Lambda>");
-			TEST("(riff-shuffle (list 1 2 3 4 5 6 7 8))", "(1 5 2 6 3 7 4 8)");
-			TEST("((repeat riff-shuffle) (list 1 2 3 4 5 6 7 8))", "(1 3 5 7 2 4 6 8)");
-			TEST("(riff-shuffle (riff-shuffle (riff-shuffle (list 1 2 3 4 5 6 7 8))))", "(1 2 3 4 5 6 7 8)");
-			std::cout
-				<< "total tests " << g_test_count
-				<< ", total failures " << g_fault_count
-				<< "\n";
-			return g_fault_count == 0;
-		}
-	}
+#include <iostream>
+#include <sstream>
+
+#include "SchemePlusPlus.h"
+
+using namespace SchemingPlusPlus::Core;
+
+namespace SchemingPlusPlus {
+	namespace Tests {
+		unsigned g_test_count;
+		unsigned g_fault_count;
+
+		template <typename T1, typename T2, typename T3>
+		void test_equal_(const T1 &expr, const T2 & value, const T3 & expected_value, const char * file, int line) {
+			++g_test_count;
+			std::cerr
+				//<< file
+				<< expr
+				<< '(' << line << ") : "
+				<< " expected " << expected_value
+				<< ", got " << value;
+			if (value != expected_value) {
+				++g_fault_count;
+				std::cerr << " - FAIL\n";
+			} else {
+				std::cerr << " - success\n";
+			}
+		}
+
+		std::string to_string(const SchemeCell &cell) { return cell.ToString(); }
+
+		// write a message to std::cout if value != expected_value
+		#define TEST_EQUAL(expr, value, expected_value) test_equal_(expr, value, expected_value, __FILE__, __LINE__)
+		// evaluate the given Scheme expression and compare the result against the given expected_result
+		#define TEST(expr, expected_result) do { \
+			try { \
+				TEST_EQUAL(expr, to_string(evaluator.Eval(Read(expr), global_env)), expected_result); \
+			} catch (critical_error &ce) { \
+				std::cerr << "Caught error: " << ce.what() << std::endl; \
+			} \
+		} while(0)
+
+		// A fresh global environment, rooted while in scope. It converts to the
+		// cell TEST evaluates in.
+		class Globals {
+		public:
+			Globals() : _cell(SchemeHeap::New()), _root(_cell) { SchemeRuntime::AddGlobals(_cell.Environment); }
+			Globals(const Globals &) = delete;
+			Globals &operator = (const Globals &) = delete;
+			operator const SchemeCell &() const { return _cell; }
+			EnvironmentType Env() const { return _cell.Environment; }
+		private:
+			SchemeCell _cell;
+			SchemeHeap::Root _root;
+		};
+
+		// Run the suite against one evaluator, in a fresh global environment
+		void RunTestsWith(Core::SchemeEvaluator &evaluator) {
+			Globals global_env;
+
+			// the 29 unit tests for lis.py
+			TEST("(quote (testing 1 (2.0) -3.14e159))", "(testing 1 (2.0) -3.14e159)");
+			TEST("(+ 2 2)", "4");
+			TEST("(+ (* 2 100) (* 1 10))", "210");
+			TEST("(if (> 6 5) (+ 1 1) (+ 2 2))", "2");
+			TEST("(if (< 6 5) (+ 1 1) (+ 2 2))", "4");
+			TEST("(define x 3)", "3");
+			TEST("x", "3");
+			TEST("(+ x x)", "6");
+			TEST("(begin (define x 1) (set! x (+ x 1)) (+ x 1))", "3");
+			TEST("((lambda (x) (+ x x)) 5)", "10");
+			TEST("(define twice (lambda (x) (* 2 x)))", "<Lambda>");
+			TEST("(twice 5)", "10");
+			TEST("(define compose (lambda (f g) (lambda (x) (f (g x)))))", "<Lambda>");
+			TEST("((compose list twice) 5)", "(10)");
+			TEST("(define repeat (lambda (f) (compose f f)))", "<Lambda>");
+			TEST("((repeat twice) 5)", "20");
+			TEST("((repeat (repeat twice)) 5)", "80");
+			TEST("(define fact (lambda (n) (if (<= n 1) 1 (* n (fact (- n 1))))))", "<Lambda>");
+			TEST("(fact 3)", "6");
+			TEST("(fact 12)", "479001600");
+			TEST("(fact 50)", "30414093201713378043612608166064768844377641568960512000000000000");
+			TEST("(/ (fact 50) (fact 48))", "2450");
+			TEST("(+ 9223372036854775807 1)", "9223372036854775808");
+			TEST("(- (+ 9223372036854775807 1) 1)", "9223372036854775807");
+			TEST("(/ (- 0 9223372036854775807 1) -1)", "9223372036854775808");
+			TEST("(* 123456789012345678901234567890 -987654321098765432109876543210)",
+				"-121932631137021795226185032733622923332237463801111263526900");
+			TEST("(< 1 100000000000000000000 1e30)", "#true");
+			TEST("(= 100000000000000000000 1e20)", "#true");
+			TEST("(define abs (lambda (n) ((if (> n 0) + -) 0 n)))", "<Lambda>");
+			TEST("(list (abs -3) (abs 0) (abs 3))", "(3 0 3)");
+			TEST("(define combine (lambda (f)"
+				"(lambda (x y)"
+				"(if (null? x) (quote ())"
+				"(f (list (head x) (head y))"
+				"((combine f) (tail x) (tail y)))))))", "<Lambda>");
+			TEST("(define zip (combine cons))", "<Lambda>");
+			TEST("(zip (list 1 2 3 4) (list 5 6 7 8))", "((1 5) (2 6) (3 7) (4 8))");
+			TEST("(define riff-shuffle (lambda (deck) (begin"
+				"(define take (lambda (n seq) (if (<= n 0) (quote ()) (cons (head seq) (take (- n 1) (tail seq))))))"
+				"(define drop (lambda (n seq) (if (<= n 0) seq (drop (- n 1) (tail seq)))))"
+				"(define mid (lambda (seq) (/ (length seq) 2)))"
+				"((combine append) (take (mid deck) deck) (drop (mid deck) deck)))))", "<Lambda>");
+			TEST("(riff-shuffle (list 1 2 3 4 5 6 7 8))", "(1 5 2 6 3 7 4 8)");
+			TEST("((repeat riff-shuffle) (list 1 2 3 4 5 6 7 8))", "(1 3 5 7 2 4 6 8)");
+			TEST("(riff-shuffle (riff-shuffle (riff-shuffle (list 1 2 3 4 5 6 7 8))))", "(1 2 3 4 5 6 7 8)");
+			// Unboxed numbers
+			TEST("(+ 1 2.5)", "3.5");
+			TEST("(* 1.5 2)", "3.0");
+			TEST("(/ 7 2)", "3");
+			TEST("(= 2 2.0)", "#true");
+			// Interned symbols
+			TEST("(= (quote abc) (quote abc))", "#true");
+			TEST("(= (quote abc) (quote abd))", "#nil");
+			// Lexical addressing
+			TEST("((lambda args args) 1 2 3)", "(1 2 3)");
+			TEST("(define counter (lambda (n) (lambda () (begin (set! n (+ n 1)) n))))", "<Lambda>");
+			TEST("(begin (define tick (counter 5)) (tick) (tick))", "7");
+			TEST("((lambda (x) ((lambda (y) (begin (define x 7) (+ x y))) 2)) 1)", "9");
+			// Macros
+			TEST("(define unless (macro (c a b) (list (quote if) c b a)))", "<Macro>");
+			TEST("(unless (> 1 2) (quote yes) (quote no))", "yes");
+			TEST("((lambda (n) (unless (> n 2) (* n 10) n)) 1)", "10");
+			// Pair lists
+			TEST("(tail (tail (list 1 2 3)))", "(3)");
+			TEST("(cons 0 (tail (list 1 2 3)))", "(0 2 3)");
+			TEST("(append (tail (list 1 2)) (list 3))", "(2 3)");
+			TEST("(= (list 1 2) (cons 1 (list 2)))", "#true");
+			TEST("(define flip (macro (f a b) (cons f (cons b (cons a (quote ()))))))", "<Macro>");
+			TEST("(flip - 1 10)", "9");
+			TEST("(define build (lambda (n acc) (if (<= n 0) acc (build (- n 1) (cons n acc)))))", "<Lambda>");
+			TEST("(define sum (lambda (l acc) (if (null? l) acc (sum (tail l) (+ acc (head l))))))", "<Lambda>");
+			TEST("(length (build 20000 (quote ())))", "20000");
+			TEST("(sum (build 20000 (quote ())) 0)", "200010000");
+			// Garbage collection
+			TEST("(define keep (counter 10))", "<Lambda>");
+			TEST("(begin (gc) (keep) (gc) (keep))", "12");
+		}
+
+		bool RunTests() {
+			size_t live_before = SchemeHeap::Stats().Live;
+			// Reader
+			TEST_EQUAL("Read comments", Read("(1 ;; two\n 3)").ToString(), "(1 3)");
+			TEST_EQUAL("Read strings", Read("(\"a b\" \"c \\\" d\")").ListValue[1].ToString(true), "\"c \\\" d\"");
+			TEST_EQUAL("Read numbers", Read("(-7 2.5 1e3 99999999999999999999 1+)").ToString(), "(-7 2.5 1e3 99999999999999999999 1+)");
+			{
+				// Streaming reader: forms complete across pieces of input
+				SchemeReader reader;
+				SchemeCell form;
+				std::string forms;
+				const char *pieces[] = { "(+ 1", " 2) ab", "c ;", "; note\n\"s (\" ((", "x)) y" };
+				for (const char *piece : pieces) {
+					reader.Feed(piece);
+					while (reader.Next(form))
+						forms += form.ToString(true) + "|";
+				}
+				reader.Finish();
+				while (reader.Next(form))
+					forms += form.ToString(true) + "|";
+				TEST_EQUAL("SchemeReader forms across pieces", forms, "(+ 1 2)|abc|\"s (\"|((x))|y|");
+
+				std::istringstream in("(define a 1) a (b\n c)");
+				SchemeReader chunked;
+				forms.clear();
+				while (chunked.NextFrom(in, form, 3))
+					forms += form.ToString() + "|";
+				TEST_EQUAL("SchemeReader forms from a stream", forms, "(define a 1)|a|(b c)|");
+
+				SchemeReader marked;
+				marked.Feed("\xEF\xBB\xBF(a)");
+				TEST_EQUAL("SchemeReader skips a byte order mark", marked.Next(form) ? form.ToString() : "", "(a)");
+			}
+			{
+				// FASL: forms survive a round trip, symbols still interned
+				VectorType forms = { Read("(define (f x) (if (< x -1234567890123) x \"s \\\" t\"))"),
+					Read("(2.5 -0.0 99999999999999999999 () ((())) x define)"), Read("sym"),
+					SchemeCell::Cons(Read("a"), Read("(b (c))")) };
+				VectorType read = SchemeFasl::Read(SchemeFasl::Write(forms));
+				TEST_EQUAL("FASL round trip", SchemeCell(read).ToString(true), SchemeCell(forms).ToString(true));
+				TEST_EQUAL("FASL symbols interned", read[1].ListValue.back().AtomValue, forms[0].ListValue[0].AtomValue);
+				std::string damaged = SchemeFasl::Write(forms);
+				damaged.pop_back();
+				bool rejected = false;
+				try { SchemeFasl::Read(damaged); } catch (critical_error &) { rejected = true; }
+				TEST_EQUAL("FASL rejects truncated data", rejected, true);
+			}
+
+			Core::SchemeSimpleEval simple;
+			RunTestsWith(simple);
+			{
+				// Heap image: definitions survive a round trip, closures still share what they captured
+				Core::SchemeSimpleEval &evaluator = simple;
+				std::string image;
+				{
+					Globals global_env;
+					evaluator.Eval(Read("(define make (lambda (n) (list (lambda () (begin (set! n (+ n 1)) n)) (lambda () n))))"), global_env);
+					evaluator.Eval(Read("(define p (make 5))"), global_env);
+					evaluator.Eval(Read("(define data (cons 1.5 (cons \"s\" (list (quote x) 99999999999999999999))))"), global_env);
+					image = SchemeImage::Write(global_env.Env());
+				}
+				Core::EnvironmentType loaded = SchemeImage::Read(image);
+				SchemeHeap::Root loaded_root(loaded);
+				Core::SchemeCell global_env(loaded);
+				TEST("((head p))", "6");
+				TEST("((head (tail p)))", "6");
+				TEST("data", "(1.5 s x 99999999999999999999)");
+				TEST("(+ 1 (length (list 1 2)))", "3");
+				{
+					// Closures from an image are compiled at their first call, then kept by their binding
+					std::string fib_image;
+					{
+						Globals fib_globals;
+						evaluator.Eval(Read("(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))"), fib_globals);
+						fib_image = SchemeImage::Write(fib_globals.Env());
+					}
+					Core::SchemeVMEval vm_compiler;
+					Core::SchemeAnalyzeEval analyze_compiler;
+					Core::SchemeEvaluator *compilers[] = { &vm_compiler, &analyze_compiler };
+					for (Core::SchemeEvaluator *compiler : compilers) {
+						Core::EnvironmentType fib_env = SchemeImage::Read(fib_image);
+						SchemeHeap::Root fib_env_root(fib_env);
+						compiler->Eval(Read("(fib 10)"), SchemeCell(fib_env));
+						Core::CompiledType compiled = (*fib_env)["fib"].Compiled;
+						TEST_EQUAL("Image closures are compiled at their first call", compiled != nullptr, true);
+						compiler->Eval(Read("(fib 10)"), SchemeCell(fib_env));
+						TEST_EQUAL("Image closures are compiled only once", (*fib_env)["fib"].Compiled == compiled, true);
+					}
+				}
+				bool rejected = false;
+				try { SchemeImage::Read(image.substr(0, image.size() - 1)); } catch (critical_error &) { rejected = true; }
+				TEST_EQUAL("Image rejects truncated data", rejected, true);
+			}
+
+			Core::SchemeAnalyzeEval analyze;
+			RunTestsWith(analyze);
+
+			Core::SchemeVMEval vm;
+			RunTestsWith(vm);
+			{
+				// Closure calls do not use the C++ stack
+				Core::SchemeVMEval &evaluator = vm;
+				Globals global_env;
+				TEST("(define count (lambda (n) (if (<= n 0) 0 (+ 1 (count (- n 1))))))", "<Lambda>");
+				TEST("(count 200000)", "200000");
+			}
+
+			Core::SchemeFrameEval frame;
+			RunTestsWith(frame);
+			{
+				// Nothing uses the C++ stack, including non-tail calls and macro expansion
+				Core::SchemeFrameEval &evaluator = frame;
+				Globals global_env;
+				TEST("(define sum (lambda (n) (if (<= n 0) 0 (+ n (sum (- n 1))))))", "<Lambda>");
+				TEST("(sum 200000)", "20000100000");
+				TEST("(define nest (macro (n) (if (<= n 0) 0 (list (quote +) 1 (list (quote nest) (- n 1))))))", "<Macro>");
+				TEST("(nest 20000)", "20000");
+
+				// Tasks take turns; each keeps its own frames between turns
+				SchemeTaskMachine machine(50);
+				IntegerType total = 0;
+				std::string failed;
+				machine.OnComplete = [&total, &failed](const SchemeTask &task) {
+					if (task.Failed)
+						failed = task.Error;
+					else
+						total += task.Result().IntegerValue;
+				};
+				for (int i = 1; i <= 1000; ++i)
+					machine.Spawn(Read("(sum " + std::to_string(i) + ")"), global_env.Env());
+				machine.Spawn(Read("(sum undefined)"), global_env.Env());
+				machine.Loop();
+				TEST_EQUAL("Tasks all complete", machine.Count(), (size_t)0);
+				TEST_EQUAL("Tasks results", total, (IntegerType)167167000);
+				TEST_EQUAL("Tasks are preempted", machine.Stats().Preempted > 1000, true);
+				TEST_EQUAL("Task errors end only that task", failed.find("undefined") != std::string::npos, true);
+
+				// The highest priority runs every turn it is offered
+				SchemeTaskMachine urgent(50);
+				urgent.Spawn(Read("(sum 5000)"), global_env.Env(), "urgent", SchemeTask::PRI_HIGHEST);
+				urgent.Loop();
+				TEST_EQUAL("PRI_HIGHEST tasks run each turn", urgent.Stats().Slices, urgent.Stats().Preempted + 1);
+			}
+
+			{
+				// Isolates: each has its own heap and globals, and they run in parallel
+				size_t process_live = SchemeHeap::Stats().Live;
+				std::vector<IntegerType> results(16);
+				SchemeExecutor executor(4);
+				for (size_t i = 0; i < results.size(); ++i) {
+					executor.Submit([i, &results]() {
+						SchemeIsolate isolate;
+						Core::SchemeFrameEval evaluator;
+						isolate.Eval(Read("(define sum (lambda (n) (if (<= n 0) 0 (+ n (sum (- n 1))))))"), evaluator);
+						isolate.Eval(Read("(define n " + std::to_string(i) + ")"), evaluator);
+						results[i] = isolate.Eval(Read("(+ n (sum 5000))"), evaluator).IntegerValue;
+					});
+				}
+				executor.Wait();
+				bool all = true;
+				for (size_t i = 0; i < results.size(); ++i)
+					all = all && results[i] == (IntegerType)(12502500 + i);
+				TEST_EQUAL("Isolates compute independently", all, true);
+				TEST_EQUAL("Isolates ran every job", executor.Stats().Executed, (size_t)16);
+				TEST_EQUAL("Isolates leave the process heap alone", SchemeHeap::Stats().Live, process_live);
+			}
+			{
+				// Processes: each has a heap of its own; closures and messages are copied between them
+				Core::SchemeSimpleEval &evaluator = simple;
+				Globals global_env;
+				TEST("(begin (spawn (lambda (to n) (send to (* n n))) (self) 12) (receive))", "144");
+				TEST("(define echo (spawn (lambda () (begin (define loop (lambda () (begin (define m (receive)) (send (head m) (tail m)) (loop)))) (loop)))))", std::to_string(SchemeProcess::Self() + 2));
+				TEST("((head (begin (send echo (list (self) (lambda (x) (+ x 1)))) (receive))) 41)", "42");
+				TEST("(define stage (lambda (next) (begin (define loop (lambda () (begin (send next (+ 1 (receive))) (loop)))) (loop))))", "<Lambda>");
+				TEST("(define a (spawn stage (spawn stage (spawn stage (self)))))", std::to_string(SchemeProcess::Self() + 5));
+				TEST("(begin (send a 1) (send a 10) (list (receive) (receive)))", "(4 13)");
+				TEST("(define square (lambda (to n) (send to (* n n))))", "<Lambda>");
+				TEST("(define spawn-all (lambda (n) (if (<= n 0) 0 (begin (spawn square (self) n) (spawn-all (- n 1))))))", "<Lambda>");
+				TEST("(define collect (lambda (n total) (if (<= n 0) total (collect (- n 1) (+ total (receive))))))", "<Lambda>");
+				TEST("(begin (spawn-all 200) (collect 200 0))", "2686700");
+				TEST("(spawn (lambda () (undefined)))", std::to_string(SchemeProcess::Self() + 206));
+				SchemeProcess::Wait();
+				TEST("(send 1000000 1)", "#false");
+				TEST_EQUAL("Processes end, or wait for messages", SchemeProcess::Count(), (size_t)5);
+			}
+			{
+				// Futures and parallel map: calls handed to workers run on copies, in heaps of their own
+				Core::SchemeSimpleEval &evaluator = simple;
+				Globals global_env;
+				TEST("(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))", "<Lambda>");
+				TEST("(pmap fib (list 10 15 20 1 2))", "(55 610 6765 1 1)");
+				TEST("(touch (future fib 20))", "6765");
+				TEST("(begin (define f (future + 1 2)) (define g (future (lambda (x) (lambda () x)) 7)) (list (touch f) ((touch g))))", "(3 7)");
+				TEST("(define range (lambda (a b) (if (<= b a) (quote ()) (cons a (range (+ a 1) b)))))", "<Lambda>");
+				TEST("(preduce + 0 (pmap (lambda (x) (* x x)) (range 0 1000)))", "332833500");
+				TEST("(preduce append (quote ()) (pmap list (range 0 10)))", "(0 1 2 3 4 5 6 7 8 9)");
+				TEST("(preduce + 5 (quote ()))", "5");
+				bool raised = false;
+				try { evaluator.Eval(Read("(touch (future (lambda () (undefined))))"), global_env); } catch (critical_error &) { raised = true; }
+				TEST_EQUAL("Future errors are raised by touch", raised, true);
+				// Only the globals a procedure names travel with it, and those they name
+				TEST("(begin (define square (lambda (x) (* x x))) (define sum-squares (lambda (n) (if (<= n 0) 0 (+ (square n) (sum-squares (- n 1)))))) (pmap sum-squares (list 1 2 3 10)))", "(1 5 14 385)");
+				SchemeCell sum_squares = (*global_env.Env())["sum-squares"];
+				TEST_EQUAL("Futures copy only the bindings named", SchemeImage::WriteValue(sum_squares, true, true).size() * 4 < SchemeImage::WriteValue(sum_squares, true).size(), true);
+			}
+			{
+				// Ports: a process waiting for input or a timer gives up its worker to the others
+				Core::SchemeSimpleEval &evaluator = simple;
+				Globals global_env;
+				TEST("(read-line (open-input-pipe \"echo hi\"))", "hi");
+				TEST("(begin (define p (open-input-pipe \"printf 'a\\nb'\")) (list (read-line p) (read-line p) (read-line p)))", "(a b #nil)");
+				TEST("(close-port p)", "0");
+				TEST("(close-port (open-input-pipe \"exit 3\"))", "3");
+				TEST("(begin (spawn (lambda (to) (begin (sleep 200) (send to (quote a)))) (self)) (spawn (lambda (to) (send to (quote b))) (self)) (list (receive) (receive)))", "(b a)");
+				TEST("(begin (spawn (lambda (to) (send to (read-all (open-input-pipe \"sleep 0.2; echo x\")))) (self)) (spawn (lambda (to) (send to (quote y))) (self)) (list (receive) (receive)))", "(y x\n)");
+				// A message does not wake a sleeper: its sleep is made twice, not once a slice
+				static std::atomic<int> naps{ 0 };
+				(*global_env.Env())["nap"] = +[](const Core::VectorType &args) { ++naps; return Core::SchemePorts::proc_sleep(args); };
+				TEST("(begin (send (spawn (lambda (to) (begin (nap 200) (send to (receive)))) (self)) (quote m)) (receive))", "m");
+				TEST_EQUAL("a sleeping process stays parked with a message queued", naps.load() <= 2, true);
+				// Messages may hold builtins added after the globals, as the REPL's (tests) is
+				(*global_env.Env())["twice"] = +[](const Core::VectorType &args) { return Core::SchemeCell(args[0].IntegerValue * 2); };
+				TEST("(begin (spawn (lambda (to) (send to (twice 21))) (self)) (receive))", "42");
+			}
+
+			{
+				// Profiler: samples name the procedures running by their bindings
+				Core::SchemeVMEval &evaluator = vm;
+				Globals global_env;
+				TEST("(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))", "<Lambda>");
+				TEST("(profile (fib 20) \"profile-test.folded\")", "6765");
+				TEST("(read-line (open-input-pipe \"grep -q '^fib;fib' profile-test.folded && echo named; rm -f profile-test.folded\"))", "named");
+			}
+
+			{
+				// Runtime statistics: this thread's counts of what (fib 10) does
+				Core::SchemeAnalyzeEval &evaluator = analyze;
+				Globals global_env;
+				TEST("(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))", "<Lambda>");
+				const Core::SchemeCounters &counters = Core::SchemeStats::Local();
+				uint64_t ifs = counters.SpecialForms[Core::SchemeCounters::IF].Get();
+				uint64_t environments = counters.Environments.Get();
+				uint64_t outer = counters.Lookups[1].Get();
+				TEST("(fib 10)", "55");
+				TEST_EQUAL("runtime-stats counts special forms", counters.SpecialForms[Core::SchemeCounters::IF].Get() - ifs, (uint64_t)177);
+				TEST_EQUAL("runtime-stats counts environments", counters.Environments.Get() - environments, (uint64_t)177);
+				TEST_EQUAL("runtime-stats counts lookups by depth", counters.Lookups[1].Get() - outer, (uint64_t)617);
+				TEST("(head (head (runtime-stats)))", "primitives");
+			}
+
+			{
+				// Heap census: what the environments of a heap of its own hold
+				Core::SchemeHeapSpace space;
+				SchemeHeap::Use use(space);
+				Core::SchemeSimpleEval &evaluator = simple;
+				Globals global_env;
+				TEST("(define kept (list \"a string too long to fit in the cell\" (lambda (x) x)))", "(a string too long to fit in the cell <Lambda>)");
+				Core::SchemeHeapCensus census = SchemeHeap::Census();
+				TEST_EQUAL("heap-census counts environments", census.Environments, (size_t)1);
+				TEST_EQUAL("heap-census counts cells by type", census.ByType[Core::STRING].Live, (size_t)1);
+				TEST_EQUAL("heap-census counts string bytes", census.ByType[Core::STRING].StringBytes > 36, true);
+				TEST_EQUAL("heap-census keeps a high-water mark", census.PeakBytes >= census.Bytes, true);
+				TEST_EQUAL("heap-census keeps a high-water mark by type", census.ByType[Core::STRING].PeakLive >= census.ByType[Core::STRING].Live, true);
+				SchemeHeap::Track(true);
+				uint64_t made = Core::SchemeStats::CellsMade(Core::STRING);
+				{
+					SchemeCell made_cell("made", Core::STRING);
+					SchemeCell copied_cell = made_cell;
+					SchemeCell moved_cell = std::move(copied_cell);
+				}
+				TEST_EQUAL("heap-census counts cells made, not copied", Core::SchemeStats::CellsMade(Core::STRING) - made, (uint64_t)1);
+				SchemeHeap::Track(false);
+				TEST("(head (head (heap-census)))", "environments");
+			}
+
+			{
+				// Trace: spans of top level forms and of calls of chosen procedures, as JSON
+				Core::SchemeAnalyzeEval &evaluator = analyze;
+				Globals global_env;
+				auto count = [](const std::string &json, const std::string &text) {
+					size_t found = 0;
+					for (size_t at = json.find(text); at != std::string::npos; at = json.find(text, at + 1))
+						++found;
+					return found;
+				};
+				TEST("(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))", "<Lambda>");
+				Core::SchemeTrace::Options options = Core::SchemeTrace::Options::Parse("trace-test.json,every=1,call=fib");
+				TEST_EQUAL("trace options name the procedures traced", options.Calls.size(), (size_t)1);
+				bool rejected = false;
+				try { Core::SchemeTrace::Options::Parse("trace-test.json,min=10us"); } catch (critical_error &) { rejected = true; }
+				TEST_EQUAL("trace options must be numbers", rejected, true);
+				Core::SchemeTrace::Start(options);
+				{
+					Core::SchemeCell form = Core::Read("(fib 5)");
+					Core::SchemeTrace::Form trace(form, global_env.Env());
+					TEST("(fib 5)", "5");
+				}
+				std::string json = Core::SchemeTrace::Stop();
+				TEST_EQUAL("trace records each call of a chosen procedure", count(json, "\"name\":\"fib\""), (size_t)15);
+				TEST_EQUAL("trace records top level forms", count(json, "\"cat\":\"form\""), (size_t)1);
+				// Nothing here lasts a second
+				Core::SchemeTrace::Start(Core::SchemeTrace::Options::Parse("trace-test.json,min=1000000,call=fib"));
+				{
+					Core::SchemeCell form = Core::Read("(fib 5)");
+					Core::SchemeTrace::Form trace(form, global_env.Env());
+					TEST("(fib 5)", "5");
+				}
+				TEST_EQUAL("trace drops spans shorter than the minimum", count(Core::SchemeTrace::Stop(), "\"ph\":\"X\""), (size_t)0);
+			}
+
+			// Each run's global environment and closures form cycles; all are collected
+			SchemeHeap::Collect();
+			TEST_EQUAL("(gc) frees unreachable environments", SchemeHeap::Stats().Live <= live_before, true);
+
+			std::cout
+				<< "total tests " << g_test_count
+				<< ", total failures " << g_fault_count
+				<< "\n";
+			return g_fault_count == 0;
+		}
+	}
 }
\ No newline at end of file
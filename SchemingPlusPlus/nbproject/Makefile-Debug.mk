@@ -37,11 +37,33 @@ OBJECTDIR=${CND_BUILDDIR}/${CND_CONF}/${CND_PLATFORM}
 OBJECTFILES= \
 	${OBJECTDIR}/Scheme.o \
 	${OBJECTDIR}/SchemeAssert.o \
+	${OBJECTDIR}/SchemeBigInt.o \
+	${OBJECTDIR}/SchemeBinary.o \
 	${OBJECTDIR}/SchemeCell.o \
+	${OBJECTDIR}/SchemeCompiler.o \
 	${OBJECTDIR}/SchemeEnvironment.o \
+	${OBJECTDIR}/SchemeEvalAnalyze.o \
+	${OBJECTDIR}/SchemeEvalFrame.o \
 	${OBJECTDIR}/SchemeEvalSimple.o \
+	${OBJECTDIR}/SchemeEvalVM.o \
+	${OBJECTDIR}/SchemeEventLoop.o \
+	${OBJECTDIR}/SchemeExecutor.o \
+	${OBJECTDIR}/SchemeFasl.o \
+	${OBJECTDIR}/SchemeFuture.o \
+	${OBJECTDIR}/SchemeHeap.o \
+	${OBJECTDIR}/SchemeImage.o \
+	${OBJECTDIR}/SchemeIsolate.o \
+	${OBJECTDIR}/SchemeLexical.o \
 	${OBJECTDIR}/SchemeParser.o \
+	${OBJECTDIR}/SchemePorts.o \
+	${OBJECTDIR}/SchemeProcess.o \
+	${OBJECTDIR}/SchemeProfiler.o \
+	${OBJECTDIR}/SchemeReader.o \
 	${OBJECTDIR}/SchemeRuntime.o \
+	${OBJECTDIR}/SchemeStats.o \
+	${OBJECTDIR}/SchemeSymbols.o \
+	${OBJECTDIR}/SchemeTaskMachine.o \
+	${OBJECTDIR}/SchemeTrace.o \
 	${OBJECTDIR}/SchemingPlusPlus.o \
 	${OBJECTDIR}/SchemingTests.o \
 	${OBJECTDIR}/TextUtils.o
@@ -51,8 +73,8 @@ OBJECTFILES= \
 CFLAGS=
 
 # CC Compiler Flags
-CCFLAGS=
-CXXFLAGS=
+CCFLAGS=-std=c++17
+CXXFLAGS=-std=c++17
 
 # Fortran Compiler Flags
 FFLAGS=
@@ -61,7 +83,7 @@ FFLAGS=
 ASFLAGS=
 
 # Link Libraries and Options
-LDLIBSOPTIONS=
+LDLIBSOPTIONS=-lpthread
 
 # Build Targets
 .build-conf: ${BUILD_SUBPROJECTS}
@@ -81,31 +103,141 @@ ${OBJECTDIR}/SchemeAssert.o: SchemeAssert.cpp
 	${RM} "$@.d"
 	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeAssert.o SchemeAssert.cpp
 
+${OBJECTDIR}/SchemeBigInt.o: SchemeBigInt.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeBigInt.o SchemeBigInt.cpp
+
+${OBJECTDIR}/SchemeBinary.o: SchemeBinary.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeBinary.o SchemeBinary.cpp
+
 ${OBJECTDIR}/SchemeCell.o: SchemeCell.cpp
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
 	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeCell.o SchemeCell.cpp
 
+${OBJECTDIR}/SchemeCompiler.o: SchemeCompiler.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeCompiler.o SchemeCompiler.cpp
+
 ${OBJECTDIR}/SchemeEnvironment.o: SchemeEnvironment.cpp
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
 	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeEnvironment.o SchemeEnvironment.cpp
 
+${OBJECTDIR}/SchemeEvalAnalyze.o: SchemeEvalAnalyze.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeEvalAnalyze.o SchemeEvalAnalyze.cpp
+
+${OBJECTDIR}/SchemeEvalFrame.o: SchemeEvalFrame.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeEvalFrame.o SchemeEvalFrame.cpp
+
 ${OBJECTDIR}/SchemeEvalSimple.o: SchemeEvalSimple.cpp
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
 	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeEvalSimple.o SchemeEvalSimple.cpp
 
+${OBJECTDIR}/SchemeEvalVM.o: SchemeEvalVM.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeEvalVM.o SchemeEvalVM.cpp
+
+${OBJECTDIR}/SchemeEventLoop.o: SchemeEventLoop.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeEventLoop.o SchemeEventLoop.cpp
+
+${OBJECTDIR}/SchemeExecutor.o: SchemeExecutor.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeExecutor.o SchemeExecutor.cpp
+
+${OBJECTDIR}/SchemeFasl.o: SchemeFasl.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeFasl.o SchemeFasl.cpp
+
+${OBJECTDIR}/SchemeFuture.o: SchemeFuture.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeFuture.o SchemeFuture.cpp
+
+${OBJECTDIR}/SchemeHeap.o: SchemeHeap.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeHeap.o SchemeHeap.cpp
+
+${OBJECTDIR}/SchemeImage.o: SchemeImage.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeImage.o SchemeImage.cpp
+
+${OBJECTDIR}/SchemeIsolate.o: SchemeIsolate.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeIsolate.o SchemeIsolate.cpp
+
+${OBJECTDIR}/SchemeLexical.o: SchemeLexical.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeLexical.o SchemeLexical.cpp
+
 ${OBJECTDIR}/SchemeParser.o: SchemeParser.cpp
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
 	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeParser.o SchemeParser.cpp
 
+${OBJECTDIR}/SchemePorts.o: SchemePorts.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemePorts.o SchemePorts.cpp
+
+${OBJECTDIR}/SchemeProcess.o: SchemeProcess.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeProcess.o SchemeProcess.cpp
+
+${OBJECTDIR}/SchemeProfiler.o: SchemeProfiler.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeProfiler.o SchemeProfiler.cpp
+
+${OBJECTDIR}/SchemeReader.o: SchemeReader.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeReader.o SchemeReader.cpp
+
 ${OBJECTDIR}/SchemeRuntime.o: SchemeRuntime.cpp
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
 	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeRuntime.o SchemeRuntime.cpp
 
+${OBJECTDIR}/SchemeStats.o: SchemeStats.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeStats.o SchemeStats.cpp
+
+${OBJECTDIR}/SchemeSymbols.o: SchemeSymbols.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeSymbols.o SchemeSymbols.cpp
+
+${OBJECTDIR}/SchemeTaskMachine.o: SchemeTaskMachine.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeTaskMachine.o SchemeTaskMachine.cpp
+
+${OBJECTDIR}/SchemeTrace.o: SchemeTrace.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SchemeTrace.o SchemeTrace.cpp
+
 ${OBJECTDIR}/SchemingPlusPlus.o: SchemingPlusPlus.cpp
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
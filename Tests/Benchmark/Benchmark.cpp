@@ -0,0 +1,287 @@
+// Benchmark.cpp
+//
+// Runs the Scheme programs beside this file (or those named on the command
+// line) a number of times under one evaluator, and reports for each the
+// min, median and 99th percentile run time, the allocations of a run and
+// the peak resident set size, as JSON.
+//
+// Each program ends with a form that is false if it computed the wrong
+// answer, so a faster evaluator that breaks a program is caught as well.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../../SchemingPlusPlus/SchemePlusPlus.h"
+
+#ifdef COMPILER_MSC
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace SchemingPlusPlus::Core;
+
+// Every allocation made through operator new, counted to report a run's allocations
+static std::atomic<size_t> allocation_count(0);
+static std::atomic<size_t> allocation_bytes(0);
+
+void *operator new(std::size_t size) {
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+	if (void *memory = std::malloc(size == 0 ? 1 : size))
+		return memory;
+	throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept {
+	std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept {
+	std::free(memory);
+}
+
+typedef std::chrono::steady_clock BenchClock;
+
+// The suite run when no programs are named
+static const char *suite[] = { "tak", "fib", "nqueens", "deriv", "destruct", "strings", "closures" };
+
+struct BenchResult {
+	std::string name;
+	bool ok = true;
+	std::string error;
+	std::vector<double> times_ms;
+	size_t allocations = 0;     // of the last run
+	size_t allocated_bytes = 0;
+	size_t environments = 0;
+	size_t peak_rss_kb = 0;     // of the whole runner, once the program has run
+};
+
+static std::unique_ptr<SchemeEvaluator> makeEvaluator(const std::string &name) {
+	if (name == "simple") return std::make_unique<SchemeSimpleEval>();
+	if (name == "analyze") return std::make_unique<SchemeAnalyzeEval>();
+	if (name == "vm") return std::make_unique<SchemeVMEval>();
+	if (name == "frame") return std::make_unique<SchemeFrameEval>();
+	return nullptr;
+}
+
+static size_t peakRssKb() {
+#ifdef COMPILER_MSC
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof counters))
+		return 0;
+	return counters.PeakWorkingSetSize / 1024;
+#else
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	return (size_t)usage.ru_maxrss / 1024; // bytes
+#else
+	return (size_t)usage.ru_maxrss;        // kilobytes
+#endif
+#endif
+}
+
+// Nearest rank percentile of sorted times
+static double percentile(const std::vector<double> &sorted, double p) {
+	size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+	return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+static double median(const std::vector<double> &sorted) {
+	size_t middle = sorted.size() / 2;
+	if (sorted.size() % 2 == 1)
+		return sorted[middle];
+	return (sorted[middle - 1] + sorted[middle]) / 2;
+}
+
+// Evaluate source in fresh globals. Parsing and the globals are not timed.
+static bool runOnce(const std::string &source, SchemeEvaluator &evaluator, BenchResult &result, bool timed) SCHEME_THROW {
+	SchemeReader reader;
+	reader.Feed(source);
+	reader.Finish();
+	VectorType forms;
+	SchemeCell form;
+	while (reader.Next(form))
+		forms.push_back(std::move(form));
+
+	EnvironmentType env = SchemeHeap::New();
+	SchemeHeap::Root env_root(env);
+	SchemeRuntime::AddGlobals(env);
+	SchemeCell env_cell(env);
+
+	size_t count_before = allocation_count, bytes_before = allocation_bytes;
+	size_t envs_before = SchemeHeap::Stats().Allocated;
+	SchemeCell value;
+	BenchClock::time_point start = BenchClock::now();
+	for (auto it = forms.cbegin(); it != forms.cend(); ++it)
+		value = evaluator.Eval(*it, env_cell);
+	BenchClock::time_point end = BenchClock::now();
+	if (timed) {
+		result.times_ms.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+		result.allocations = allocation_count - count_before;
+		result.allocated_bytes = allocation_bytes - bytes_before;
+		result.environments = SchemeHeap::Stats().Allocated - envs_before;
+	}
+	return value != SchemeConstants::False;
+}
+
+static BenchResult runProgram(const std::string &path, const std::string &evaluator_name, int runs, int warmups) {
+	BenchResult result;
+	size_t slash = path.find_last_of("/\\");
+	result.name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+	if (result.name.size() > 4 && result.name.compare(result.name.size() - 4, 4, ".scm") == 0)
+		result.name.resize(result.name.size() - 4);
+
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		result.ok = false;
+		result.error = "cannot open " + path;
+		return result;
+	}
+	std::stringstream source;
+	source << file.rdbuf();
+
+	std::unique_ptr<SchemeEvaluator> evaluator = makeEvaluator(evaluator_name);
+	try {
+		for (int i = 0; i < warmups + runs && result.ok; ++i) {
+			if (!runOnce(source.str(), *evaluator, result, i >= warmups)) {
+				result.ok = false;
+				result.error = "wrong answer";
+			}
+			// Each run starts from an empty heap
+			SchemeHeap::Collect();
+		}
+	} catch (critical_error &ce) {
+		result.ok = false;
+		result.error = ce.what();
+	}
+	result.peak_rss_kb = peakRssKb();
+	return result;
+}
+
+static std::string jsonString(const std::string &text) {
+	std::string quoted = "\"";
+	for (char c : text) {
+		if (c == '"' || c == '\\') {
+			quoted += '\\';
+			quoted += c;
+		} else if ((unsigned char)c < 0x20) {
+			std::ostringstream escape;
+			escape << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c;
+			quoted += escape.str();
+		} else {
+			quoted += c;
+		}
+	}
+	return quoted + "\"";
+}
+
+static void writeJson(std::ostream &out, const std::string &evaluator, int runs, const std::vector<BenchResult> &results) {
+	out << "{" << std::endl;
+	out << "  \"evaluator\": " << jsonString(evaluator) << "," << std::endl;
+	out << "  \"runs\": " << runs << "," << std::endl;
+	out << "  \"benchmarks\": [" << std::endl;
+	out << std::fixed << std::setprecision(3);
+	for (size_t i = 0; i < results.size(); ++i) {
+		const BenchResult &result = results[i];
+		out << "    { \"name\": " << jsonString(result.name) << ", \"ok\": " << (result.ok ? "true" : "false");
+		if (result.ok) {
+			std::vector<double> sorted(result.times_ms);
+			std::sort(sorted.begin(), sorted.end());
+			out << ", \"min_ms\": " << sorted.front()
+				<< ", \"median_ms\": " << median(sorted)
+				<< ", \"p99_ms\": " << percentile(sorted, 99)
+				<< ", \"allocations\": " << result.allocations
+				<< ", \"allocated_bytes\": " << result.allocated_bytes
+				<< ", \"environments\": " << result.environments;
+		} else {
+			out << ", \"error\": " << jsonString(result.error);
+		}
+		out << ", \"peak_rss_kb\": " << result.peak_rss_kb << " }"
+			<< (i + 1 < results.size() ? "," : "") << std::endl;
+	}
+	out << "  ]" << std::endl;
+	out << "}" << std::endl;
+}
+
+static void usage() {
+	std::cerr << "Usage: benchmark [options] [program.scm...]" << std::endl;
+	std::cerr << "program.scm...  Programs to run; by default the suite in the -d directory" << std::endl;
+	std::cerr << "-n runs         Timed runs of each program (default 10)" << std::endl;
+	std::cerr << "-w runs         Untimed warm up runs first (default 1)" << std::endl;
+	std::cerr << "-e evaluator    Evaluator: simple (default), analyze, vm or frame" << std::endl;
+	std::cerr << "-d directory    Where the suite is (default ../Tests/Benchmark)" << std::endl;
+	std::cerr << "-o file         Write the JSON results to file rather than standard output" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+	int runs = 10, warmups = 1;
+	std::string evaluator = "simple", directory = "../Tests/Benchmark", output;
+	std::vector<std::string> programs;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg(argv[i]);
+		if (arg == "-n" && i + 1 < argc)
+			runs = std::atoi(argv[++i]);
+		else if (arg == "-w" && i + 1 < argc)
+			warmups = std::atoi(argv[++i]);
+		else if (arg == "-e" && i + 1 < argc)
+			evaluator = argv[++i];
+		else if (arg == "-d" && i + 1 < argc)
+			directory = argv[++i];
+		else if (arg == "-o" && i + 1 < argc)
+			output = argv[++i];
+		else if (arg[0] != '-')
+			programs.push_back(arg);
+		else {
+			usage();
+			return 1;
+		}
+	}
+	if (runs < 1 || warmups < 0 || makeEvaluator(evaluator) == nullptr) {
+		usage();
+		return 1;
+	}
+	if (programs.empty())
+		for (const char *name : suite)
+			programs.push_back(directory + "/" + name + ".scm");
+
+	std::vector<BenchResult> results;
+	bool ok = true;
+	for (auto it = programs.cbegin(); it != programs.cend(); ++it) {
+		results.push_back(runProgram(*it, evaluator, runs, warmups));
+		const BenchResult &result = results.back();
+		if (result.ok)
+			std::cerr << result.name << ": " << std::fixed << std::setprecision(3)
+				<< *std::min_element(result.times_ms.cbegin(), result.times_ms.cend()) << " ms" << std::endl;
+		else
+			std::cerr << result.name << ": " << result.error << std::endl;
+		ok = ok && result.ok;
+	}
+
+	if (output.empty()) {
+		writeJson(std::cout, evaluator, runs, results);
+	} else {
+		std::ofstream out(output);
+		writeJson(out, evaluator, runs, results);
+		if (!out) {
+			std::cerr << output << ": cannot write" << std::endl;
+			return 1;
+		}
+	}
+	return ok ? 0 : 1;
+}
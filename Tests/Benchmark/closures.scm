@@ -0,0 +1,14 @@
+;; Closure heavy code: Church numerals, composition and counters
+(define zero (lambda (f) (lambda (x) x)))
+(define succ (lambda (n) (lambda (f) (lambda (x) (f ((n f) x))))))
+(define add (lambda (m n) (lambda (f) (lambda (x) ((m f) ((n f) x))))))
+(define church (lambda (k) (if (= k 0) zero (succ (church (- k 1))))))
+(define unchurch (lambda (n) ((n (lambda (i) (+ i 1))) 0)))
+(define compose (lambda (f g) (lambda (x) (f (g x)))))
+(define chain (lambda (k f) (if (= k 0) f (chain (- k 1) (compose f (lambda (x) (+ x 1)))))))
+(define make-counter (lambda () (begin (define n 0) (lambda () (begin (set! n (+ n 1)) n)))))
+(define tick (lambda (counter k) (if (= k 1) (counter) (begin (counter) (tick counter (- k 1))))))
+(define rounds (lambda (n total)
+	(if (= n 0) total
+		(rounds (- n 1) (+ total (unchurch (add (church 50) (church 50))) ((chain 50 (lambda (x) x)) 0) (tick (make-counter) 50))))))
+(= (rounds 40 0) 8000)
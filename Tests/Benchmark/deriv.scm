@@ -0,0 +1,16 @@
+;; Symbolic differentiation: builds and walks many small lists of symbols
+(define map1 (lambda (f items) (if (null? items) (quote ()) (cons (f (head items)) (map1 f (tail items))))))
+(define deriv (lambda (a)
+	(if (= (length a) 0)
+		(if (= a (quote x)) 1 0)
+		(if (= (head a) (quote +)) (cons (quote +) (map1 deriv (tail a)))
+			(if (= (head a) (quote -)) (cons (quote -) (map1 deriv (tail a)))
+				(if (= (head a) (quote *))
+					(list (quote *) a (cons (quote +) (map1 (lambda (b) (list (quote /) (deriv b) b)) (tail a))))
+					(quote error)))))))
+(define run (lambda (n result) (if (= n 0) result (run (- n 1) (deriv (quote (+ (* 3 x x) (* a x x) (* b x) 5)))))))
+(= (run 500 (quote ()))
+   (quote (+ (* (* 3 x x) (+ (/ 0 3) (/ 1 x) (/ 1 x)))
+             (* (* a x x) (+ (/ 0 a) (/ 1 x) (/ 1 x)))
+             (* (* b x) (+ (/ 0 b) (/ 1 x)))
+             0)))
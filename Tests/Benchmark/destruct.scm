@@ -0,0 +1,9 @@
+;; List rebuilding through set!: a stack kept in a variable, pushed and popped
+;; in place of pair mutation, which the runtime does not provide
+(define stack (quote ()))
+(define push! (lambda (x) (set! stack (cons x stack))))
+(define pop! (lambda () (begin (define top (head stack)) (set! stack (tail stack)) top)))
+(define fill (lambda (n) (if (= n 0) 0 (begin (push! n) (fill (- n 1))))))
+(define drain (lambda (total) (if (null? stack) total (drain (+ total (pop!))))))
+(define rounds (lambda (n total) (if (= n 0) total (begin (fill 100) (rounds (- n 1) (drain total))))))
+(= (rounds 100 0) 505000)
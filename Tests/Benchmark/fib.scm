@@ -0,0 +1,3 @@
+;; Doubly recursive Fibonacci: procedure calls and integer arithmetic
+(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))
+(= (fib 20) 6765)
@@ -0,0 +1,14 @@
+;; Solutions of the n queens problem by backtracking over lists
+(define iota1 (lambda (n) (if (= n 0) (quote ()) (cons n (iota1 (- n 1))))))
+(define ok? (lambda (row dist placed)
+	(if (null? placed) #t
+		(if (= (head placed) (+ row dist)) #f
+			(if (= (head placed) (- row dist)) #f
+				(ok? row (+ dist 1) (tail placed)))))))
+(define try (lambda (x y z)
+	(if (null? x)
+		(if (null? y) 1 0)
+		(+ (if (ok? (head x) 1 z) (try (append (tail x) y) (quote ()) (cons (head x) z)) 0)
+		   (try (tail x) (cons (head x) y) z)))))
+(define queens (lambda (n) (try (iota1 n) (quote ()) (quote ()))))
+(= (queens 7) 40)
@@ -0,0 +1,5 @@
+;; String building: repeated appends against repeated doubling
+(define repeat (lambda (s n acc) (if (= n 0) acc (repeat s (- n 1) (+ acc s)))))
+(define double (lambda (s n) (if (= n 0) s (double (+ s s) (- n 1)))))
+(define rounds (lambda (n ok) (if (= n 0) ok (rounds (- n 1) (= (repeat "ab" 512 "") (double "ab" 9))))))
+(rounds 20 #f)
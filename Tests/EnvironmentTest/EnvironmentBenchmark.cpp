@@ -0,0 +1,73 @@
+// EnvironmentBenchmark.cpp
+//
+// Timing test for SchemingPlusPlus::Core::SchemeEnvironment lookups.
+// Lookups return a binding handle and never copy a frame, so their cost
+// should stay flat as the global environment grows.
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "../../SchemingPlusPlus/SchemePlusPlus.h"
+
+using namespace SchemingPlusPlus::Core;
+
+#if _DEBUG
+static const long bench_iterations = 100000;
+#else
+static const long bench_iterations = 10000000;
+#endif
+
+typedef std::chrono::high_resolution_clock BenchClock;
+
+template<typename Fn>
+static double nanosecondsPerCall(Fn fn) {
+	auto start = BenchClock::now();
+	for (long i = 0; i < bench_iterations; ++i)
+		fn();
+	auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(BenchClock::now() - start);
+	return (double)elapsed.count() / bench_iterations;
+}
+
+void BenchmarkSchemeEnvironment() {
+	const size_t sizes[] = { 16, 256, 4096, 65536, 262144 };
+	volatile IntegerType sink = 0;
+
+	std::cout << "SchemeEnvironment lookup, " << bench_iterations << " iterations each (ns per lookup)" << std::endl;
+	std::cout << std::setw(10) << "globals"
+		<< std::setw(12) << "global"
+		<< std::setw(12) << "lexical"
+		<< std::setw(12) << "by name" << std::endl;
+
+	for (size_t size : sizes) {
+		EnvironmentType global = SchemeHeap::New();
+		SchemeHeap::Root global_root(global);
+		SchemeRuntime::AddGlobals(global);
+		for (size_t i = 0; i < size; ++i)
+			(*global)["bench-global-" + std::to_string(i)] = SchemeCell((IntegerType)i);
+
+		// Two closure frames, as for (lambda (a b c) (lambda (d) ...))
+		VectorType outer_args = { SchemeCell((IntegerType)1), SchemeCell((IntegerType)2), SchemeCell((IntegerType)3) };
+		VectorType inner_args = { SchemeCell((IntegerType)4) };
+		EnvironmentType outer = SchemeHeap::New(Read("(a b c)"), std::move(outer_args), global);
+		EnvironmentType inner = SchemeHeap::New(Read("(d)"), std::move(inner_args), outer);
+		SchemeHeap::Root inner_root(inner);
+
+		const AtomType global_atom = SchemeSymbols::Intern("bench-global-" + std::to_string(size / 2));
+		// b, one frame out, second slot; as annotated by SchemeLexical
+		SchemeCell param("b", SYMBOL);
+		param.LexicalDepth = 2;
+		param.LexicalSlot = 1;
+
+		double global_ns = nanosecondsPerCall([&]() { sink = sink + inner->Resolve(global_atom)->IntegerValue; });
+		double lexical_ns = nanosecondsPerCall([&]() { sink = sink + inner->ResolveLexical(param)->IntegerValue; });
+		double name_ns = nanosecondsPerCall([&]() { sink = sink + inner->Resolve(param.AtomValue)->IntegerValue; });
+
+		std::cout << std::setw(10) << size
+			<< std::fixed << std::setprecision(2)
+			<< std::setw(12) << global_ns
+			<< std::setw(12) << lexical_ns
+			<< std::setw(12) << name_ns << std::endl;
+	}
+}
@@ -7,6 +7,7 @@
 #include <string>
 
 // Forward declarations
+void BenchmarkSchemeEnvironment(); // EnvironmentBenchmark.cpp
 class Cell;
 class StringCell;
 class Atom;
@@ -220,6 +221,8 @@ int main()
 {
 	atoms::Initialise();
 
+	BenchmarkSchemeEnvironment();
+
 	return 0;
 }
 